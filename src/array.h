@@ -1,6 +1,253 @@
 /* -*- coding: utf-8 c-basic-offset: 2 tab-width: 2 indent-tabs-mode: nil -*- */
 /** \file */ /* Array template definition. */
 
+/** Memory block in an `Arena`, followed by the allocations. */
+typedef struct ArenaBlock {
+  /** Previous block, allocated before this one. */
+  struct ArenaBlock* previous;
+  /** Bytes available after this header. */
+  size_t size;
+  /** Bytes already allocated after this header. */
+  size_t used;
+} ArenaBlock;
+/** Bump allocator for short-lived arrays:
+    allocating is just moving forward a position in a block,
+    and freeing does nothing until everything is released
+    at once with `reset_Arena()`.                                       \n
+    Arrays get their memory from it if created with
+    `init_`T`_array_in()`. */
+typedef struct Arena {
+  /** Current block, the others are linked from it. */
+  ArenaBlock* block;
+  /** Minimum size for new blocks. */
+  size_t block_size;
+  /** Allocations made in the arena. */
+  size_t allocations;
+  /** Blocks obtained from `malloc()`. */
+  size_t blocks;
+} Arena;
+/** Alignment for allocations in an `Arena`. */
+#define ARENA_ALIGNMENT (2 * sizeof(void*))
+static size_t
+arena_round_up(size_t size)
+{
+  return (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+}
+static unsigned char*
+arena_block_data(ArenaBlock* block)
+{
+  return (unsigned char*)block + arena_round_up(sizeof(ArenaBlock));
+}
+/** Allocate `size` bytes, or return `NULL` if out of memory. */
+static void*
+arena_allocate(Arena* _, size_t size)
+{
+  size = arena_round_up(size);
+  ArenaBlock* block = _->block;
+  if (!block || block->size - block->used < size) {
+    size_t block_size = _->block_size? _->block_size: 64 * 1024;
+    if (block_size < size) block_size = size;
+    block = malloc(arena_round_up(sizeof(ArenaBlock)) + block_size);
+    if (!block) return NULL;
+    block->previous = _->block;
+    block->size = block_size;
+    block->used = 0;
+    _->block = block;
+    ++_->blocks;
+  }
+  void* allocation = arena_block_data(block) + block->used;
+  block->used += size;
+  ++_->allocations;
+  return allocation;
+}
+/** Resize an allocation from `size` to `new_size` bytes,
+    in place if it was the last one, otherwise by copying it.
+    Returns `NULL` if out of memory, in which case `allocation`
+    is still valid. */
+static void*
+arena_reallocate(Arena* _, void* allocation, size_t size, size_t new_size)
+{
+  ArenaBlock* block = _->block;
+  if (allocation && block &&
+      (unsigned char*)allocation + arena_round_up(size) ==
+      arena_block_data(block) + block->used &&
+      arena_round_up(new_size) - arena_round_up(size) <=
+      block->size - block->used) {
+    block->used += arena_round_up(new_size) - arena_round_up(size);
+    return allocation;
+  }
+  void* new_allocation = arena_allocate(_, new_size);
+  if (new_allocation && allocation) memcpy(new_allocation, allocation, size);
+  return new_allocation;
+}
+/** Position in an `Arena`, to go back to it with `rewind_Arena()`. */
+typedef struct ArenaMark {
+  /** Block that was current when the mark was taken. */
+  ArenaBlock* block;
+  /** Bytes that were in use in that block. */
+  size_t used;
+} ArenaMark;
+/** Take a mark at the current position of the arena. */
+static ArenaMark
+mark_Arena(Arena* _)
+{
+  return (ArenaMark){ _->block, _->block? _->block->used: 0 };
+}
+/** Release everything allocated in the arena after the mark,
+    freeing the blocks added since then. */
+static void
+rewind_Arena(Arena* _, ArenaMark mark)
+{
+  while (_->block != mark.block) {
+    ArenaBlock* previous = _->block->previous;
+    free(_->block);
+    _->block = previous;
+  }
+  if (_->block) _->block->used = mark.used;
+}
+/** Release everything allocated in the arena.
+    If it needed several blocks, they get replaced by one big enough
+    for all of them, so that the next time it needs only one. */
+static void
+reset_Arena(Arena* _)
+{
+  if (!_->block) return;
+  if (!_->block->previous) {
+    _->block->used = 0;
+    return;
+  }
+  size_t total = 0;
+  while (_->block) {
+    ArenaBlock* previous = _->block->previous;
+    total += _->block->size;
+    free(_->block);
+    _->block = previous;
+  }
+  if (total > _->block_size) _->block_size = total;
+}
+/** Release the memory blocks of the arena. */
+static void
+destruct_Arena(Arena* _)
+{
+  reset_Arena(_);
+  free(_->block);
+  _->block = NULL;
+}
+
+/** Blocks of at least this size get rounded up to a multiple of it,
+    which is the usual size of huge pages,
+    so that the system can use them for big arrays,
+    and growing them wastes at most one of those pages. */
+#define ARRAY_HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+/** Round up the capacity for elements of `element_size` bytes,
+    to a multiple of `ARRAY_HUGE_PAGE_SIZE` if that big. */
+static size_t
+array_round_up_capacity(size_t capacity, size_t element_size)
+{
+  size_t size = capacity * element_size;
+  if (size < ARRAY_HUGE_PAGE_SIZE) return capacity;
+  size = (size + ARRAY_HUGE_PAGE_SIZE - 1) / ARRAY_HUGE_PAGE_SIZE *
+      ARRAY_HUGE_PAGE_SIZE;
+  return size / element_size;
+}
+
+/** Bits of the `capacity` of an array that say where `start` comes from
+    when it is not a block from `malloc()`,
+    so that the array needs no extra fields for it:
+    `ARRAY_IN_ARENA` for a block in an `Arena`,
+    which keeps a pointer to the arena just before the elements,
+    and `ARRAY_INLINE_BUFFER` for the buffer of a small array,
+    see `DEFINE_SMALL_ARRAY_OF()`.                                      \n
+    The other bits are the actual capacity. */
+#define ARRAY_IN_ARENA      (~(SIZE_MAX >> 1))
+#define ARRAY_INLINE_BUFFER (ARRAY_IN_ARENA >> 1)
+#define ARRAY_MODE          (ARRAY_IN_ARENA | ARRAY_INLINE_BUFFER)
+/** Return the arena that owns the elements at `start`,
+    for an array whose capacity has the `ARRAY_IN_ARENA` bit. */
+static Arena*
+array_arena(const void* start)
+{
+  return *(Arena**)((unsigned char*)start - ARENA_ALIGNMENT);
+}
+
+#ifdef CEDRO_STATS
+/** Allocation statistics for all the arrays of one element type,
+    collected when compiled with `-DCEDRO_STATS`
+    and printed with `print_array_stats()`. */
+typedef struct ArrayStats {
+  /** Element type name. */
+  const char* type_name;
+  /** Size of each element in bytes. */
+  size_t element_size;
+  /** Blocks allocated for arrays that had none. */
+  size_t allocations;
+  /** Blocks grown with `realloc()`. */
+  size_t reallocations;
+  /** Blocks allocated or grown in an `Arena` instead. */
+  size_t arena_allocations;
+  /** Largest capacity reached by any array, in elements. */
+  size_t peak_capacity;
+  /** Bytes moved to open or close gaps in splice and delete. */
+  size_t bytes_moved;
+  /** Elements added by push, append, and splice. */
+  size_t pushed;
+  /** Whether it is already in `array_stats_list`. */
+  bool registered;
+  /** Next type in the list. */
+  struct ArrayStats* next;
+} ArrayStats;
+/** Types whose arrays have been used so far, most recent first. */
+static ArrayStats* array_stats_list = NULL;
+static ArrayStats*
+array_stats_of(ArrayStats* _)
+{
+  if (!_->registered) {
+    _->registered = true;
+    _->next = array_stats_list;
+    array_stats_list = _;
+  }
+  return _;
+}
+/** Print the statistics for each array type used so far. */
+static void
+print_array_stats(FILE* out)
+{
+  fprintf(out, "%-24s %6s %12s %12s %12s %14s %14s %12s\n",
+          "array", "size", "allocations", "reallocs", "arena",
+          "peak capacity", "bytes moved", "pushed");
+  ArrayStats total = { "total", 0 };
+  for (ArrayStats* s = array_stats_list; s; s = s->next) {
+    fprintf(out, "%-24s %6zu %12zu %12zu %12zu %14zu %14zu %12zu\n",
+            s->type_name, s->element_size, s->allocations, s->reallocations,
+            s->arena_allocations,
+            s->peak_capacity, s->bytes_moved, s->pushed);
+    total.allocations       += s->allocations;
+    total.reallocations     += s->reallocations;
+    total.arena_allocations += s->arena_allocations;
+    total.bytes_moved       += s->bytes_moved;
+    total.pushed            += s->pushed;
+  }
+  fprintf(out, "%-24s %6s %12zu %12zu %12zu %14s %14zu %12zu\n",
+          total.type_name, "", total.allocations, total.reallocations,
+          total.arena_allocations,
+          "", total.bytes_moved, total.pushed);
+}
+#define ARRAY_STATS_DEFINE(T)                                           \
+  static ArrayStats T##_array_stats = { #T "_array", sizeof(T) };
+#define ARRAY_STATS(T, FIELD, N)                                        \
+  (array_stats_of(&T##_array_stats)->FIELD += (N))
+#define ARRAY_STATS_PEAK(T, CAPACITY) do {                              \
+    ArrayStats* stats = array_stats_of(&T##_array_stats);               \
+    if ((CAPACITY) > stats->peak_capacity) {                            \
+      stats->peak_capacity = (CAPACITY);                                \
+    }                                                                   \
+  } while (0)
+#else
+#define ARRAY_STATS_DEFINE(T)
+#define ARRAY_STATS(T, FIELD, N)      ((void)0)
+#define ARRAY_STATS_PEAK(T, CAPACITY) ((void)0)
+#endif
+
 /** `DESTRUCT_BLOCK` is a block of code that releases the resources for a
     block of objects of type T, between `mut_T_p cursor` and `T_p end`. \n
     For instance:                                                       \n
@@ -8,7 +255,8 @@
     If the type does not need any clean-up, just use `{}`.              \n
     Defines the types:                                                  \n
     `mut_`T`_array`, `mut_`T`_array_p`, `mut_`T`_array_mut_p`,          \n
-    T`_array`, T`_array_p`, T`_array_mut_p`
+    T`_array`, T`_array_p`, T`_array_mut_p`,                            \n
+    `mut_`T`_gap_array`, `mut_`T`_gap_array_p`
 */
 #define DEFINE_ARRAY_OF(T, PADDING, DESTRUCT_BLOCK)                     \
   /** The constant `PADDING_##T##_ARRAY` = `PADDING`                    \
@@ -21,13 +269,15 @@
 typedef struct mut_##T##_array {                                        \
   /** Current length, the number of valid elements. */                  \
   size_t len;                                                           \
-  /** Maximum length before reallocation is needed. */                  \
+  /** Maximum length before reallocation is needed,                     \
+      plus the `ARRAY_MODE` bits, see `capacity_of_##T##_array()`. */   \
   size_t capacity;                                                      \
   /** The items stored in this array. */                                \
   mut_##T##_mut_p start;                                                \
 } mut_##T##_array, * const mut_##T##_array_p, * mut_##T##_array_mut_p;  \
 typedef const struct mut_##T##_array                                    \
 T##_array, * const T##_array_p, * T##_array_mut_p;                      \
+ARRAY_STATS_DEFINE(T)                                                   \
                                                                         \
 /**                                                                     \
    A mutable slice of an array where the elements are <b>const</b>ants. \
@@ -139,12 +389,38 @@ init_##T##_array(size_t initial_capacity)                               \
      but there are still other false positives and a smarter analyzer   \
      might catch future mistakes if we leve it uninitialized            \
      so it is better this way. */                                       \
+  ARRAY_STATS(T, allocations, 1);                                       \
+  ARRAY_STATS_PEAK(T, initial_capacity);                                \
   return (mut_##T##_array){                                             \
     .len = 0,                                                           \
     .capacity = initial_capacity,                                       \
     .start = malloc(initial_capacity * sizeof(T))                       \
   };                                                                    \
 }                                                                       \
+/** Initialize an array whose memory comes from the given arena,        \
+    and return by value.                                                \
+    Destructing it does not release the memory,                         \
+    that only happens with `reset_Arena()`,                             \
+    so it must not be used after that.                                  \
+    If `arena` is `NULL`, it is the same as `init_##T##_array()`.       \
+ */                                                                     \
+static mut_##T##_array                                                  \
+init_##T##_array_in(Arena* arena, size_t initial_capacity)              \
+{                                                                       \
+  if (!arena) return init_##T##_array(initial_capacity);                \
+  initial_capacity += PADDING;                                          \
+  ARRAY_STATS(T, arena_allocations, 1);                                 \
+  ARRAY_STATS_PEAK(T, initial_capacity);                                \
+  Arena** header = arena_allocate(arena, ARENA_ALIGNMENT +              \
+                                  initial_capacity * sizeof(T));        \
+  if (!header) return (mut_##T##_array){0};                             \
+  *header = arena;                                                      \
+  return (mut_##T##_array){                                             \
+    .len = 0,                                                           \
+    .capacity = initial_capacity | ARRAY_IN_ARENA,                      \
+    .start = (mut_##T##_mut_p)((unsigned char*)header + ARENA_ALIGNMENT)\
+  };                                                                    \
+}                                                                       \
 /** Heap-allocate and initialize a mut_##T##_array.                     \
  * This is the one that works more similarly to `new` in C++ or Java,   \
  * returning a pointer to the heap.                                     \
@@ -167,7 +443,11 @@ destruct_##T##_array(mut_##T##_array_p _)                               \
   if (_->capacity is_not 0) {                                           \
     /* _->capacity == 0 means that _->start is a non-owned pointer. */  \
     destruct_##T##_block((mut_##T##_p) _->start, _->start + _->len);    \
-    free((mut_##T##_mut_p) (_->start));                                 \
+    /* Arena memory gets released all at once by reset_Arena(),         \
+       and the buffer of a small array belongs to its owner. */         \
+    if (!(_->capacity & ARRAY_MODE)) {                                  \
+      free((mut_##T##_mut_p) (_->start));                               \
+    }                                                                   \
     *((mut_##T##_mut_p *) &(_->start)) = NULL;                          \
     _->capacity = 0;                                                    \
   }                                                                     \
@@ -188,6 +468,10 @@ free_##T##_array(mut_##T##_array_p _)                                   \
 /** Transfer ownership of any resources allocated for this struct.      \
     This just indicates that the caller is no longer responsible for    \
     releasing those resources.                                       \n \
+    If the elements are in the inline buffer of a small array,          \
+    they get copied to a new block because that buffer stays behind,    \
+    and the array is left empty but still using it.                     \
+    If the copy fails, the result has capacity `0` and `start` `NULL`.  \
    Example:                                                             \
    \code{.c}                                                            \
    T##_array a; init_##T##_array(&a, 10);                            \n \
@@ -200,6 +484,18 @@ free_##T##_array(mut_##T##_array_p _)                                   \
 static mut_##T##_array                                                  \
 move_##T##_array(mut_##T##_array_p _)                                   \
 {                                                                       \
+  if (_->capacity & ARRAY_INLINE_BUFFER) {                              \
+    mut_##T##_array copy = init_##T##_array(_->len);                    \
+    if (copy.start) {                                                   \
+      memcpy((void*) copy.start, _->start,                              \
+             _->len * sizeof(_->start[0]));                             \
+      copy.len = _->len;                                                \
+    } else {                                                            \
+      copy.capacity = 0;                                                \
+    }                                                                   \
+    _->len = 0;                                                         \
+    return copy;                                                        \
+  }                                                                     \
   mut_##T##_array transferred_copy = *_;                                \
   _->len = 0;                                                           \
   _->capacity = 0;                                                      \
@@ -207,6 +503,14 @@ move_##T##_array(mut_##T##_array_p _)                                   \
   return transferred_copy;                                              \
 }                                                                       \
                                                                         \
+/** Return the maximum length before reallocation is needed,            \
+    that is `_->capacity` without the `ARRAY_MODE` bits. */             \
+static size_t                                                           \
+capacity_of_##T##_array(T##_array_p _)                                  \
+{                                                                       \
+  return _->capacity & ~ARRAY_MODE;                                     \
+}                                                                       \
+                                                                        \
 /** Make sure that the array is ready to hold `minimum` elements,       \
     resizing the array if needed.                                       \
     Returns `false` if (re)allocation failed. */                        \
@@ -214,20 +518,79 @@ static bool                                                             \
 ensure_capacity_##T##_array(mut_##T##_array_p _, size_t minimum)        \
 {                                                                       \
   minimum += PADDING;                                                   \
-  if (minimum <= _->capacity) return true;                              \
+  size_t capacity = capacity_of_##T##_array(_);                         \
+  if (minimum <= capacity) return true;                                 \
   /* _->capacity == 0 means that _->start is a non-owned pointer. */    \
   size_t new_size = minimum;                                            \
-  if (_->capacity is 0) {                                               \
+  mut_##T##_mut_p view = NULL;                                          \
+  Arena* arena = NULL;                                                  \
+  if (_->capacity is 0 || (_->capacity & ARRAY_INLINE_BUFFER)) {        \
+    view = _->start; /* Copy its elements to the new block. */          \
     _->start = NULL;                                                    \
+    ARRAY_STATS(T, allocations, 1);                                     \
+    if (capacity) {                                                     \
+      new_size = 2*capacity + PADDING;                                  \
+    } else if (new_size < _->len + PADDING) {                           \
+      /* splice_##T##_array() moves the tail after this. */             \
+      new_size = _->len + PADDING;                                      \
+    }                                                                   \
+    if (minimum > new_size) new_size = minimum;                         \
   } else {                                                              \
-    new_size = 2*_->capacity + PADDING;                                 \
+    if (_->capacity & ARRAY_IN_ARENA) arena = array_arena(_->start);    \
+    if (arena) ARRAY_STATS(T, arena_allocations, 1);                    \
+    else       ARRAY_STATS(T, reallocations, 1);                        \
+    new_size = 2*capacity + PADDING;                                    \
     if (minimum > new_size) new_size = minimum;                         \
   }                                                                     \
+  mut_##T##_mut_p new_block;                                            \
+  if (arena) {                                                          \
+    /* The arena pointer before the elements gets copied with them. */  \
+    unsigned char* header = arena_reallocate(                           \
+        arena, (unsigned char*) _->start - ARENA_ALIGNMENT,             \
+        ARENA_ALIGNMENT + capacity * sizeof(_->start[0]),               \
+        ARENA_ALIGNMENT + new_size * sizeof(_->start[0]));              \
+    new_block = header? (mut_##T##_mut_p)(header + ARENA_ALIGNMENT):    \
+        NULL;                                                           \
+  } else {                                                              \
+    new_size = array_round_up_capacity(new_size, sizeof(T));            \
+    new_block = realloc((void*) _->start,                               \
+                        new_size * sizeof(_->start[0]));                \
+  }                                                                     \
+  if (!new_block) {                                                     \
+    if (view) _->start = view;                                          \
+    return false;                                                       \
+  }                                                                     \
+  if (view && _->len) {                                                 \
+    memcpy((void*) new_block, view, _->len * sizeof(_->start[0]));      \
+  }                                                                     \
+  _->start    = new_block;                                              \
+  _->capacity = new_size | (arena? ARRAY_IN_ARENA: 0);                  \
+  ARRAY_STATS_PEAK(T, new_size);                                        \
+  return true;                                                          \
+}                                                                       \
+                                                                        \
+/** Give back the memory beyond `capacity` elements if it has more      \
+    than twice that, for instance when reusing the array                \
+    for a smaller input.                                                \
+    Does nothing for views, small arrays, arenas,                       \
+    or if `capacity` is less than the current length.                   \
+    Returns `false` if reallocation failed,                             \
+    in which case the array is unchanged. */                            \
+static bool                                                             \
+shrink_##T##_array(mut_##T##_array_p _, size_t capacity)                \
+{                                                                       \
+  if (_->capacity is 0 || (_->capacity & ARRAY_MODE) ||                 \
+      capacity < _->len) {                                              \
+    return true;                                                        \
+  }                                                                     \
+  capacity = array_round_up_capacity(capacity + PADDING, sizeof(T));    \
+  if (_->capacity / 2 <= capacity) return true;                         \
   mut_##T##_p new_block = realloc((void*) _->start,                     \
-                                  new_size * sizeof(_->start[0]));      \
+                                  capacity * sizeof(_->start[0]));      \
   if (!new_block) return false;                                         \
+  ARRAY_STATS(T, reallocations, 1);                                     \
   _->start    = new_block;                                              \
-  _->capacity = new_size;                                               \
+  _->capacity = capacity;                                               \
   return true;                                                          \
 }                                                                       \
                                                                         \
@@ -239,6 +602,7 @@ push_##T##_array(mut_##T##_array_p _, T item)                           \
 {                                                                       \
   if (ensure_capacity_##T##_array(_, _->len + 1)) {                     \
     *((mut_##T##_p) _->start + _->len++) = item;                        \
+    ARRAY_STATS(T, pushed, 1);                                          \
     return true;                                                        \
   } else {                                                              \
     return false;                                                       \
@@ -282,8 +646,9 @@ splice_##T##_array(mut_##T##_array_p _,                                 \
   size_t insert_len = 0;                                                \
   size_t new_len = _->len - delete;                                     \
   if (insert.start_p is_not insert.end_p) {                             \
-    assert(_->start          > insert.end_p ||                          \
-           _->start + _->len < insert.start_p);                         \
+    /* Blocks from an arena can be adjacent, so touching is fine. */    \
+    assert(_->start          >= insert.end_p ||                         \
+           _->start + _->len <= insert.start_p);                        \
     assert(insert.end_p >= insert.start_p);                             \
     insert_len = (size_t)(insert.end_p - insert.start_p);               \
     new_len += insert_len;                                              \
@@ -294,6 +659,9 @@ splice_##T##_array(mut_##T##_array_p _,                                 \
   memmove((void*) (_->start + gap_end),                                 \
           _->start + position + delete,                                 \
           (_->len - delete - position) * sizeof(*_->start));            \
+  ARRAY_STATS(T, bytes_moved,                                           \
+              (_->len - delete - position) * sizeof(*_->start));        \
+  ARRAY_STATS(T, pushed, insert_len);                                   \
   _->len = _->len + insert_len - delete;                                \
   if (insert_len) {                                                     \
     memcpy((void*) (_->start + position),                               \
@@ -327,6 +695,8 @@ delete_##T##_array(mut_##T##_array_p _, size_t position, size_t delete) \
   memmove((void*) (_->start + position),                                \
           _->start + position + delete,                                 \
           (_->len - delete - position) * sizeof(*_->start));            \
+  ARRAY_STATS(T, bytes_moved,                                           \
+              (_->len - delete - position) * sizeof(*_->start));        \
   _->len -= delete;                                                     \
 }                                                                       \
                                                                         \
@@ -423,4 +793,184 @@ index_##T##_array(T##_array_p _, T##_p pointer)                         \
 {                                                                       \
   return (size_t)(pointer - _->start);                                  \
 }                                                                       \
+                                                                        \
+/** Array with a movable gap, for macros that walk forward              \
+    with a cursor and edit near it: inserting or deleting at the gap    \
+    only moves the elements being inserted or deleted,                  \
+    and moving the gap costs as many elements as it moves over,         \
+    instead of everything until the end as in `splice_##T##_array()`.\n \
+    It takes the block of a `mut_##T##_array`, and gives it back        \
+    with `flatten_##T##_gap_array()`,                                   \
+    which only has to move the elements after the gap.                  \
+    The elements before the gap are at the start of the block,          \
+    and those after it at the end. */                                   \
+typedef struct mut_##T##_gap_array {                                    \
+  /** The block, where `len` counts the elements on both sides. */      \
+  mut_##T##_array array;                                                \
+  /** Position of the gap, that is the number of elements before it. */ \
+  size_t gap;                                                           \
+} mut_##T##_gap_array, * const mut_##T##_gap_array_p;                   \
+                                                                        \
+/** Take over the block of `from`, with the gap at the end.             \
+    If it was a view or a small array, its elements get copied          \
+    to a new block, which is the only case where this allocates.        \
+ */                                                                     \
+static mut_##T##_gap_array                                              \
+init_##T##_gap_array(mut_##T##_array_p from)                            \
+{                                                                       \
+  mut_##T##_gap_array _ = { .array = move_##T##_array(from) };          \
+  if (_.array.capacity is 0) {                                          \
+    ensure_capacity_##T##_array(&_.array, _.array.len);                 \
+  }                                                                     \
+  _.gap = _.array.len;                                                  \
+  return _;                                                             \
+}                                                                       \
+                                                                        \
+/** Return a mutable pointer to the element at `position`.              \
+    Panics if the index is out of range. */                             \
+static mut_##T##_p                                                      \
+get_mut_##T##_gap_array(mut_##T##_gap_array_p _, size_t position)       \
+{                                                                       \
+  assert(position < _->array.len);                                      \
+  if (position >= _->gap) {                                             \
+    position += capacity_of_##T##_array(&_->array) - _->array.len;      \
+  }                                                                     \
+  return (mut_##T##_p) _->array.start + position;                       \
+}                                                                       \
+                                                                        \
+/** Move the gap to `position`, so that the elements before it          \
+    are contiguous from the start of the block,                         \
+    and those after it until the end of the block. */                   \
+static void                                                             \
+move_gap_##T##_gap_array(mut_##T##_gap_array_p _, size_t position)      \
+{                                                                       \
+  assert(position <= _->array.len);                                     \
+  size_t gap_len = capacity_of_##T##_array(&_->array) - _->array.len;   \
+  mut_##T##_mut_p start = (mut_##T##_mut_p) _->array.start;             \
+  if (position < _->gap) {                                              \
+    memmove((void*) (start + position + gap_len), start + position,     \
+            (_->gap - position) * sizeof(*start));                      \
+    ARRAY_STATS(T, bytes_moved, (_->gap - position) * sizeof(*start));  \
+  } else if (position > _->gap) {                                       \
+    memmove((void*) (start + _->gap), start + _->gap + gap_len,         \
+            (position - _->gap) * sizeof(*start));                      \
+    ARRAY_STATS(T, bytes_moved, (position - _->gap) * sizeof(*start));  \
+  }                                                                     \
+  _->gap = position;                                                    \
+}                                                                       \
+                                                                        \
+/** Splice the given `insert` slice in place of the removed elements,   \
+    like `splice_##T##_array()` but first moving the gap there          \
+    unless it is already inside the deleted range.                      \
+    Afterwards the gap is right after the inserted elements.            \
+    The `insert` slice must belong to a different array.                \
+    Returns `false` if (re)allocation failed. */                        \
+static bool                                                             \
+splice_##T##_gap_array(mut_##T##_gap_array_p _,                         \
+                       size_t position, size_t delete,                  \
+                       T##_array_slice insert)                          \
+{                                                                       \
+  assert(position + delete <= _->array.len);                            \
+  if (_->gap < position || _->gap > position + delete) {                \
+    move_gap_##T##_gap_array(_, position + delete);                     \
+  }                                                                     \
+  if (delete) {                                                         \
+    /* Before the gap, and after it: */                                 \
+    destruct_##T##_block((mut_##T##_p) _->array.start + position,       \
+                         _->array.start + _->gap);                      \
+    if (position + delete > _->gap) {                                   \
+      mut_##T##_p after = get_mut_##T##_gap_array(_, _->gap);           \
+      destruct_##T##_block(after, after + position + delete - _->gap);  \
+    }                                                                   \
+    _->array.len -= delete;                                             \
+    _->gap = position;                                                  \
+  }                                                                     \
+  assert(insert.end_p >= insert.start_p);                               \
+  size_t insert_len = (size_t)(insert.end_p - insert.start_p);          \
+  if (!insert_len) return true;                                         \
+  size_t capacity  = capacity_of_##T##_array(&_->array);                \
+  assert(_->array.start            >= insert.end_p ||                   \
+         _->array.start + capacity <= insert.start_p);                  \
+  size_t after_len = _->array.len - _->gap;                             \
+  if (!ensure_capacity_##T##_array(&_->array,                           \
+                                   _->array.len + insert_len)) {        \
+    return false;                                                       \
+  }                                                                     \
+  size_t new_capacity = capacity_of_##T##_array(&_->array);             \
+  if (new_capacity is_not capacity) {                                   \
+    mut_##T##_mut_p start = (mut_##T##_mut_p) _->array.start;           \
+    memmove((void*) (start + new_capacity - after_len),                 \
+            start + capacity - after_len,                               \
+            after_len * sizeof(*start));                                \
+    ARRAY_STATS(T, bytes_moved, after_len * sizeof(*start));            \
+  }                                                                     \
+  memcpy((void*) (_->array.start + _->gap), insert.start_p,             \
+         insert_len * sizeof(*insert.start_p));                         \
+  ARRAY_STATS(T, pushed, insert_len);                                   \
+  _->gap       += insert_len;                                           \
+  _->array.len += insert_len;                                           \
+  return true;                                                          \
+}                                                                       \
+                                                                        \
+/** Move the gap to the end and give back the block as a flat array,    \
+    leaving this one empty. */                                          \
+static mut_##T##_array                                                  \
+flatten_##T##_gap_array(mut_##T##_gap_array_p _)                        \
+{                                                                       \
+  move_gap_##T##_gap_array(_, _->array.len);                            \
+  _->gap = 0;                                                           \
+  return move_##T##_array(&_->array);                                   \
+}                                                                       \
+                                                                        \
+/** Release any resources allocated for this struct. */                 \
+static void                                                             \
+destruct_##T##_gap_array(mut_##T##_gap_array_p _)                       \
+{                                                                       \
+  move_gap_##T##_gap_array(_, _->array.len);                            \
+  _->gap = 0;                                                           \
+  destruct_##T##_array(&_->array);                                      \
+}                                                                       \
+                                                                        \
 static const size_t PADDING_##T##_ARRAY = PADDING//; commented out to avoid ;;.
+
+/** Inline buffer for arrays that usually stay under `N` elements,
+    including the `PADDING` given to `DEFINE_ARRAY_OF()`,
+    which must be used before for the same type `T`.                    \n
+    The buffer is typically a local variable, and
+    `init_`T`_small_array()` returns a normal `mut_`T`_array`
+    that uses it instead of allocating memory,
+    so all the functions for the array work the same.
+    Only when it needs more than `N` elements its contents
+    get copied to a block from `malloc()`.                              \n
+    The array must not be used after the buffer goes out of scope,
+    but it can be moved with `move_`T`_array()`.                        \n
+    Defines the types:                                                  \n
+    `mut_`T`_small_array_buffer`, `mut_`T`_small_array_buffer_p`
+*/
+#define DEFINE_SMALL_ARRAY_OF(T, N)                                     \
+/** Inline storage for `N` elements of a small array. */                \
+typedef struct mut_##T##_small_array_buffer {                           \
+  /** The items while they fit here. */                                 \
+  mut_##T items[N];                                                     \
+} mut_##T##_small_array_buffer, * const mut_##T##_small_array_buffer_p; \
+                                                                        \
+/** Initialize an array that keeps its elements in `buffer`             \
+    until it needs to grow, and then moves them to the heap.         \n \
+    For local variables, use it like this:                           \n \
+    \code{.c}                                                           \
+    mut_##T##_small_array_buffer buffer;                             \n \
+    mut_##T##_array things = init_##T##_small_array(&buffer);        \n \
+    {...}                                                            \n \
+    destruct_##T##_array(&things);                                   \n \
+    \endcode                                                            \
+ */                                                                     \
+static mut_##T##_array                                                  \
+init_##T##_small_array(mut_##T##_small_array_buffer_p buffer)           \
+{                                                                       \
+  return (mut_##T##_array){                                             \
+    .len = 0,                                                           \
+    .capacity = N | ARRAY_INLINE_BUFFER,                                \
+    .start = buffer->items                                              \
+  };                                                                    \
+}                                                                       \
+static const size_t SMALL_##T##_ARRAY_CAPACITY = N//; avoid ;;.
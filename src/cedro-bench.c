@@ -0,0 +1,497 @@
+/* -*- coding: utf-8 c-basic-offset: 2 tab-width: 2 indent-tabs-mode: nil -*- */
+/** \file */
+/** \mainpage
+ * Benchmark for the macro processing, on a generated corpus.
+ *
+ * \author Alberto González Palomo https://sentido-labs.com
+ * \copyright ©2021 Alberto González Palomo https://sentido-labs.com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma Cedro 1.0
+
+/* _POSIX_C_SOURCE is needed for clock_gettime() and mkdir(). */
+#define _POSIX_C_SOURCE 200809L
+
+// Get Cedro’s utility functions and typedefs.
+#define USE_CEDRO_AS_LIBRARY
+#include "cedro.c"
+
+#include <math.h>     // log2()
+#include <time.h>     // clock_gettime()
+#include <sys/stat.h> // mkdir(), stat()
+#include <sys/wait.h> // WIFEXITED(), WEXITSTATUS()
+
+/** Deterministic pseudo-random numbers, so that the corpus is always
+ * the same for the same scale. */
+static uint32_t
+next_random(uint32_t* state)
+{
+  *state = *state * 1103515245 + 12345;
+  return (*state >> 16) & 0x7FFF;
+}
+
+/* Each generator writes into `out` the input of size `n`
+ * for the C file `name`, and returns the size of any other files
+ * that it writes for it. */
+
+/** Write `n` functions with nested blocks,
+ * each with its own `auto` (deferred) cleanup,
+ * and exits through `return`, `break`, and `continue` at every level.
+ *  `pragma` is the Cedro `#pragma` line, that selects the lowering. */
+static size_t
+generate_defer_with(FILE* out, const char* pragma, size_t n)
+{
+  const size_t depth = 8;
+  fprintf(out, "%s\n"
+          "typedef struct Lock Lock;\n"
+          "Lock* lock(int n);\n"
+          "void unlock(Lock* lock);\n"
+          "int check(Lock* lock);\n",
+          pragma);
+  for (size_t f = 0; f is_not n; ++f) {
+    fprintf(out, "int f%zu(int a)\n{\n", f);
+    for (size_t level = 0; level is_not depth; ++level) {
+      fprintf(out, "%*sfor (int i%zu = 0; i%zu < a; ++i%zu) {\n",
+              (int)(2 * level + 2), "", level, level, level);
+      fprintf(out, "%*sLock* l%zu = lock(%zu);\n"
+              "%*sauto unlock(l%zu);\n"
+              "%*sif (check(l%zu) < 0) return -%zu;\n"
+              "%*sif (check(l%zu) > 1) break;\n"
+              "%*sif (check(l%zu) > 0) continue;\n",
+              (int)(2 * level + 4), "", level, level,
+              (int)(2 * level + 4), "", level,
+              (int)(2 * level + 4), "", level, level,
+              (int)(2 * level + 4), "", level,
+              (int)(2 * level + 4), "", level);
+    }
+    for (size_t level = depth; level is_not 0; --level) {
+      fprintf(out, "%*s}\n", (int)(2 * level), "");
+    }
+    fprintf(out, "  return 0;\n}\n");
+  }
+  return 0;
+}
+/** Deferred actions copied before each exit. */
+static size_t
+generate_defer(FILE* out, const char* name, size_t n)
+{
+  (void)name;
+  return generate_defer_with(out, "#pragma Cedro 1.0", n);
+}
+/** Deferred actions in a goto ladder. */
+static size_t
+generate_defer_ladder(FILE* out, const char* name, size_t n)
+{
+  (void)name;
+  return generate_defer_with(out, "#pragma Cedro 1.0 goto-ladder", n);
+}
+
+/** Write `n` statements, each a backstitch chain of 32 calls. */
+static size_t
+generate_backstitch(FILE* out, const char* name, size_t n)
+{
+  (void)name;
+  uint32_t seed = 1;
+  fprintf(out, "#pragma Cedro 1.0\nvoid f(Object* object)\n{\n");
+  for (size_t i = 0; i is_not n; ++i) {
+    fprintf(out, "  object @");
+    for (size_t j = 0; j is_not 32; ++j) {
+      fprintf(out, "%s\n    op%u(%zu)", j? ",": "",
+              next_random(&seed) % 100, i);
+    }
+    fprintf(out, ";\n");
+  }
+  fprintf(out, "}\n");
+  return 0;
+}
+
+/** Write a `#foreach` table with `n` rows,
+ * used to generate an `enum` and a table of strings. */
+static size_t
+generate_foreach(FILE* out, const char* name, size_t n)
+{
+  (void)name;
+  fprintf(out, "#pragma Cedro 1.0\n#foreach { ROWS {{ \\\n");
+  for (size_t i = 0; i is_not n; ++i) {
+    fprintf(out, "  {VALUE_%zu, %zu, \"value %zu\"}%s \\\n",
+            i, i, i, i + 1 is n? "": ",");
+  }
+  fprintf(out, "}}\n"
+          "typedef enum {\n"
+          "#foreach { {NAME, NUMBER, TEXT} ROWS\n"
+          "  NAME = NUMBER,\n"
+          "#foreach }\n"
+          "} Value;\n"
+          "const char* const Value_STRING[] = {\n"
+          "#foreach { {NAME, NUMBER, TEXT} ROWS\n"
+          "  TEXT,\n"
+          "#foreach }\n"
+          "};\n"
+          "#foreach }\n");
+  return 0;
+}
+
+/** Write `n` bytes into the binary file `name` with `.bin` instead of `.c`,
+ * and a C file that includes it with `#embed`. */
+static size_t
+generate_embed(FILE* out, const char* name, size_t n)
+{
+  mut_Byte_array binary_name = {0};
+  auto destruct_Byte_array(&binary_name);
+  push_str(&binary_name, name);
+  binary_name.len -= strlen(".c");
+  push_str(&binary_name, ".bin");
+  FILE* binary = fopen(as_c_string(&binary_name), "wb");
+  if (not binary) {
+    perror(as_c_string(&binary_name));
+    return 0;
+  }
+  uint32_t seed = 1;
+  for (size_t i = 0; i is_not n; ++i) {
+    fputc((int)(next_random(&seed) & 0xFF), binary);
+  }
+  fclose(binary);
+
+  const char* base_name = strrchr(as_c_string(&binary_name), '/');
+  base_name = base_name? base_name + 1: as_c_string(&binary_name);
+  fprintf(out, "#pragma Cedro 1.0\n"
+          "const unsigned char data[] = {\n#embed \"%s\"\n};\n", base_name);
+  return n;
+}
+
+/** Write `n` lines of plain C code without macros, in the same proportion
+ * of declarations, statements, and comments as typical code. */
+static size_t
+generate_plain(FILE* out, const char* name, size_t n)
+{
+  (void)name;
+  uint32_t seed = 1;
+  fprintf(out, "#pragma Cedro 1.0\n");
+  size_t line = 1;
+  for (size_t f = 0; line < n; ++f) {
+    fprintf(out, "/* Function number %zu. */\n"
+            "static int\nfunction_%zu(const int* a, size_t len)\n{\n"
+            "  int total = 0;\n",
+            f, f);
+    line += 6;
+    for (size_t i = 0; i is_not 20; ++i) {
+      fprintf(out, "  if (len > %u) total += a[%u] * %u; // Step %zu.\n",
+              next_random(&seed) % 64, next_random(&seed) % 64,
+              next_random(&seed), i);
+    }
+    line += 20;
+    fprintf(out, "  return total;\n}\n");
+    line += 2;
+  }
+  return 0;
+}
+
+typedef size_t (*Generator)(FILE* out, const char* name, size_t n);
+typedef struct {
+  /** Name of the input, used also for its file names. */
+  const char* name;
+  Generator generate;
+  /** Value of `n` for the generator at scale 1. */
+  size_t n;
+  /** Whether the result can be compiled, with `--cc`. */
+  bool compile;
+} Input;
+static const Input inputs[] = {
+  { "defer",        generate_defer,        200,             true  },
+  { "defer-ladder", generate_defer_ladder, 200,             true  },
+  { "backstitch",   generate_backstitch,   500,             false },
+  { "foreach",      generate_foreach,      5000,            false },
+  { "embed",        generate_embed,        4 * 1024 * 1024, false },
+  { "plain",        generate_plain,        1000 * 1000,     false },
+  { NULL, NULL, 0, false }
+};
+
+/** Returns the wall clock time in seconds. */
+static double
+wall_time(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
+
+/** Run `cedro` on `file_name` `runs` times, discarding its output,
+ * and return the shortest time in seconds, or a negative number
+ * if it failed. */
+static double
+time_cedro(const char* cedro, const char* file_name, size_t runs)
+{
+  mut_Byte_array cmd = {0};
+  auto destruct_Byte_array(&cmd);
+  push_fmt(&cmd, "'%s' '%s' >/dev/null", cedro, file_name);
+  double best = -1.0;
+  for (size_t run = 0; run is_not runs; ++run) {
+    double start = wall_time();
+    int status = system(as_c_string(&cmd));
+    double time = wall_time() - start;
+    if (status is -1 or not WIFEXITED(status) or WEXITSTATUS(status)) {
+      eprintln(LANG("Error al ejecutar: %s", "Error when running: %s"),
+               as_c_string(&cmd));
+      return -1.0;
+    }
+    if (best < 0 or time < best) best = time;
+  }
+  return best;
+}
+
+/** Compile with `cc` the result of running `cedro` on `file_name`,
+ * and return the time in seconds taken by the compiler,
+ * or a negative number if it failed.
+ *  `object_size` gets the size of the object file. */
+static double
+time_compiler(const char* cedro, const char* cc, const char* file_name,
+              size_t* object_size)
+{
+  mut_Byte_array cmd = {0};
+  auto destruct_Byte_array(&cmd);
+  push_fmt(&cmd, "'%s' '%s' >'%s.out.c'", cedro, file_name, file_name);
+  int status = system(as_c_string(&cmd));
+  if (status is -1 or not WIFEXITED(status) or WEXITSTATUS(status)) {
+    eprintln(LANG("Error al ejecutar: %s", "Error when running: %s"),
+             as_c_string(&cmd));
+    return -1.0;
+  }
+  cmd.len = 0;
+  push_fmt(&cmd, "%s -c '%s.out.c' -o '%s.o'", cc, file_name, file_name);
+  double start = wall_time();
+  status = system(as_c_string(&cmd));
+  double time = wall_time() - start;
+  if (status is -1 or not WIFEXITED(status) or WEXITSTATUS(status)) {
+    eprintln(LANG("Error al ejecutar: %s", "Error when running: %s"),
+             as_c_string(&cmd));
+    return -1.0;
+  }
+  cmd.len = 0;
+  push_fmt(&cmd, "%s.o", file_name);
+  struct stat object_status;
+  *object_size = stat(as_c_string(&cmd), &object_status) is 0?
+      (size_t)object_status.st_size: 0;
+  return time;
+}
+
+/** Result for one input. */
+typedef struct {
+  const char* name;
+  /** Size in bytes of the input at the given scale. */
+  size_t size;
+  /** Best time in seconds at the given scale. */
+  double seconds;
+  /** How the time grows with the size: 1 for linear, 2 for quadratic.
+   * Measured as `log2(t₂/t₁)` where `t₂` is the time for twice the size. */
+  double exponent;
+} Result;
+
+/** Find `name` in the baseline file contents,
+ * with lines in the format `<name> <seconds> <exponent>`. */
+static bool
+find_in_baseline(mut_Byte_array_p baseline, const char* name,
+                 double* seconds, double* exponent)
+{
+  size_t name_len = strlen(name);
+  const char* line = (const char*)as_c_string(baseline);
+  while (line and *line) {
+    if (strn_eq(line, name, name_len) and line[name_len] is ' ') {
+      return sscanf(line + name_len, "%lf %lf", seconds, exponent) is 2;
+    }
+    line = strchr(line, '\n');
+    if (line) ++line;
+  }
+  return false;
+}
+
+static const char* const
+usage_es =
+    "Uso: cedro-bench [opciones] <cedro>\n"
+    "  Genera entradas sintéticas en dos tamaños, y mide el tiempo que\n"
+    " tarda el ejecutable <cedro> dado en procesar cada una.\n"
+    "  El exponente indica cómo crece el tiempo con el tamaño:\n"
+    " 1 es lineal, 2 es cuadrático.\n"
+    "    --dir=<d>         Directorio para las entradas."
+    " Valor implícito: bin/bench\n"
+    "    --scale=<n>       Multiplica el tamaño de las entradas."
+    " Valor implícito: 1\n"
+    "    --runs=<n>        Repeticiones, se usa la más rápida."
+    " Valor implícito: 3\n"
+    "    --baseline=<f>    Compara con la referencia en ese fichero,\n"
+    "                      o la crea si no existe.\n"
+    "    --update          Sobreescribe la referencia.\n"
+    "    --threshold=<p>   Porcentaje de lentitud tolerado."
+    " Valor implícito: 25\n"
+    "    --cc=<cmd>        Compila también el resultado de las entradas que\n"
+    "                      lo permiten, como las dos formas de `auto`,\n"
+    "                      y muestra el tiempo y el tamaño del fichero objeto.\n"
+    ;
+static const char* const
+usage_en =
+    "Usage: cedro-bench [options] <cedro>\n"
+    "  Generates synthetic inputs in two sizes, and measures the time taken\n"
+    " by the given <cedro> executable to process each one.\n"
+    "  The exponent shows how the time grows with the size:\n"
+    " 1 is linear, 2 is quadratic.\n"
+    "    --dir=<d>         Directory for the inputs. Default value: bin/bench\n"
+    "    --scale=<n>       Multiplies the size of the inputs."
+    " Default value: 1\n"
+    "    --runs=<n>        Repetitions, the fastest is used."
+    " Default value: 3\n"
+    "    --baseline=<f>    Compares with the baseline in that file,\n"
+    "                      or creates it if it does not exist.\n"
+    "    --update          Overwrites the baseline.\n"
+    "    --threshold=<p>   Tolerated slowdown percentage. Default value: 25\n"
+    "    --cc=<cmd>        Compile also the result for the inputs that allow it,\n"
+    "                      such as both lowerings of `auto`,\n"
+    "                      and show the time and the object file size.\n"
+    ;
+
+int main(int argc, char* argv[])
+{
+  const char* dir = "bin/bench";
+  const char* cedro = NULL;
+  const char* baseline_file = NULL;
+  const char* cc = NULL;
+  double scale = 1.0;
+  double threshold = 25.0;
+  size_t runs = 3;
+  bool update = false;
+
+  for (int i = 1; i < argc; ++i) {
+    char* arg = argv[i];
+    if (strn_eq(arg, "--dir=", strlen("--dir="))) {
+      dir = arg + strlen("--dir=");
+    } else if (strn_eq(arg, "--scale=", strlen("--scale="))) {
+      scale = atof(arg + strlen("--scale="));
+    } else if (strn_eq(arg, "--runs=", strlen("--runs="))) {
+      runs = (size_t)atol(arg + strlen("--runs="));
+    } else if (strn_eq(arg, "--baseline=", strlen("--baseline="))) {
+      baseline_file = arg + strlen("--baseline=");
+    } else if (strn_eq(arg, "--threshold=", strlen("--threshold="))) {
+      threshold = atof(arg + strlen("--threshold="));
+    } else if (strn_eq(arg, "--cc=", strlen("--cc="))) {
+      cc = arg + strlen("--cc=");
+    } else if (str_eq(arg, "--update")) {
+      update = true;
+    } else if (str_eq(arg, "-h") or str_eq(arg, "--help")) {
+      eprint(LANG(usage_es, usage_en));
+      return EXIT_SUCCESS;
+    } else if (arg[0] is_not '-' and not cedro) {
+      cedro = arg;
+    } else {
+      eprint(LANG(usage_es, usage_en));
+      eprintln(LANG("Error: opción desconocida: %s",
+                    "Error: unknown option: %s"),
+               arg);
+      return EINVAL;
+    }
+  }
+  if (not cedro or scale <= 0 or runs is 0) {
+    eprint(LANG(usage_es, usage_en));
+    return EINVAL;
+  }
+
+  if (mkdir(dir, 0777) is -1 and errno is_not EEXIST) {
+    perror(dir);
+    return errno;
+  }
+
+  mut_Byte_array baseline = {0};
+  auto destruct_Byte_array(&baseline);
+  bool compare = baseline_file and not update and
+      read_file(&baseline, baseline_file) is 0;
+  if (baseline_file and not compare) update = true;
+
+  FILE* baseline_out = NULL;
+  if (update) {
+    baseline_out = fopen(baseline_file, "w");
+    if (not baseline_out) {
+      perror(baseline_file);
+      return errno;
+    }
+  }
+  auto if (baseline_out) fclose(baseline_out);
+
+  int return_code = EXIT_SUCCESS;
+  mut_Byte_array file_name = {0};
+  auto destruct_Byte_array(&file_name);
+
+  fprintf(stdout, "%-12s %12s %10s %9s\n",
+          "input", "bytes", "seconds", "exponent");
+  for (const Input* input = inputs; input->name; ++input) {
+    double seconds[2];
+    size_t size = 0;
+    for (size_t k = 0; k is_not 2; ++k) {
+      size_t n = (size_t)(scale * (double)input->n) << k;
+      file_name.len = 0;
+      push_fmt(&file_name, "%s/%s-%zu.c", dir, input->name, n);
+      FILE* out = fopen(as_c_string(&file_name), "w");
+      if (not out) {
+        perror(as_c_string(&file_name));
+        return errno;
+      }
+      size_t other_size = input->generate(out, as_c_string(&file_name), n);
+      if (k is 0) size = (size_t)ftell(out) + other_size;
+      fclose(out);
+      seconds[k] = time_cedro(cedro, as_c_string(&file_name), runs);
+      if (seconds[k] < 0) return 1;
+    }
+    Result result = {
+      .name     = input->name,
+      .size     = size,
+      .seconds  = seconds[0],
+      .exponent = log2(seconds[1] / seconds[0])
+    };
+    fprintf(stdout, "%-12s %12zu %10.4f %9.2f",
+            result.name, result.size, result.seconds, result.exponent);
+
+    double base_seconds, base_exponent;
+    if (baseline_out) {
+      fprintf(baseline_out, "%s %.6f %.3f\n",
+              result.name, result.seconds, result.exponent);
+    } else if (compare and
+               find_in_baseline(&baseline, result.name,
+                                &base_seconds, &base_exponent)) {
+      double change = 100.0 * (result.seconds / base_seconds - 1.0);
+      fprintf(stdout, " %+6.1f%%", change);
+      // The exponent is too noisy to compare in detail, and more so
+      // for very short times: only report it when it becomes superlinear.
+      if (change > threshold or
+          (result.seconds > 0.05 and result.exponent > 1.5 and
+           result.exponent > base_exponent + 0.3)) {
+        fprintf(stdout, LANG(" ← REGRESIÓN", " ← REGRESSION"));
+        return_code = 1;
+      }
+    }
+    if (cc and input->compile) {
+      size_t object_size = 0;
+      double cc_seconds = time_compiler(cedro, cc, as_c_string(&file_name),
+                                        &object_size);
+      if (cc_seconds < 0) return 1;
+      fprintf(stdout, "  cc: %.4f s, %zu %s",
+              cc_seconds, object_size, LANG("octetos", "bytes"));
+    }
+    fprintf(stdout, "\n");
+    fflush(stdout);
+  }
+
+  if (baseline_out) {
+    eprintln(LANG("Referencia guardada en %s", "Baseline written to %s"),
+             baseline_file);
+  }
+
+  return return_code;
+}
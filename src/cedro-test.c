@@ -5,6 +5,60 @@
 #define run_test(name) test_##name(); eprintln("OK: " #name)
 #define eq(a, b) (a == b)
 
+void test_intern_symbol()
+{
+  mut_SymbolTable table = init_SymbolTable();
+  Byte_p text = B("alpha beta alpha");
+  SymbolId alpha = intern_symbol(&table, text, text + 5);
+  SymbolId beta  = intern_symbol(&table, text + 6, text + 10);
+  assert(alpha && beta && alpha is_not beta);
+  // Same text at another position, same ID:
+  assert(eq(intern_symbol(&table, text + 11, text + 16), alpha));
+  // Prefixes are different symbols:
+  SymbolId alp = intern_symbol(&table, text, text + 3);
+  assert(alp is_not alpha && alp is_not beta);
+
+  // The IDs stay the same when the hash table grows,
+  // and the table keeps its own copy of the text.
+  char name[16];
+  mut_SymbolId ids[3000];
+  for (size_t i = 0; i < 3000; ++i) {
+    snprintf(name, sizeof(name), "id_%zu", i);
+    ids[i] = intern_symbol(&table, B(name), B(name) + strlen(name));
+    assert(ids[i]);
+  }
+  assert(table.slots.len >= 2 * table.symbols.len);
+  for (size_t i = 0; i < 3000; ++i) {
+    snprintf(name, sizeof(name), "id_%zu", i);
+    assert(eq(intern_symbol(&table, B(name), B(name) + strlen(name)), ids[i])
+           || (eprintln("Symbol %s changed", name), false));
+  }
+  assert(eq(intern_symbol(&table, text, text + 5), alpha));
+  assert(eq(table.symbols.len, 3003));
+
+  // parse() interns identifiers, including labels.
+  Byte_p code = B("void f(void) { goto end; end: ; }");
+  mut_Byte_array src = init_Byte_array(100);
+  append_Byte_array(&src, (Byte_array_slice){ code,
+                                              code + strlen((char*)code) });
+  mut_Marker_array markers = init_Marker_array(100);
+  assert(eq(parse(&src, bounds_of_Byte_array(&src), &markers, false, &table),
+            end_of_Byte_array(&src)));
+  mut_SymbolId goto_target = 0, label = 0;
+  for (Marker_mut_p m = start_of_Marker_array(&markers);
+       m is_not end_of_Marker_array(&markers); ++m) {
+    if (m->token_type is T_CONTROL_FLOW_LABEL) label = m->symbol;
+    else if (m->token_type is T_IDENTIFIER and m->len is 3) {
+      goto_target = m->symbol;
+    }
+  }
+  assert(label && eq(label, goto_target));
+  destruct_Marker_array(&markers);
+  destruct_Byte_array(&src);
+
+  destruct_SymbolTable(&table);
+}
+
 void test_number()
 {
   Byte_p text = B("100");
@@ -35,6 +89,22 @@ char* to_string_Byte_array(Byte_array_p array)
   return string;
 }
 
+/** Parse `text` into `markers` and `src` as `cedro` does,
+ * updating `options` with its pragma. */
+static void
+parse_test_source(const char* text, mut_Marker_array_p markers,
+                  mut_Byte_array_p src, mut_Options_p options)
+{
+  src->len = 0;
+  markers->len = 0;
+  append_Byte_array(src, (Byte_array_slice){ B(text), B(text) + strlen(text) });
+  Byte_array_mut_slice region = bounds_of_Byte_array(src);
+  region.start_p = parse_skip_until_cedro_pragma(src, region, markers,
+                                                 options);
+  assert(eq(parse(src, region, markers,
+                  options->use_defer_instead_of_auto, NULL), region.end_p));
+}
+
 void test_array()
 {
   Byte_p text = B("En un lugar de La Mancha, de cuyo nombre no quiero acordarme, no ha mucho tiempo que vivía un hidalgo de los de lanza en astillero, adarga antigua, rocín flaco y galgo corredor.");
@@ -81,10 +151,626 @@ void test_array()
   free(text_rebuilt);
 }
 
+void test_apply_macros()
+{
+  // The first function is fine, the second one has an error,
+  // and the third one another that is not the first one reported.
+  const char* text =
+      "#pragma Cedro 1.0\n"
+      "void f(void) { char* p = malloc(1); auto free(p); if (!p) return; }\n"
+      "void g(void) { char* p = malloc(1); auto free(p); goto; }\n"
+      "void h(void) { char* p = malloc(1); auto free(p); break; }\n";
+  mut_Options options = DEFAULT_OPTIONS;
+  mut_Marker_array markers = init_Marker_array(100);
+  mut_Byte_array src = init_Byte_array(100);
+  mut_Marker_array serial_markers = init_Marker_array(100);
+  mut_Byte_array serial_src = init_Byte_array(100);
+  parse_test_source(text, &serial_markers, &serial_src, &options);
+  for (Macro_p macro = macros; macro->name and macro->function; ++macro) {
+    apply_macro(macro, &serial_markers, &serial_src, &options, NULL);
+  }
+  assert(has_macro_error(&serial_markers, &serial_src));
+
+#ifdef CEDRO_THREADS
+  // In parallel it gives up, leaving the markers for the serial fallback.
+  options = DEFAULT_OPTIONS;
+  parse_test_source(text, &markers, &src, &options);
+  size_t markers_len = markers.len, src_len = src.len;
+  assert(not apply_macros_in_parallel(&markers, &src, &options, 3));
+  assert(eq(markers.len, markers_len) && eq(src.len, src_len));
+#endif
+
+  // The fallback applies the macros again one after another
+  // to the whole array, so the result is the same error.
+  options = DEFAULT_OPTIONS;
+  parse_test_source(text, &markers, &src, &options);
+  apply_macros(&markers, &src, &options, NULL);
+  assert(eq(markers.len, serial_markers.len) ||
+         (eprintln("Markers: %zu ≠ %zu", markers.len, serial_markers.len),
+          false));
+  for (size_t i = 0; i < markers.len; ++i) {
+    Marker_p m = &markers.start[i], serial_m = &serial_markers.start[i];
+    assert(eq(m->token_type, serial_m->token_type));
+    assert(eq(m->len, serial_m->len) &&
+           mem_eq(src.start + m->start, serial_src.start + serial_m->start,
+                  m->len));
+  }
+
+  destruct_Marker_array(&markers);
+  destruct_Byte_array(&src);
+  destruct_Marker_array(&serial_markers);
+  destruct_Byte_array(&serial_src);
+}
+
+void test_arena()
+{
+  // The arena and inline buffer modes are in `capacity`, not extra fields.
+  assert(eq(sizeof(mut_Byte_array), 3 * sizeof(size_t)) ||
+         (eprintln("Array size %zu", sizeof(mut_Byte_array)), false));
+
+  Arena arena = {0};
+  mut_Byte_array array = init_Byte_array_in(&arena, 4);
+  assert(eq((array.capacity & ARRAY_MODE), ARRAY_IN_ARENA));
+  assert(eq(array_arena(array.start), &arena));
+  assert(eq(capacity_of_Byte_array(&array), 4 + PADDING_Byte_ARRAY));
+  Byte_p text = B("En un lugar de La Mancha");
+  size_t text_len = strlen((const char*) text);
+  for (size_t i = 0; i < text_len; ++i) push_Byte_array(&array, text[i]);
+  // Grown in place, because it is the last allocation in the arena.
+  assert(eq((array.capacity & ARRAY_MODE), ARRAY_IN_ARENA));
+  assert(eq(arena.allocations, 1) ||
+         (eprintln("Arena allocations %zu", arena.allocations), false));
+  assert(eq(memcmp(array.start, text, text_len), 0));
+
+  // Another allocation in between makes it move to a new block
+  // in the same arena, keeping the elements.
+  mut_Marker_array other = init_Marker_array_in(&arena, 100);
+  ensure_capacity_Byte_array(&array, 1000);
+  assert(eq(array_arena(array.start), &arena));
+  assert(eq(capacity_of_Byte_array(&array), 1000 + PADDING_Byte_ARRAY));
+  assert(eq(memcmp(array.start, text, text_len), 0));
+  // Destructing them does not release the memory, only forgets it.
+  destruct_Marker_array(&other);
+  assert(eq(other.capacity, 0) && eq(other.start, NULL));
+  destruct_Byte_array(&array);
+
+  // Rewinding releases what came after the mark,
+  // and the next allocations reuse that memory.
+  ArenaMark mark = mark_Arena(&arena);
+  other = init_Marker_array_in(&arena, 100);
+  Marker_p first_start = other.start;
+  rewind_Arena(&arena, mark);
+  other = init_Marker_array_in(&arena, 100);
+  assert(eq(other.start, first_start));
+  destruct_Marker_array(&other);
+
+  // After a reset, everything is available again in one block.
+  for (size_t i = 0; i < 100; ++i) {
+    mut_Marker_array big = init_Marker_array_in(&arena, 10000);
+    assert(big.start);
+  }
+  assert(arena.blocks > 1);
+  reset_Arena(&arena);
+  assert(arena.block_size >= 100 * 10000 * sizeof(Marker));
+  size_t blocks = arena.blocks;
+  for (size_t i = 0; i < 100; ++i) {
+    mut_Marker_array big = init_Marker_array_in(&arena, 10000);
+    assert(big.start);
+  }
+  assert(eq(arena.blocks, blocks + 1) ||
+         (eprintln("New blocks after reset: %zu", arena.blocks - blocks),
+          false));
+  reset_Arena(&arena);
+  assert(eq(arena.block->used, 0));
+
+  // Moving an arena array keeps it there, and with a `NULL` arena
+  // it is the same as a heap array.
+  array = init_Byte_array_in(&arena, 10);
+  mut_Byte_array moved_array = move_Byte_array(&array);
+  assert(eq((moved_array.capacity & ARRAY_MODE), ARRAY_IN_ARENA));
+  assert(eq(array.capacity, 0) && eq(array.start, NULL));
+  array = init_Byte_array_in(NULL, 10);
+  assert(eq((array.capacity & ARRAY_MODE), 0));
+  destruct_Byte_array(&array);
+
+  destruct_Arena(&arena);
+  assert(eq(arena.block, NULL));
+}
+
+void test_small_array()
+{
+  mut_TokenType_small_array_buffer buffer;
+  mut_TokenType_array array = init_TokenType_small_array(&buffer);
+  assert(eq((array.capacity & ARRAY_MODE), ARRAY_INLINE_BUFFER));
+  assert(eq(capacity_of_TokenType_array(&array),
+            SMALL_TokenType_ARRAY_CAPACITY));
+  size_t i = 0;
+  for (; i < SMALL_TokenType_ARRAY_CAPACITY; ++i) {
+    push_TokenType_array(&array, (TokenType)(i % T_OTHER));
+  }
+  // Still in the buffer:
+  assert(eq(array.start, buffer.items));
+
+  // Moving it copies the elements out of the buffer,
+  // and leaves the array empty but still using it.
+  mut_TokenType_array moved = move_TokenType_array(&array);
+  assert(eq((moved.capacity & ARRAY_MODE), 0));
+  assert(eq(moved.len, SMALL_TokenType_ARRAY_CAPACITY));
+  assert(eq(memcmp(moved.start, buffer.items, sizeof(buffer.items)), 0));
+  assert(eq(array.len, 0) && eq(array.start, buffer.items));
+  destruct_TokenType_array(&moved);
+
+  // Spills to the heap when it needs more than the buffer:
+  for (i = 0; i < SMALL_TokenType_ARRAY_CAPACITY + 1; ++i) {
+    push_TokenType_array(&array, (TokenType)(i % T_OTHER));
+  }
+  assert(array.start is_not buffer.items);
+  assert(eq((array.capacity & ARRAY_MODE), 0));
+  assert(capacity_of_TokenType_array(&array) >=
+         2 * SMALL_TokenType_ARRAY_CAPACITY);
+  assert(eq(array.len, SMALL_TokenType_ARRAY_CAPACITY + 1));
+  for (i = 0; i < array.len; ++i) {
+    assert(eq(*get_TokenType_array(&array, i), (TokenType)(i % T_OTHER)) ||
+           (eprintln("Wrong element at %zu", i), false));
+  }
+  // From there on it is a normal heap array, released by destruct.
+  destruct_TokenType_array(&array);
+  assert(eq(array.capacity, 0) && eq(array.start, NULL));
+
+  // Destructing it while in the buffer does not free anything.
+  array = init_TokenType_small_array(&buffer);
+  push_TokenType_array(&array, T_NONE);
+  destruct_TokenType_array(&array);
+  assert(eq(array.capacity, 0) && eq(array.start, NULL));
+}
+
+char* to_string_Byte_gap_array(mut_Byte_gap_array_p array)
+{
+  char* string = malloc(array->array.len * sizeof(char) + 1);
+  for (size_t i = 0; i < array->array.len; ++i) {
+    string[i] = (char)*get_mut_Byte_gap_array(array, i);
+  }
+  string[array->array.len] = 0;
+  return string;
+}
+
+#define assert_gap_array_is(array, expected) do {                   \
+    char* text = to_string_Byte_gap_array(array);                   \
+    assert(str_eq(text, expected) ||                                \
+           (eprintln("Gap array: “%s” ≠ “%s”", text, expected),     \
+            false));                                                \
+    free(text);                                                     \
+  } while (0)
+
+void test_gap_array()
+{
+  // From a view, the elements get copied to a new block.
+  mut_Byte_array view = { .len = 6, .start = (mut_Byte_p) "abcdef" };
+  mut_Byte_gap_array array = init_Byte_gap_array(&view);
+  assert(array.array.capacity is_not 0);
+  assert(eq(array.gap, 6));
+  assert_gap_array_is(&array, "abcdef");
+
+  // Move the gap past the start, and insert there.
+  move_gap_Byte_gap_array(&array, 0);
+  assert_gap_array_is(&array, "abcdef");
+  splice_Byte_gap_array(&array, 0, 0, (Byte_array_slice){ B("XY"), B("XY")+2 });
+  assert(eq(array.gap, 2));
+  assert_gap_array_is(&array, "XYabcdef");
+
+  // Delete after the gap, and then before it.
+  splice_Byte_gap_array(&array, 4, 2, (Byte_array_slice){0});
+  assert(eq(array.gap, 4));
+  assert_gap_array_is(&array, "XYabef");
+  splice_Byte_gap_array(&array, 1, 2, (Byte_array_slice){0});
+  assert(eq(array.gap, 1));
+  assert_gap_array_is(&array, "Xbef");
+
+  // Delete and insert across the gap.
+  splice_Byte_gap_array(&array, 0, 3, (Byte_array_slice){ B("12"), B("12")+2 });
+  assert(eq(array.gap, 2));
+  assert_gap_array_is(&array, "12f");
+
+  // Move the gap past the end, and insert there.
+  move_gap_Byte_gap_array(&array, array.array.len);
+  splice_Byte_gap_array(&array, 3, 0, (Byte_array_slice){ B("Z"), B("Z")+1 });
+  assert_gap_array_is(&array, "12fZ");
+
+  // Grow the block with the gap in the middle:
+  // the elements after it must move to the new end.
+  Byte_p long_text = B("En un lugar de La Mancha, de cuyo nombre");
+  size_t long_len = strlen((const char*) long_text);
+  for (size_t i = 0; i < 20; ++i) {
+    size_t capacity = capacity_of_Byte_array(&array.array);
+    Byte_array_slice insert = { long_text, long_text + long_len };
+    splice_Byte_gap_array(&array, 2, 0, insert);
+    move_gap_Byte_gap_array(&array, 2);
+    if (capacity_of_Byte_array(&array.array) is_not capacity) {
+      assert(eq(*get_mut_Byte_gap_array(&array, array.array.len - 1), 'Z'));
+    }
+  }
+  assert(eq(array.array.len, 4 + 20 * long_len));
+  move_gap_Byte_gap_array(&array, 0);
+  move_gap_Byte_gap_array(&array, array.array.len);
+  move_gap_Byte_gap_array(&array, 2);
+
+  mut_Byte_array flat = flatten_Byte_gap_array(&array);
+  assert(eq(flat.len, 4 + 20 * long_len));
+  assert(eq(memcmp(flat.start, "12", 2), 0));
+  assert(eq(memcmp(flat.start + flat.len - 2, "fZ", 2), 0));
+  for (size_t i = 0; i < 20; ++i) {
+    assert(eq(memcmp(flat.start + 2 + i * long_len, long_text, long_len), 0));
+  }
+  assert(eq(array.array.len, 0) && eq(array.array.capacity, 0));
+  destruct_Byte_array(&flat);
+  destruct_Byte_gap_array(&array);
+}
+
+void test_shrink()
+{
+  // A heap array gets shrunk when it has more than twice the capacity.
+  mut_Byte_array array = init_Byte_array(10000);
+  push_str(&array, "abc");
+  assert(shrink_Byte_array(&array, 100));
+  assert(eq(capacity_of_Byte_array(&array), 100 + PADDING_Byte_ARRAY));
+  assert(eq(memcmp(array.start, "abc", 3), 0));
+  // But not below its length, nor if it is less than twice as big.
+  assert(shrink_Byte_array(&array, 2));
+  assert(shrink_Byte_array(&array, 60));
+  assert(eq(capacity_of_Byte_array(&array), 100 + PADDING_Byte_ARRAY));
+  destruct_Byte_array(&array);
+
+  // Views, arenas, and inline buffers stay untouched.
+  mut_Byte_array view = { .len = 3, .start = (mut_Byte_p) "abc" };
+  assert(shrink_Byte_array(&view, 0));
+  assert(eq(view.capacity, 0) && eq(view.len, 3));
+  assert(str_eq((const char*) view.start, "abc"));
+
+  Arena arena = {0};
+  array = init_Byte_array_in(&arena, 10000);
+  size_t capacity = array.capacity;
+  Byte_p start = array.start;
+  assert(shrink_Byte_array(&array, 0));
+  assert(eq(array.capacity, capacity) && eq(array.start, start));
+  destruct_Arena(&arena);
+
+  mut_TokenType_small_array_buffer buffer;
+  mut_TokenType_array small = init_TokenType_small_array(&buffer);
+  capacity = small.capacity;
+  assert(shrink_TokenType_array(&small, 0));
+  assert(eq(small.capacity, capacity) && eq(small.start, buffer.items));
+  destruct_TokenType_array(&small);
+}
+
+/** Write a token stream for `text` to `path`, parsed with default options. */
+static void
+write_test_token_stream(const char* path, const char* text)
+{
+  mut_Options options = DEFAULT_OPTIONS;
+  Options options_before_pragma = options;
+  mut_Byte_array src = init_Byte_array(100);
+  mut_Marker_array markers = init_Marker_array(100);
+  parse_test_source(text, &markers, &src, &options);
+  FILE* file = fopen(path, "wb");
+  assert(file);
+  assert(eq(write_token_stream(file, &markers, &src,
+                               token_stream_options(options_before_pragma,
+                                                    options)), 0));
+  fclose(file);
+  destruct_Marker_array(&markers);
+  destruct_Byte_array(&src);
+}
+
+/** Overwrite `len` bytes at `offset` in the file at `path`. */
+static void
+patch_test_file(const char* path, long offset, const void* bytes, size_t len)
+{
+  FILE* file = fopen(path, "r+b");
+  assert(file);
+  assert(eq(fseek(file, offset, SEEK_SET), 0));
+  assert(eq(fwrite(bytes, 1, len, file), len));
+  fclose(file);
+}
+
+void test_token_stream()
+{
+  const char* path = "test-token-stream.tokens";
+  const char* text =
+      "#pragma Cedro 1.0 goto-ladder\n"
+      "int f(void) { auto g(); return 1; }\n";
+  mut_Options options = DEFAULT_OPTIONS;
+  mut_Marker_array markers = init_Marker_array(10);
+  mut_Byte_array src = init_Byte_array(10);
+  mut_TokenStream stream = {0};
+  Marker_p markers_start = markers.start;
+
+  // A valid file loads as views, with the options from its pragma.
+  write_test_token_stream(path, text);
+  assert(eq(load_token_stream(&stream, path, NULL,
+                              &markers, &src, &options), 0));
+  assert(eq(markers.capacity, 0) && eq(src.capacity, 0));
+  assert(eq(src.len, strlen(text)) && eq(memcmp(src.start, text, src.len), 0));
+  assert(options.use_goto_ladder_for_defer);
+  uint64_t hash = hash_bytes(HASH_SEED, bounds_of_Byte_array(&src));
+  unload_token_stream(&stream, &markers, &src);
+  // Then the arrays are back as they were.
+  assert(eq(markers.start, markers_start) && eq(markers.len, 0));
+
+  // The cache rejects a file made from different source code.
+  uint64_t stale_hash = hash + 1;
+  options = DEFAULT_OPTIONS;
+  assert(eq(load_token_stream(&stream, path, &stale_hash,
+                              &markers, &src, &options), EINVAL));
+  unload_token_stream(&stream, &markers, &src);
+  assert(eq(load_token_stream(&stream, path, &hash,
+                              &markers, &src, &options), 0));
+  unload_token_stream(&stream, &markers, &src);
+
+  // A source code that does not match its content_hash is rejected.
+  write_test_token_stream(path, text);
+  assert(eq(load_token_stream(&stream, path, NULL,
+                              &markers, &src, &options), 0));
+  size_t marker_count = markers.len;
+  unload_token_stream(&stream, &markers, &src);
+  patch_test_file(path, (long)(sizeof(TokenStreamHeader) +
+                               marker_count * sizeof(Marker)),
+                  "/", 1);
+  assert(eq(load_token_stream(&stream, path, NULL,
+                              &markers, &src, &options), EINVAL));
+  unload_token_stream(&stream, &markers, &src);
+
+  // So is the file written by another version.
+  write_test_token_stream(path, text);
+  char version[8] = "0.0";
+  patch_test_file(path, (long)offsetof(TokenStreamHeader, version),
+                  version, sizeof(version));
+  assert(eq(load_token_stream(&stream, path, NULL,
+                              &markers, &src, &options), EINVAL));
+  unload_token_stream(&stream, &markers, &src);
+
+  remove(path);
+  destruct_Marker_array(&markers);
+  destruct_Byte_array(&src);
+}
+
+void test_view()
+{
+  // Arrays with capacity zero do not own their elements,
+  // so they get copied to a new block before modifying them.
+  Byte_p text = B("En un lugar de La Mancha");
+  size_t text_len = strlen((const char*) text);
+  mut_Byte_array view = { .len = text_len, .start = (mut_Byte_p) text };
+  Byte_p replacement = B("X");
+  // Deleting more than inserting must not lose the tail.
+  splice_Byte_array(&view, 0, 11, NULL,
+                    (Byte_array_slice){ replacement, replacement + 1 });
+  assert(view.start is_not text);
+  assert(eq(view.len, text_len - 10));
+  assert(eq(memcmp(view.start, "X de La Mancha", view.len), 0));
+  assert(str_eq((const char*) text, "En un lugar de La Mancha"));
+  destruct_Byte_array(&view);
+}
+
+/** Parse `src` from scratch into `markers`, updating `options`
+ * with its pragma. Returns `false` if there is an error. */
+static bool
+parse_from_scratch(Byte_array_p src, mut_Marker_array_p markers,
+                   mut_Options_p options)
+{
+  markers->len = 0;
+  error_buffer[0] = 0;
+  Byte_array_mut_slice region = bounds_of_Byte_array(src);
+  region.start_p = parse_skip_until_cedro_pragma(src, region, markers,
+                                                 options);
+  parse(src, region, markers, options->use_defer_instead_of_auto, NULL);
+  bool ok = not error_buffer[0];
+  error_buffer[0] = 0;
+  return ok;
+}
+
+/** Apply `edit` with `reparse()`, and check that the markers are the same
+ * as parsing the result from scratch, and that those outside
+ * the `MarkerChange` range are the old ones, shifted after it.
+ *  If either gives an error, `src`, `markers`, and `options`
+ * are restored to what they were before the edit.
+ * Returns `false` in that case, `true` if the edit got checked. */
+static bool
+check_reparse(mut_Byte_array_p src, mut_Marker_array_p markers,
+              mut_Options_p options, SourceEdit edit)
+{
+  mut_Byte_array old_src = init_Byte_array(src->len);
+  append_Byte_array(&old_src, bounds_of_Byte_array(src));
+  mut_Marker_array old = init_Marker_array(markers->len);
+  append_Marker_array(&old, bounds_of_Marker_array(markers));
+  Options old_options = *options;
+
+  mut_MarkerChange change;
+  error_buffer[0] = 0;
+  bool ok = reparse(src, markers, edit, options, &change);
+  error_buffer[0] = 0;
+  mut_Options fresh_options = DEFAULT_OPTIONS;
+  mut_Byte_array fresh_src = init_Byte_array(src->len);
+  append_Byte_array(&fresh_src, bounds_of_Byte_array(src));
+  mut_Marker_array fresh = init_Marker_array(markers->len);
+  ok = parse_from_scratch(&fresh_src, &fresh, &fresh_options) && ok;
+
+  if (ok) {
+    assert(eq(options->use_defer_instead_of_auto,
+              fresh_options.use_defer_instead_of_auto));
+    assert(eq(options->enable_embed_directive,
+              fresh_options.enable_embed_directive));
+    assert(eq(markers->len, fresh.len) ||
+           (eprintln("Reparse at %zu: %zu markers ≠ %zu",
+                     edit.start, markers->len, fresh.len), false));
+    for (size_t i = 0; i < markers->len; ++i) {
+      Marker_p m = &markers->start[i], f = &fresh.start[i];
+      assert((eq(m->start, f->start) && eq(m->len, f->len) &&
+              eq(m->token_type, f->token_type)) ||
+             (eprintln("Reparse at %zu: marker %zu %s “%.*s” ≠ %s “%.*s”",
+                       edit.start, i,
+                       TokenType_STRING[m->token_type],
+                       (int)m->len, src->start + m->start,
+                       TokenType_STRING[f->token_type],
+                       (int)f->len, src->start + f->start), false));
+    }
+
+    assert(change.start <= change.end && change.end <= markers->len);
+    assert(change.start <= change.old_end && change.old_end <= old.len);
+    assert(eq(markers->len - change.end, old.len - change.old_end));
+    for (size_t i = 0; i < change.start; ++i) {
+      Marker_p m = &markers->start[i], o = &old.start[i];
+      assert((eq(m->start, o->start) && eq(m->len, o->len) &&
+              eq(m->token_type, o->token_type)) ||
+             (eprintln("Reparse at %zu: marker %zu before the change moved",
+                       edit.start, i), false));
+    }
+    size_t inserted = (size_t)(edit.inserted.end_p - edit.inserted.start_p);
+    for (size_t i = change.end; i < markers->len; ++i) {
+      Marker_p m = &markers->start[i];
+      Marker_p o = &old.start[change.old_end + (i - change.end)];
+      assert((eq(m->start + edit.deleted, o->start + inserted) &&
+              eq(m->len, o->len) && eq(m->token_type, o->token_type)) ||
+             (eprintln("Reparse at %zu: marker %zu after the change differs",
+                       edit.start, i), false));
+    }
+  } else {
+    src->len = 0;
+    append_Byte_array(src, bounds_of_Byte_array(&old_src));
+    memset(src->start + src->len, 0, PADDING_Byte_ARRAY);
+    markers->len = 0;
+    append_Marker_array(markers, bounds_of_Marker_array(&old));
+    *options = old_options;
+  }
+
+  destruct_Marker_array(&fresh);
+  destruct_Byte_array(&fresh_src);
+  destruct_Marker_array(&old);
+  destruct_Byte_array(&old_src);
+
+  return ok;
+}
+
+/** Edit of `deleted` bytes at `offset` from the first `anchor` in `text`. */
+static SourceEdit
+edit_at(const char* text, const char* anchor, size_t offset, size_t deleted,
+        const char* inserted)
+{
+  const char* position = strstr(text, anchor);
+  assert(position);
+  return (SourceEdit){
+    .start    = (size_t)(position - text) + offset,
+    .deleted  = deleted,
+    .inserted = { B(inserted), B(inserted) + strlen(inserted) }
+  };
+}
+
+void test_reparse()
+{
+  const char* text =
+      "// Before the pragma.\n"
+      "#pragma Cedro 1.0\n"
+      "#include <stdio.h>\n"
+      "#define TWICE(x) ((x) + (x))\n"
+      "/* A block comment\n"
+      "   on two lines. */\n"
+      "static const char* s = \"a string; with } and /* inside\";\n"
+      "int f(int n)\n"
+      "{\n"
+      "  char* p = malloc((size_t)n);\n"
+      "  auto free(p);\n"
+      "  switch (n) {\n"
+      "    case 1: return 'c';\n"
+      "    default: break;\n"
+      "  }\n"
+      "  if (n > 2) goto end;\n"
+      "  n = TWICE(n);\n"
+      "end:\n"
+      "  return n;\n"
+      "}\n"
+      "#if 1\n"
+      "int g(void) { return f(1) * 2; }\n"
+      "#endif\n";
+  SourceEdit edits[] = {
+    // Inside a comment, a string, and a directive:
+    edit_at(text, "two lines", 0, 3, "three"),
+    edit_at(text, "two lines", 0, 0, "*/ "),
+    edit_at(text, "Before", 0, 6, "After"),
+    edit_at(text, "a string", 2, 0, "\\\""),
+    edit_at(text, "a string", 0, 1, "\" \""),
+    edit_at(text, "stdio.h", 0, 5, "stdlib"),
+    edit_at(text, "((x) + (x))", 0, 0, "\\\n"),
+    edit_at(text, "#if 1", 4, 1, "0"),
+    edit_at(text, "#endif", 0, 0, "}\n"),
+    // Across the end of the pragma line, or changing its options:
+    edit_at(text, "#pragma", 0, 0, "int before;\n"),
+    edit_at(text, "1.0\n", 3, 1, " "),
+    edit_at(text, "1.0\n", 3, 0, " defer"),
+    edit_at(text, "pragma.", 6, 14, ";"),
+    edit_at(text, "Cedro 1.0", 6, 14, "2"),
+    // Around labels and case colons:
+    edit_at(text, "end:", 3, 1, ";"),
+    edit_at(text, "goto end", 5, 0, "x: "),
+    edit_at(text, "case 1:", 4, 1, "2"),
+  };
+  mut_Options options = DEFAULT_OPTIONS;
+  mut_Marker_array markers = init_Marker_array(100);
+  mut_Byte_array src = init_Byte_array(100);
+  size_t checked = 0;
+  for (size_t i = 0; i < sizeof(edits)/sizeof(edits[0]); ++i) {
+    options = DEFAULT_OPTIONS;
+    parse_test_source(text, &markers, &src, &options);
+    if (check_reparse(&src, &markers, &options, edits[i])) ++checked;
+  }
+  assert(eq(checked, sizeof(edits)/sizeof(edits[0])) ||
+         (eprintln("Only %zu edits checked", checked), false));
+
+  // Random edits one after another, with fragments that change
+  // how the text around them gets tokenized. A second pragma would only
+  // print a warning for each edit, the fixed ones above change it.
+  const char* fragments[] = {
+    "", "x", "y1", " ", "\n", ";", "{", "}", "(", ")", ":", "case ",
+    "/*", "*/", "//", "\"", "'", "\\\n", "#define X 1\n", "\n#if 1\n",
+    "+", "-", "*", "&", ".", "..", "<<", "=", "0x1", "u8\"s\"", "L'c'",
+    "foo:", "a; b:", "label: x;\n", "auto ", "defer ", "int z = 3;\n"
+  };
+  uint32_t random = 12345;
+  options = DEFAULT_OPTIONS;
+  parse_test_source(text, &markers, &src, &options);
+  checked = 0;
+  for (size_t i = 0; i < 1000; ++i) {
+    random = random * 1103515245 + 12345;
+    size_t start = (random >> 8) % (src.len + 1);
+    random = random * 1103515245 + 12345;
+    size_t deleted = (random >> 8) % 4;
+    if (deleted > src.len - start) deleted = src.len - start;
+    random = random * 1103515245 + 12345;
+    const char* inserted =
+        fragments[(random >> 8) % (sizeof(fragments)/sizeof(fragments[0]))];
+    SourceEdit edit = {
+      start, deleted, { B(inserted), B(inserted) + strlen(inserted) }
+    };
+    if (check_reparse(&src, &markers, &options, edit)) ++checked;
+  }
+  assert(checked > 500 ||
+         (eprintln("Only %zu random edits checked", checked), false));
+
+  destruct_Marker_array(&markers);
+  destruct_Byte_array(&src);
+}
+
 int main(int argc, char** argv)
 {
+  run_test(apply_macros);
   run_test(array);
+  run_test(arena);
   run_test(const);
+  run_test(gap_array);
+  run_test(intern_symbol);
 
   run_test(number);
+  run_test(reparse);
+  run_test(shrink);
+  run_test(small_array);
+  run_test(token_stream);
+  run_test(view);
 }
@@ -40,8 +40,25 @@
 /* In Solaris 8, we need __EXTENSIONS__ for vsnprintf(). */
 #define __EXTENSIONS__
 
+/* Large source files get mapped into memory instead of copied,
+ * in POSIX systems. Define CEDRO_NO_MMAP to always copy them. */
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(CEDRO_NO_MMAP)
+#define CEDRO_MMAP
+#ifndef _POSIX_C_SOURCE
+/* _POSIX_C_SOURCE is needed for mmap() and sysconf(). */
+#define _POSIX_C_SOURCE 200112L
+#endif
+#endif
+
+/* Define CEDRO_THREADS, and link with `-pthread`, to make `--jobs=<n>`
+ * apply the macros to several parts of the file in parallel. */
+#if defined(CEDRO_THREADS) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h> // For offsetof().
 #ifdef __UINT8_C
 #include <stdint.h>
 #else
@@ -178,6 +195,8 @@ eprint(const char * const fmt, ...)
   } else {
     char* buffer;
     char small[512];
+    va_list args_retry;
+    va_copy(args_retry, args); // `args` can not be used again after this.
     size_t needed =
         (size_t) vsnprintf(small, sizeof(small), fmt, args)
         + 1; // For the zero terminator.
@@ -191,7 +210,7 @@ eprint(const char * const fmt, ...)
               needed);
         goto exit;
       }
-      vsnprintf(buffer, needed, fmt, args);
+      vsnprintf(buffer, needed, fmt, args_retry);
     }
     const uint8_t* p   = (const uint8_t*)buffer;
     const uint8_t* end = p + needed;
@@ -218,6 +237,7 @@ eprint(const char * const fmt, ...)
     }
  exit:
     if (buffer is_not &small[0]) free(buffer);
+    va_end(args_retry);
   }
 
   va_end(args);
@@ -266,14 +286,24 @@ typedef struct Options {
   bool discard_comments;
   /// Insert `#line` directives in the output, mapping to the original file.
   bool insert_line_directives;
+  /// Lines in the original file before the start of `src`,
+  /// when it gets processed in pieces as with `--stream`.
+  size_t line_offset;
   /// Enable `#embed`.
   bool enable_embed_directive;
   /// Size limit for using strings when including binaries.
   size_t embed_as_string;
   /// Use `defer` instead of `auto`.
   bool use_defer_instead_of_auto;
+  /// Emit each deferred action once at the end of its block,
+  /// in a ladder of labels that `return` jumps to,
+  /// instead of copying them in front of every `return`.
+  /// Set by `#pragma Cedro 1.0 goto-ladder`, see `macro_defer()`.
+  bool use_goto_ladder_for_defer;
   /// Which standard to target for output.
   mut_CStandard c_standard;
+  /// Where `parse()` interns the identifiers, or `NULL` to not do it.
+  struct SymbolTable* symbols;
 } MUT_CONST_TYPE_VARIANTS(Options);
 
 /** Binary string, `const unsigned char const*`. */
@@ -381,12 +411,16 @@ TokenType_STRING[1+T_OTHER] = {
 #define is_operator(token_type) (token_type >= T_OP_1 and token_type <= T_COMMA)
 #define is_fence(token_type) (token_type >= T_BLOCK_START and token_type <= T_GROUP_END)
 
-/** Marks a C token in the source code. */
+/** Marks a C token in the source code.
+ *  It takes 24 bytes on 64-bit machines: without `symbol` it would be 16
+ * when built with `-fshort-enums` as in the `Makefile`, and 24 otherwise. */
 typedef struct Marker {
   SrcIndexType start;       /**< Start position, in bytes/chars. */
   SrcLenType   len;         /**< Length, in bytes/chars. */
   mut_TokenType token_type; /**< Token type. */
   bool synthetic;           /**< It does not come directly from parsing. */
+  uint32_t symbol;          /**< Interned identifier, see `intern_symbol()`,
+                                 or 0 if not interned. */
 } MUT_CONST_TYPE_VARIANTS(Marker);
 
 /** Error while processing markers. */
@@ -399,11 +433,15 @@ typedef struct Error {
 
 DEFINE_ARRAY_OF(Marker, 0, {});
 DEFINE_ARRAY_OF(TokenType, 0, {});
+/** Most temporary arrays in the macros stay below this size. */
+DEFINE_SMALL_ARRAY_OF(Marker, 32);
+DEFINE_SMALL_ARRAY_OF(TokenType, 32);
 
 typedef uint8_t MUT_CONST_TYPE_VARIANTS(Byte);
 /** Add 8 bytes after end of buffer to avoid bounds checking while scanning
  * for tokens. No literal token is longer. */
 DEFINE_ARRAY_OF(Byte, 8, {});
+
 //DEFINE_ARRAY_OF(Byte_array_slice, 0, {});
 
 /** Append the C string bytes to the end of the given buffer. */
@@ -421,10 +459,13 @@ __attribute__ ((format (printf, 2, 3))) // GCC, typecheck format string args
 static bool
 push_fmt(mut_Byte_array_p _, const char * const fmt, ...)
 {
-  va_list args;
+  va_list args, args_retry;
   va_start(args, fmt);
+  // The second vsnprintf() needs its own copy, `args` is consumed by the first.
+  va_copy(args_retry, args);
 
   if (not ensure_capacity_Byte_array(_, _->len + 80)) {
+    va_end(args_retry);
     va_end(args);
     return false;
   }
@@ -432,14 +473,16 @@ push_fmt(mut_Byte_array_p _, const char * const fmt, ...)
   // We need space for the zero terminator even if we don’t care about it.
   size_t needed = (size_t)
       vsnprintf((char*) end_of_Byte_array(_), available, fmt, args);
-  if (needed > available) {
+  if (needed >= available) {
     if (not ensure_capacity_Byte_array(_, _->len + needed)) {
+      va_end(args_retry);
       va_end(args);
       return false;
     }
     available = _->capacity - _->len;
-    vsnprintf((char*) end_of_Byte_array(_), available, fmt, args);
+    vsnprintf((char*) end_of_Byte_array(_), available, fmt, args_retry);
   }
+  va_end(args_retry);
   // “return value (number of bytes that would be written
   //  not including the null terminator)”
   // https://en.cppreference.com/w/c/io/vfprintf
@@ -488,6 +531,19 @@ get_file_size(FilePath path)
   return size >=0? (size_t)size: 0;
 }
 
+/** Average number of source bytes per marker, measured on C code
+ * including this file: typically between 3 and 5,
+ * more for headers with many comments, down to 2 for dense tables. */
+static const size_t BYTES_PER_MARKER = 4;
+
+/** Estimate how many markers `parse()` will produce for `src_len` bytes,
+ * to reserve them at once instead of doubling the array several times. */
+static size_t
+estimate_marker_count(size_t src_len)
+{
+  return src_len / BYTES_PER_MARKER + 64;
+}
+
 /** Read a file into the given buffer. Returns error code, 0 if it succeeds. */
 static int
 read_file(mut_Byte_array_p _, FilePath path)
@@ -497,6 +553,8 @@ read_file(mut_Byte_array_p _, FilePath path)
   if (not input) return errno;
   fseek(input, 0, SEEK_END);
   size_t size = (size_t)ftell(input);
+  // The buffer might be much bigger than needed, from a previous file.
+  shrink_Byte_array(_, size);
   if (not ensure_capacity_Byte_array(_, size)) {
     fclose(input);
     return ENOMEM;
@@ -515,6 +573,86 @@ read_file(mut_Byte_array_p _, FilePath path)
   return err;
 }
 
+/** Memory map used as source buffer, see `map_or_read_file()`. */
+typedef struct FileMapping {
+  /// Mapped address, `NULL` if the file was read into the buffer instead.
+  void* address;
+  /// Length of the mapping in bytes.
+  size_t size;
+  /// The buffer to restore after unmapping.
+  mut_Byte_array buffer;
+} MUT_CONST_TYPE_VARIANTS(FileMapping);
+
+#ifdef CEDRO_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/** Files smaller than this are read with `read_file()` even if they
+ * could be mapped, because the copy is cheaper than the mapping. */
+static const size_t MAP_FILE_MIN_SIZE = 256 * 1024;
+
+/** Make `_` a view over the file mapped into memory, or if that is not
+ * possible or worth it, read it into `_` as `read_file()` does.
+ * The mapping is private, so any modification is copy-on-write,
+ * and appending to `_` moves it to a heap buffer.
+ * The lexer needs `PADDING_Byte_ARRAY` zero bytes after the end,
+ * so the file is only mapped if those fall in the last page,
+ * which the system fills with zeros.
+ * Call `unmap_or_keep_file()` when done.
+ * Returns error code, 0 if it succeeds. */
+static int
+map_or_read_file(mut_Byte_array_p _, mut_FileMapping_p mapping,
+                 FilePath path)
+{
+  mapping->address = NULL;
+  mapping->size    = 0;
+#ifdef CEDRO_MMAP
+  int fd = open(path, O_RDONLY);
+  if (fd is -1) return errno;
+  struct stat file_status;
+  long page_size = sysconf(_SC_PAGESIZE);
+  if (fstat(fd, &file_status) is 0 and S_ISREG(file_status.st_mode) and
+      page_size > 0 and
+      (size_t)file_status.st_size >= MAP_FILE_MIN_SIZE) {
+    size_t size = (size_t)file_status.st_size;
+    size_t tail = (size_t)page_size - size % (size_t)page_size;
+    if (tail is_not (size_t)page_size and tail >= PADDING_Byte_ARRAY) {
+      void* address = mmap(NULL, size + PADDING_Byte_ARRAY,
+                           PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+      if (address is_not MAP_FAILED) {
+        mapping->address = address;
+        mapping->size    = size + PADDING_Byte_ARRAY;
+        mapping->buffer  = move_Byte_array(_);
+        // Capacity zero means that the array does not own the memory.
+        *_ = (mut_Byte_array){ .len = size, .capacity = 0, .start = address };
+      }
+    }
+  }
+  close(fd);
+  if (mapping->address) return 0;
+#endif
+  return read_file(_, path);
+}
+
+/** Release the mapping made by `map_or_read_file()`, if any,
+ * and give back to `_` the buffer it had before. */
+static void
+unmap_or_keep_file(mut_Byte_array_p _, mut_FileMapping_p mapping)
+{
+#ifdef CEDRO_MMAP
+  if (mapping->address) {
+    destruct_Byte_array(_); // Only does something if it was copied.
+    munmap(mapping->address, mapping->size);
+    *_ = move_Byte_array(&mapping->buffer);
+    mapping->address = NULL;
+    mapping->size    = 0;
+  }
+#endif
+}
+
 /** Read into the given buffer. Returns error code, 0 if it succeeds. */
 static int
 read_stream(mut_Byte_array_p _, FILE* input)
@@ -537,6 +675,120 @@ read_stream(mut_Byte_array_p _, FILE* input)
   return err;
 }
 
+/** Tracks just enough of the C syntax while reading a stream
+ * to know where the top-level declarations end. */
+typedef struct StreamScanner {
+  /// Nesting level of `()`, `[]`, and `{}`. Not zero if unbalanced.
+  long depth;
+  /// Inside a `//…` comment.
+  bool line_comment;
+  /// Inside a `/*…*/` comment.
+  bool block_comment;
+  /// `"` or `'` inside a string or character literal, `0` otherwise.
+  mut_Byte quote;
+  /// The previous byte was a backslash that escapes this one.
+  bool escaped;
+  /// Inside a pre-processor directive.
+  bool directive;
+  /// Inside a number, where `'` is a digit separator.
+  bool number;
+  /// Only space seen so far in this line.
+  bool line_start;
+  /// Previous byte, for the comment delimiters.
+  mut_Byte previous;
+  /// Last significant byte outside of directives and comments
+  /// since the previous boundary.
+  mut_Byte last;
+} MUT_CONST_TYPE_VARIANTS(StreamScanner);
+
+/** Feed the next byte to the scanner.
+ *  Returns `true` if it is a newline that ends a top-level declaration
+ *  or pre-processor directive, so that the input read so far
+ *  can be processed without waiting for the rest.
+ *  A wrong guess only makes the pieces larger:
+ *  if the brackets do not balance, the rest is kept as one piece. */
+static bool
+scan_stream_byte(mut_StreamScanner_p _, mut_Byte c)
+{
+  bool boundary = false;
+  bool escaped  = _->escaped;
+  mut_Byte previous = _->previous;
+  _->escaped  = c is '\\' and not escaped;
+  _->previous = c;
+
+  if (c is '\n') {
+    if (escaped) return false; // Line continuation.
+    _->line_comment = false;
+    _->quote        = 0; // Unterminated literal, parse() will report it.
+    _->number       = false;
+    _->line_start   = true;
+    if (not _->block_comment) {
+      boundary = _->depth is 0 and
+          (_->last is ';' or _->last is '}' or
+           (_->directive and _->last is 0));
+      if (boundary) _->last = 0;
+      _->directive = false;
+    }
+  } else if (_->block_comment) {
+    if (c is '/' and previous is '*') _->block_comment = false;
+  } else if (_->line_comment) {
+    // Skip until the end of the line.
+  } else if (_->quote) {
+    if (c is _->quote and not escaped) _->quote = 0;
+  } else {
+    bool alphanumeric = (c >= 'a' and c <= 'z') or (c >= 'A' and c <= 'Z') or
+        (c >= '0' and c <= '9') or c is '_';
+    if (c >= '0' and c <= '9') {
+      bool after_identifier =
+          (previous >= 'a' and previous <= 'z') or
+          (previous >= 'A' and previous <= 'Z') or
+          (previous >= '0' and previous <= '9') or previous is '_';
+      if (not after_identifier) _->number = true;
+    } else if (not alphanumeric and c is_not '.' and c is_not '\'') {
+      _->number = false;
+    }
+
+    switch (c) {
+      case '*':
+        if (previous is '/') {
+          _->block_comment = true;
+          _->previous = 0; // So that `/*/` does not close it.
+        }
+        break;
+      case '/':
+        if (previous is '/') _->line_comment = true;
+        break;
+      case '"':
+        _->quote = c;
+        break;
+      case '\'':
+        if (not _->number) _->quote = c;
+        break;
+      case '#':
+        if (_->line_start) _->directive = true;
+        break;
+      case '(': case '[': case '{':
+        ++_->depth;
+        break;
+      case ')': case ']': case '}':
+        --_->depth;
+        break;
+    }
+
+    if (c is_not ' ' and c is_not '\t' and c is_not '\r' and
+        c is_not '\v' and c is_not '\f') {
+      _->line_start = false;
+      // A '/' can not end a declaration, and it may start a comment.
+      if (not _->directive and c is_not '/' and
+          not _->block_comment and not _->line_comment) {
+        _->last = c;
+      }
+    }
+  }
+
+  return boundary;
+}
+
 /** Print an error produced when reading a file. */
 static void
 print_file_error(int err, const char* file_name, size_t read)
@@ -554,6 +806,120 @@ print_file_error(int err, const char* file_name, size_t read)
   }
 }
 
+static const uint64_t HASH_SEED = 0xCBF29CE484222325;
+
+/** 64-bit FNV-1a hash of the given bytes, continuing from `hash`.
+ * http://www.isthe.com/chongo/tech/comp/fnv/ */
+static uint64_t
+hash_bytes(uint64_t hash, Byte_array_slice bytes)
+{
+  for (Byte_mut_p p = bytes.start_p; p is_not bytes.end_p; ++p) {
+    hash ^= *p;
+    hash *= 0x100000001B3;
+  }
+  return hash;
+}
+
+/** Text of an interned identifier. */
+typedef struct Symbol {
+  size_t start;   /**< Start position in `SymbolTable.text`. */
+  SrcLenType len; /**< Length, in bytes/chars. */
+  uint32_t hash;  /**< Hash of the text, to avoid recomputing it. */
+} MUT_CONST_TYPE_VARIANTS(Symbol);
+DEFINE_ARRAY_OF(Symbol, 0, {});
+typedef uint32_t MUT_CONST_TYPE_VARIANTS(SymbolId);
+DEFINE_ARRAY_OF(SymbolId, 0, {});
+
+/** Identifiers interned by `parse()`, so that comparing two of them is
+ * just comparing their symbol IDs.
+ * It keeps its own copy of the text, so it can be reused for any number
+ * of files, and then the same identifier gets the same ID in all of them. */
+typedef struct SymbolTable {
+  /// Text of all symbols, one after another.
+  mut_Byte_array text;
+  /// The symbol with ID `n` is at index `n - 1`.
+  mut_Symbol_array symbols;
+  /// Open addressing hash table with the symbol IDs, 0 for empty slots.
+  /// Its length is always a power of two.
+  mut_SymbolId_array slots;
+} MUT_CONST_TYPE_VARIANTS(SymbolTable);
+
+static mut_SymbolTable
+init_SymbolTable(void)
+{
+  return (mut_SymbolTable){
+    .text    = init_Byte_array(4096),
+    .symbols = init_Symbol_array(256),
+    .slots   = init_SymbolId_array(1024)
+  };
+}
+
+static void
+destruct_SymbolTable(mut_SymbolTable_p _)
+{
+  destruct_Byte_array(&_->text);
+  destruct_Symbol_array(&_->symbols);
+  destruct_SymbolId_array(&_->slots);
+}
+
+
+/** Put `id` in the first free slot for `hash`. */
+static void
+place_symbol(mut_SymbolTable_p _, uint32_t hash, SymbolId id)
+{
+  size_t mask = _->slots.len - 1;
+  size_t slot = hash & mask;
+  while (_->slots.start[slot]) slot = (slot + 1) & mask;
+  _->slots.start[slot] = id;
+}
+
+/** Get the symbol ID for the identifier in `[start, end)`,
+ * adding it to the table if it was not there yet.
+ *  Returns 0 if it runs out of memory. */
+static SymbolId
+intern_symbol(mut_SymbolTable_p _, Byte_p start, Byte_p end)
+{
+  // Fold the 64-bit hash, so that its high bits also pick the slot.
+  uint64_t wide_hash = hash_bytes(HASH_SEED,
+                                  (Byte_array_slice){ start, end });
+  uint32_t hash = (uint32_t)(wide_hash ^ (wide_hash >> 32));
+  size_t len = (size_t)(end - start);
+  if (_->slots.len) {
+    size_t mask = _->slots.len - 1;
+    for (size_t slot = hash & mask; _->slots.start[slot];
+         slot = (slot + 1) & mask) {
+      SymbolId id = _->slots.start[slot];
+      Symbol_p symbol = &_->symbols.start[id - 1];
+      if (symbol->hash is hash and symbol->len is len and
+          mem_eq(_->text.start + symbol->start, start, len)) {
+        return id;
+      }
+    }
+  }
+
+  // Keep the load factor under 1/2.
+  if (2 * (_->symbols.len + 1) > _->slots.len) {
+    size_t slot_count = _->slots.len? 2 * _->slots.len: 1024;
+    if (not ensure_capacity_SymbolId_array(&_->slots, slot_count)) return 0;
+    memset(_->slots.start, 0, slot_count * sizeof(_->slots.start[0]));
+    _->slots.len = slot_count;
+    for (size_t i = 0; i < _->symbols.len; ++i) {
+      place_symbol(_, _->symbols.start[i].hash, (SymbolId)(i + 1));
+    }
+  }
+  Symbol symbol = {
+    .start = _->text.len, .len = (SrcLenType)len, .hash = hash
+  };
+  if (_->symbols.len >= (SymbolId)-1 or
+      not append_Byte_array(&_->text, (Byte_array_slice){ start, end }) or
+      not push_Symbol_array(&_->symbols, symbol)) {
+    return 0;
+  }
+  SymbolId id = (SymbolId)_->symbols.len;
+  place_symbol(_, hash, id);
+  return id;
+}
+
 /** Initialize a marker with the given values. */
 static void
 init_Marker(mut_Marker_p _, Byte_p start, Byte_p end, Byte_array_p src,
@@ -563,20 +929,29 @@ init_Marker(mut_Marker_p _, Byte_p start, Byte_p end, Byte_array_p src,
   _->len        = (size_t)(end - start);
   _->token_type = token_type;
   _->synthetic  = false;
+  _->symbol     = 0;
 }
 
-/** Check whether two markers represent the same token. */
+/** Check whether two markers have the same text,
+ * which for interned identifiers means the same symbol. */
 static bool
-is_same_token(Marker_p a, Marker_p b, Byte_array_p src)
+is_same_text(Marker_p a, Marker_p b, Byte_array_p src)
 {
-  return (a->token_type is b->token_type and
-          a->len        is b->len        and
+  if (a->symbol and b->symbol) return a->symbol is b->symbol;
+  return (a->len is b->len and
           mem_eq(get_Byte_array(src, a->start),
                  get_Byte_array(src, b->start),
                  a->len)
           );
 }
 
+/** Check whether two markers represent the same token. */
+static bool
+is_same_token(Marker_p a, Marker_p b, Byte_array_p src)
+{
+  return a->token_type is b->token_type and is_same_text(a, b, src);
+}
+
 /** Build a new marker for the given string,
  * pointing to its first appearance in `src`.
  *  If not found, append the text to `src`
@@ -1327,7 +1702,8 @@ preprocessor(Byte_p start, Byte_p end)
     return cursor;
   }
   if (cursor is end) return end;
-  if (*cursor is ' ' or *cursor is '\n') {
+  // Without arguments, as in `#endif\n`, the directive ends right here.
+  if (*cursor is ' ') {
     do {
       if (cursor is end) break;
       cursor = memchr(cursor + 1, '\n', (size_t)(end - (cursor + 1)));
@@ -1749,6 +2125,14 @@ original_line_number(size_t position, Byte_array_p src)
   return line;
 }
 
+/** Compute the line number in the original file,
+ * of which `src` might be only a piece, see `Options.line_offset`. */
+static size_t
+line_in_file(size_t position, Byte_array_p src, Options options)
+{
+  return options.line_offset + original_line_number(position, src);
+}
+
 /** Truncate the markers at the given position
  * and append a pre-processor error directive.
  * `src` is needed to create the new marker for `message`,
@@ -1756,7 +2140,8 @@ original_line_number(size_t position, Byte_array_p src)
  */
 static void
 error_at(const char * message,
-         Marker_p cursor, mut_Marker_array_p _, mut_Byte_array_p src)
+         Marker_p cursor, mut_Marker_array_p _, mut_Byte_array_p src,
+         Options_p options)
 {
   assert(cursor >= _->start and cursor <= _->start + _->len);
   // Check that there aren’t any previous errors already there
@@ -1776,7 +2161,7 @@ error_at(const char * message,
   mut_Byte_array buffer = init_Byte_array(200);
   bool ok =
       push_fmt(&buffer, "\n#line %zu",
-               original_line_number(cursor->start, src))          &&
+               line_in_file(cursor->start, src, *options))        &&
       push_str(&buffer, "\n")                                     &&
       push_Marker_array(_, Marker_from(src, as_c_string(&buffer),
                                        T_PREPROCESSOR));
@@ -2365,7 +2750,8 @@ prepare_binary_embedding(mut_Marker_array_p markers, mut_Byte_array_p src,
  * mut_Options options = {0};
  * region.start_p = parse_skip_until_cedro_pragma(&src, region, markers,
  *                                                &options);
- * parse(&src, region, &markers, options.use_defer_instead_of_auto);
+ * parse(&src, region, &markers, options.use_defer_instead_of_auto,
+ *       options.symbols);
  * print_markers(&markers, &src, "", 0, markers.len);
  * ```
  */
@@ -2376,6 +2762,7 @@ parse_skip_until_cedro_pragma(Byte_array_p src, Byte_array_slice region, mut_Mar
   Byte_mut_p cursor = region.start_p;
   Byte_p     end    = region.end_p;
   Byte_mut_p prev_cursor = NULL;
+  bool pragma_found = false;
 
   // First look for the pragma.
   // We need to do some tokenization to avoid false positives if it appears
@@ -2403,6 +2790,7 @@ parse_skip_until_cedro_pragma(Byte_array_p src, Byte_array_slice region, mut_Mar
             if (*cursor is ' ') { ++cursor; break; }
             ++cursor;
           }
+          options->use_goto_ladder_for_defer = false;
           Byte_mut_p start;
           do {
             start = cursor;
@@ -2412,6 +2800,8 @@ parse_skip_until_cedro_pragma(Byte_array_p src, Byte_array_slice region, mut_Mar
               options->enable_embed_directive = true;
             } else if (len is 5 and mem_eq("defer", start, len)) {
               options->use_defer_instead_of_auto = true;
+            } else if (len is 11 and mem_eq("goto-ladder", start, len)) {
+              options->use_goto_ladder_for_defer = true;
             }
             if (cursor is_not token_end) ++cursor;
           } while (cursor is_not token_end);
@@ -2419,6 +2809,7 @@ parse_skip_until_cedro_pragma(Byte_array_p src, Byte_array_slice region, mut_Mar
           // Skip LF and empty lines after line.
           while (cursor is_not end and
                  ('\n' is *cursor or ' ' is *cursor)) ++cursor;
+          pragma_found = true;
           break;
         }
       }
@@ -2439,7 +2830,7 @@ parse_skip_until_cedro_pragma(Byte_array_p src, Byte_array_slice region, mut_Mar
   }
 
 
-  if (cursor is end) {
+  if (not pragma_found) {
     // No “#pragma Cedro x.y”, so just wrap the whole C code verbatim.
     mut_Marker inert;
     init_Marker(&inert,
@@ -2453,6 +2844,102 @@ parse_skip_until_cedro_pragma(Byte_array_p src, Byte_array_slice region, mut_Mar
   return cursor;
 }
 
+/** Whether `parse_skip_until_cedro_pragma()` did not find the pragma,
+ * in which case the whole source is wrapped in one inert marker. */
+static bool
+is_without_cedro_pragma(Marker_array_p markers, Byte_array_p src)
+{
+  return markers->len is 1 and
+      markers->start[0].start is 0 and markers->start[0].len is src->len;
+}
+
+/** Whether a token of this type is a value, so that a `+`, `-`, `*`,
+ * or `&` after it is a binary operator instead of a prefix one.
+ *  `T_SPACE` and `T_COMMENT` do not count, skip them before asking. */
+static inline bool
+is_value_token(TokenType token_type)
+{
+  switch (token_type) {
+    case T_IDENTIFIER:
+    case T_NUMBER:
+    case T_STRING:
+    case T_CHARACTER:
+    case T_TUPLE_END:
+    case T_INDEX_END:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/** Where `reparse()` can stop parsing because the old markers are valid
+ * again from there on. */
+typedef struct ParseResync {
+  /// Whether the token before the region is a value.
+  bool previous_token_is_value;
+  /// Type of the last token before the region that is not space,
+  /// or `T_NONE` if there is none.
+  TokenType previous_token_type;
+  /// No stopping before this point, where the inserted text ends.
+  Byte_p damage_end;
+  /// The old markers from the start of the region, with the offsets
+  /// after the edit already shifted.
+  Marker_p old_start;
+  Marker_p old_end;
+  /// Starts at the first old marker after the edit, advances while
+  /// parsing, and at the end it points to the first one that is still
+  /// valid, or to `old_end`.
+  Marker_mut_p old;
+} MUT_CONST_TYPE_VARIANTS(ParseResync);
+
+/** Check whether the old markers are valid again from `position`:
+ * one of them must start there, and the last token before it
+ * must be a `;`, `{`, `}`, or directive, both in the old markers and
+ * in `markers`, and the next ones must not be a colon or `#define };`.
+ * After that there is nothing that `parse()` would classify differently
+ * depending on what came before. */
+static bool
+can_resync(mut_ParseResync_p _, SrcIndexType position,
+           Marker_array_p markers, Byte_array_p src)
+{
+  while (_->old is_not _->old_end and _->old->start < position) ++_->old;
+  if (_->old is _->old_end or _->old->start is_not position) return false;
+
+  Marker_p new_token = skip_space_back(markers->start,
+                                       end_of_Marker_array(markers));
+  if (new_token is markers->start) return false;
+  TokenType token_type = (new_token - 1)->token_type;
+  switch (token_type) {
+    case T_SEMICOLON: case T_BLOCK_START: case T_BLOCK_END:
+    case T_PREPROCESSOR:
+      break;
+    default:
+      return false;
+  }
+  Marker_p old_token = skip_space_back(_->old_start, _->old);
+  if (token_type is_not (old_token is _->old_start?
+                         _->previous_token_type: (old_token - 1)->token_type)) {
+    return false;
+  }
+  // A `:` right after them looks further back for `case`.
+  Marker_mut_p next = skip_space_forward(_->old, _->old_end);
+  if (next is_not _->old_end and
+      (next->token_type is T_OP_13 or next->token_type is T_LABEL_COLON)) {
+    return false;
+  }
+  // `#define };` swallows the semicolon before the token that precedes it.
+  for (size_t i = 0; i is_not 2 and next is_not _->old_end; ++i) {
+    if (next->token_type is T_PREPROCESSOR and
+        next->len >= 10/*strlen("#define };")*/ and
+        mem_eq("#define };", src->start + next->start, 10)) {
+      return false;
+    }
+    next = skip_space_forward(next + 1, _->old_end);
+  }
+
+  return true;
+}
+
 #define TOKEN1(token) token_type = token
 #define TOKEN2(token) ++token_end;    TOKEN1(token)
 #define TOKEN3(token) token_end += 2; TOKEN1(token)
@@ -2468,23 +2955,44 @@ parse_skip_until_cedro_pragma(Byte_array_p src, Byte_array_slice region, mut_Mar
  * mut_Marker_array markers = init_Marker_array(8192);
  * mut_Byte_array src = init_Byte_array(80);
  * push_str(&src, "printf(\"hello\\n\", i);");
- * parse(&src, bounds_of_Byte_array(&src), &markers, false);
+ * parse(&src, bounds_of_Byte_array(&src), &markers, false, NULL);
  * print_markers(&markers, &src, "", 0, markers.len);
  * ```
  *
  * Returns the point where parsing ended, which will normally be the
  * end of `region` unless there is an error, in which case the message
  * will be in `error_buffer`.
+ *
+ *  If `symbols` is not `NULL`, each identifier gets interned there,
+ * with its ID stored in the `symbol` field of its marker.
  */
 static Byte_p
+parse_with_resync(Byte_array_p src, Byte_array_slice region,
+                  mut_Marker_array_p markers,
+                  bool use_defer_instead_of_auto, mut_SymbolTable_p symbols,
+                  mut_ParseResync_p resync);
+static Byte_p
 parse(Byte_array_p src, Byte_array_slice region, mut_Marker_array_p markers,
-      bool use_defer_instead_of_auto)
+      bool use_defer_instead_of_auto, mut_SymbolTable_p symbols)
+{
+  return parse_with_resync(src, region, markers,
+                           use_defer_instead_of_auto, symbols, NULL);
+}
+
+/** Same as `parse()`, but if `resync` is not `NULL`, continuing
+ * from the state it gives, and stopping as soon as `can_resync()`. */
+static Byte_p
+parse_with_resync(Byte_array_p src, Byte_array_slice region,
+                  mut_Marker_array_p markers,
+                  bool use_defer_instead_of_auto, mut_SymbolTable_p symbols,
+                  mut_ParseResync_p resync)
 {
   assert(PADDING_Byte_ARRAY >= 8); // Must be greater than the longest keyword.
   Byte_mut_p cursor = region.start_p;
   Byte_p     end    = region.end_p;
   Byte_mut_p prev_cursor = NULL;
-  bool previous_token_is_value = false;
+  bool previous_token_is_value =
+      resync? resync->previous_token_is_value: false;
 
   while (cursor is_not end) {
     assert(cursor is_not prev_cursor);
@@ -2729,33 +3237,431 @@ parse(Byte_array_p src, Byte_array_slice region, mut_Marker_array_p markers,
 
     mut_Marker marker;
     init_Marker(&marker, cursor, token_end, src, token_type);
+    if (symbols and token_type is T_IDENTIFIER) {
+      marker.symbol = intern_symbol(symbols, cursor, token_end);
+    }
     if (not push_Marker_array(markers, marker)) {
       error("OUT OF MEMORY ERROR.");
       return end;
     }
     cursor = token_end;
 
-    switch (token_type) {
-      case T_IDENTIFIER:
-      case T_NUMBER:
-      case T_STRING:
-      case T_CHARACTER:
-      case T_TUPLE_END:
-      case T_INDEX_END:
-        previous_token_is_value = true;
-        break;
-      case T_SPACE:
-      case T_COMMENT:
-        /* Not significant for this purpose. */
-        break;
-      default:
-        previous_token_is_value = false;
+    if (token_type is_not T_SPACE and token_type is_not T_COMMENT) {
+      previous_token_is_value = is_value_token(token_type);
+    }
+
+    if (resync and cursor >= resync->damage_end and
+        can_resync(resync, index_Byte_array(src, cursor), markers, src)) {
+      break;
     }
   }
 
   return cursor;
 }
 
+/** Replacement of `deleted` bytes at `start` in the source code
+ * with the `inserted` text, for `reparse()`. */
+typedef struct SourceEdit {
+  size_t start;
+  size_t deleted;
+  Byte_array_slice inserted;
+} MUT_CONST_TYPE_VARIANTS(SourceEdit);
+
+/** Markers changed by `reparse()`: `[start, end)` in the updated array
+ * replace the old `[start, old_end)`, and the ones after that
+ * are the same as before except for their offsets. */
+typedef struct MarkerChange {
+  size_t start;
+  size_t end;
+  size_t old_end;
+} MUT_CONST_TYPE_VARIANTS(MarkerChange);
+
+/** Apply `edit` to `src`, and update `markers` to match,
+ * for instance in an editor or when watching a file for changes.
+ *  The `markers` must come from `parse_skip_until_cedro_pragma()`
+ * and `parse()` on `src` with the same `options`, or from a previous
+ * call to this function, and must not have been modified by the macros.
+ *  Only the damaged region gets parsed again: from the token before
+ * the edit until the first token boundary after it where the old markers
+ * are valid again, see `can_resync()`. The markers after that only get
+ * their offsets shifted. Edits that touch the `#pragma` line or the
+ * text before it, or files without it, get parsed again from scratch,
+ * updating `options` for the new pragma.
+ *
+ *  Example:
+ * ```
+ * // `src` contains "#pragma Cedro 1.0\nint x = 1;\nint y = 2;\n",
+ * // and `markers` come from parsing it.
+ * SourceEdit edit = {
+ *   .start = 26, .deleted = 1,
+ *   .inserted = { (Byte_p)"42", (Byte_p)"42" + 2 }
+ * };
+ * mut_MarkerChange change;
+ * if (reparse(&src, &markers, edit, &options, &change)) {
+ *   // Only "= 42;" got parsed again, the markers after it got shifted.
+ * }
+ * ```
+ *
+ * Returns `false` if there is an error, with the message
+ * in `error_buffer`, in which case `markers` need to be parsed again.
+ */
+static bool
+reparse(mut_Byte_array_p src, mut_Marker_array_p markers, SourceEdit edit,
+        mut_Options_p options, mut_MarkerChange_p change)
+{
+  if (edit.start > src->len or edit.deleted > src->len - edit.start) {
+    error(LANG("la edición está fuera del código fuente.",
+               "the edit is outside of the source code."));
+    return false;
+  }
+  size_t inserted = (size_t)(edit.inserted.end_p - edit.inserted.start_p);
+
+  // First marker that ends at or after the edit start,
+  // because the edit might join its end with the inserted text.
+  size_t first = 0;
+  size_t last  = markers->len;
+  while (first is_not last) {
+    size_t middle = first + (last - first) / 2;
+    Marker_p m = markers->start + middle;
+    if (m->start + m->len < edit.start) first = middle + 1;
+    else                                last  = middle;
+  }
+  // Back to the token before, in case it is an identifier
+  // that the edit turns into a label or back.
+  // If it is the colon after a label, to the label too,
+  // and for each directive, two more, because `#define };` swallows
+  // the semicolon before the token that precedes it.
+  Marker_mut_p restart = markers->start + first;
+  if (first is_not markers->len) {
+    size_t steps = restart->token_type is T_PREPROCESSOR? 3: 1;
+    for (; steps and restart is_not markers->start; --steps) {
+      restart = skip_space_back(markers->start, restart);
+      if (restart is_not markers->start) --restart;
+      if      (restart->token_type is T_LABEL_COLON)  steps += 1;
+      else if (restart->token_type is T_PREPROCESSOR) steps += 2;
+    }
+  }
+
+  if (first is markers->len or
+      restart->token_type is T_NONE or restart->start >= edit.start) {
+    size_t old_len = markers->len;
+    if (not splice_Byte_array(src, edit.start, edit.deleted, NULL,
+                              edit.inserted)) {
+      error("OUT OF MEMORY ERROR.");
+      return false;
+    }
+    memset(src->start + src->len, 0, PADDING_Byte_ARRAY);
+    markers->len = 0;
+    // Only the pragma enables these, and it might have changed.
+    options->enable_embed_directive    = false;
+    options->use_defer_instead_of_auto = false;
+    Byte_array_mut_slice region = bounds_of_Byte_array(src);
+    region.start_p = parse_skip_until_cedro_pragma(src, region, markers,
+                                                   options);
+    parse(src, region, markers,
+          options->use_defer_instead_of_auto, options->symbols);
+    *change = (MarkerChange){ 0, markers->len, old_len };
+    return not error_buffer[0];
+  }
+
+  size_t restart_index = index_Marker_array(markers, restart);
+  SrcIndexType restart_position = restart->start;
+  Marker_p before = skip_space_back(markers->start, restart);
+  bool has_previous = before is_not markers->start;
+  TokenType previous_token_type =
+      has_previous? (before-1)->token_type: T_NONE;
+
+  mut_Marker_array old = {0};
+  if (not splice_Marker_array(markers, restart_index,
+                              markers->len - restart_index, &old,
+                              (Marker_array_slice){0,0}) or
+      not splice_Byte_array(src, edit.start, edit.deleted, NULL,
+                            edit.inserted)) {
+    destruct_Marker_array(&old);
+    error("OUT OF MEMORY ERROR.");
+    return false;
+  }
+  memset(src->start + src->len, 0, PADDING_Byte_ARRAY);
+
+  // The old markers that start before the end of the deleted text
+  // are never valid again, so the resync search starts after them.
+  size_t old_edit_end = edit.start + edit.deleted;
+  Marker_mut_p undamaged = end_of_Marker_array(&old);
+  for (mut_Marker_mut_p m = start_of_mut_Marker_array(&old);
+       m is_not end_of_Marker_array(&old); ++m) {
+    if (m->start >= old_edit_end) {
+      if (undamaged is end_of_Marker_array(&old)) undamaged = m;
+      m->start += inserted - edit.deleted;
+    }
+  }
+  mut_ParseResync resync = {
+    .previous_token_is_value = has_previous and
+                               is_value_token(previous_token_type),
+    .previous_token_type     = previous_token_type,
+    .damage_end              = src->start + edit.start + inserted,
+    .old_start               = old.start,
+    .old_end                 = end_of_Marker_array(&old),
+    .old                     = undamaged
+  };
+
+  parse_with_resync(src, (Byte_array_slice){
+      src->start + restart_position, end_of_Byte_array(src)
+    }, markers, options->use_defer_instead_of_auto, options->symbols,
+    &resync);
+  if (error_buffer[0]) {
+    destruct_Marker_array(&old);
+    return false;
+  }
+
+  *change = (MarkerChange){
+    .start   = restart_index,
+    .end     = markers->len,
+    .old_end = restart_index + index_Marker_array(&old, resync.old)
+  };
+  bool ok = append_Marker_array(markers, (Marker_array_slice){
+      resync.old, resync.old_end
+    });
+  destruct_Marker_array(&old);
+  if (not ok) error("OUT OF MEMORY ERROR.");
+
+  return ok;
+}
+
+/* Token stream files, written by `--emit-tokens`, read by `--load-tokens`,
+ * and used by `cedrocc` to cache the markers of the Cedro files:
+ *   `TokenStreamHeader`
+ *   `marker_count` times `Marker`, as in memory but with `symbol` zero.
+ *   `src_len` bytes of source code, then `PADDING_Byte_ARRAY` zero bytes.
+ * The numbers and structs are in the format of the machine that wrote it,
+ * which is checked with `byte_order`, `marker_size`, and `token_type_size`.
+ * The token types are those of the version in the header. */
+
+/** Magic number at the start of a token stream file. */
+#define TOKEN_STREAM_MAGIC "CEDROTOK"
+/** Bits in `TokenStreamHeader.options`. */
+typedef enum TokenStreamOption {
+  /// `parse()` got `use_defer_instead_of_auto` from the options.
+  TOKEN_STREAM_DEFER_INSTEAD_OF_AUTO = 1,
+  /// `#embed` was enabled after reading the pragma.
+  TOKEN_STREAM_EMBED_DIRECTIVE       = 2,
+  /// `defer` was the keyword after reading the pragma.
+  TOKEN_STREAM_DEFER_KEYWORD         = 4,
+  /// The pragma asked for `goto-ladder`.
+  TOKEN_STREAM_GOTO_LADDER           = 8
+} TokenStreamOption;
+/** Header of a token stream file. */
+typedef struct TokenStreamHeader {
+  char magic[8];            ///< `TOKEN_STREAM_MAGIC`, without terminator.
+  char version[8];          ///< `CEDRO_VERSION`, padded with zeros.
+  uint32_t byte_order;      ///< `0x01020304` as written.
+  uint32_t marker_size;     ///< `sizeof(Marker)`.
+  uint32_t token_type_size; ///< `sizeof(TokenType)`.
+  uint32_t options;         ///< `TokenStreamOption` bits.
+  uint64_t content_hash;    ///< `hash_bytes(HASH_SEED, source)`.
+  uint64_t src_len;         ///< Source code length in bytes.
+  uint64_t marker_count;    ///< Number of markers.
+} MUT_CONST_TYPE_VARIANTS(TokenStreamHeader);
+
+/** Compute the `TokenStreamOption` bits for a file
+ * parsed with the options `before` reading its pragma,
+ * which are `after` once read. */
+static uint32_t
+token_stream_options(Options before, Options after)
+{
+  uint32_t bits = 0;
+  if (before.use_defer_instead_of_auto) {
+    bits |= TOKEN_STREAM_DEFER_INSTEAD_OF_AUTO;
+  }
+  if (after.enable_embed_directive) bits |= TOKEN_STREAM_EMBED_DIRECTIVE;
+  if (after.use_defer_instead_of_auto) bits |= TOKEN_STREAM_DEFER_KEYWORD;
+  if (after.use_goto_ladder_for_defer) bits |= TOKEN_STREAM_GOTO_LADDER;
+  return bits;
+}
+
+/** Write the markers and source code as a token stream.
+ * Returns error code, 0 if it succeeds. */
+static int
+write_token_stream(FILE* out, Marker_array_p markers, Byte_array_p src,
+                   uint32_t options)
+{
+  mut_TokenStreamHeader header = {
+    .magic           = TOKEN_STREAM_MAGIC,
+    .version         = CEDRO_VERSION,
+    .byte_order      = 0x01020304,
+    .marker_size     = sizeof(Marker),
+    .token_type_size = sizeof(TokenType),
+    .options         = options,
+    .content_hash    = hash_bytes(HASH_SEED, bounds_of_Byte_array(src)),
+    .src_len         = src->len,
+    .marker_count    = markers->len
+  };
+  if (fwrite(&header, sizeof(header), 1, out) is_not 1) return errno;
+  // Symbol IDs are only valid for the symbol table that made them.
+  mut_Marker buffer[256];
+  for (size_t i = 0; i < markers->len; i += 256) {
+    size_t count = markers->len - i < 256? markers->len - i: 256;
+    memcpy(buffer, markers->start + i, count * sizeof(Marker));
+    for (size_t j = 0; j is_not count; ++j) buffer[j].symbol = 0;
+    if (fwrite(buffer, sizeof(Marker), count, out) is_not count) return errno;
+  }
+  if (fwrite(src->start, 1, src->len, out) is_not src->len) return errno;
+  for (size_t i = 0; i is_not PADDING_Byte_ARRAY; ++i) {
+    if (fputc(0, out) is EOF) return errno;
+  }
+  return 0;
+}
+
+/** Token stream loaded with `load_token_stream()`. */
+typedef struct TokenStream {
+  /// The whole file, mapped into memory or read into `file`.
+  mut_FileMapping mapping;
+  /// The file contents, when read instead of mapped.
+  mut_Byte_array file;
+  /// The arrays to restore in `unload_token_stream()`.
+  mut_Marker_array markers;
+  /// The source buffer to restore in `unload_token_stream()`.
+  mut_Byte_array src;
+  /// Whether `markers` and `src` are currently borrowed.
+  bool loaded;
+} MUT_CONST_TYPE_VARIANTS(TokenStream);
+
+/** Load the token stream file at `path`, and make `markers` and `src`
+ * views of its contents, so that they can be used as if they came from
+ * `parse()`, with `options` updated as the pragma in it did.
+ * The file gets mapped into memory where possible, privately so
+ * that modifying the views only changes this process’ copy,
+ * and appending to them moves them to heap buffers as usual.
+ * If `expected_hash` is not `NULL`, the file must be for source code with
+ * that hash, and be parsed with the same `use_defer_instead_of_auto`,
+ * otherwise the hash gets checked against the source code in the file.
+ * Call `unload_token_stream()` when done, even if it fails.
+ * Returns error code, 0 if it succeeds, `EINVAL` if it is not
+ * a valid token stream for this version of Cedro or does not match. */
+static int
+load_token_stream(mut_TokenStream_p _, FilePath path,
+                  const uint64_t* expected_hash,
+                  mut_Marker_array_p markers, mut_Byte_array_p src,
+                  mut_Options_p options)
+{
+  Byte_mut_p content = NULL;
+  size_t size = 0;
+#ifdef CEDRO_MMAP
+  int fd = open(path, O_RDONLY);
+  if (fd is -1) return errno;
+  struct stat file_status;
+  if (fstat(fd, &file_status) is 0 and S_ISREG(file_status.st_mode) and
+      (size_t)file_status.st_size >= sizeof(TokenStreamHeader)) {
+    size = (size_t)file_status.st_size;
+    void* address = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                         fd, 0);
+    if (address is_not MAP_FAILED) {
+      _->mapping.address = address;
+      _->mapping.size    = size;
+      content = address;
+    }
+  }
+  close(fd);
+#endif
+  if (not content) {
+    int err = read_file(&_->file, path);
+    if (err) return err;
+    content = _->file.start;
+    size    = _->file.len;
+  }
+
+  TokenStreamHeader_p header = (TokenStreamHeader_p) content;
+  mut_TokenStreamHeader expected = {
+    .magic           = TOKEN_STREAM_MAGIC,
+    .version         = CEDRO_VERSION,
+    .byte_order      = 0x01020304,
+    .marker_size     = sizeof(Marker),
+    .token_type_size = sizeof(TokenType)
+  };
+  if (size < sizeof(TokenStreamHeader) or
+      memcmp(header, &expected, offsetof(TokenStreamHeader, options))) {
+    return EINVAL;
+  }
+  size_t markers_size = (size_t)header->marker_count * sizeof(Marker);
+  if (header->marker_count > SIZE_MAX / sizeof(Marker) or
+      header->src_len > SIZE_MAX - markers_size or
+      size - sizeof(TokenStreamHeader) <
+      markers_size + (size_t)header->src_len + PADDING_Byte_ARRAY) {
+    return EINVAL;
+  }
+  Byte_array_slice stored_src = {
+    content + sizeof(TokenStreamHeader) + markers_size,
+    content + sizeof(TokenStreamHeader) + markers_size + header->src_len
+  };
+  if (expected_hash) {
+    bool defer_instead_of_auto =
+        header->options & TOKEN_STREAM_DEFER_INSTEAD_OF_AUTO;
+    if (header->content_hash is_not *expected_hash or
+        defer_instead_of_auto is_not options->use_defer_instead_of_auto) {
+      return EINVAL;
+    }
+  } else if (header->content_hash is_not hash_bytes(HASH_SEED, stored_src)) {
+    return EINVAL;
+  }
+
+  _->markers = move_Marker_array(markers);
+  _->src     = move_Byte_array(src);
+  _->loaded  = true;
+  // Capacity zero means that the arrays do not own the memory.
+  *markers = (mut_Marker_array){
+    .len   = (size_t)header->marker_count,
+    .start = (mut_Marker_p)(content + sizeof(TokenStreamHeader))
+  };
+  *src = (mut_Byte_array){
+    .len   = (size_t)header->src_len,
+    .start = (mut_Byte_mut_p) stored_src.start_p
+  };
+
+  if (header->options & TOKEN_STREAM_EMBED_DIRECTIVE) {
+    options->enable_embed_directive = true;
+  }
+  if (header->options & TOKEN_STREAM_DEFER_KEYWORD) {
+    options->use_defer_instead_of_auto = true;
+  }
+  options->use_goto_ladder_for_defer =
+      header->options & TOKEN_STREAM_GOTO_LADDER;
+  if (options->symbols) {
+    for (mut_Marker_mut_p m = start_of_mut_Marker_array(markers);
+         m is_not end_of_Marker_array(markers); ++m) {
+      if (m->token_type is T_IDENTIFIER or
+          m->token_type is T_CONTROL_FLOW_LABEL) {
+        m->symbol = intern_symbol(options->symbols,
+                                  src->start + m->start,
+                                  src->start + m->start + m->len);
+      }
+    }
+  }
+
+  return 0;
+}
+
+/** Give back to `markers` and `src` the arrays they had before
+ * `load_token_stream()`, and release the file. */
+static void
+unload_token_stream(mut_TokenStream_p _,
+                    mut_Marker_array_p markers, mut_Byte_array_p src)
+{
+  if (_->loaded) {
+    destruct_Marker_array(markers); // Only does something if it was copied.
+    destruct_Byte_array(src);
+    *markers = move_Marker_array(&_->markers);
+    *src     = move_Byte_array(&_->src);
+    _->loaded = false;
+  }
+#ifdef CEDRO_MMAP
+  if (_->mapping.address) {
+    munmap(_->mapping.address, _->mapping.size);
+    _->mapping.address = NULL;
+    _->mapping.size    = 0;
+  }
+#endif
+  destruct_Byte_array(&_->file);
+}
+
 static inline bool
 write_token(Marker_p m, Byte_array_p src, Options options, FILE* out)
 {
@@ -2864,9 +3770,16 @@ typedef int (*IncludeCallbackFunction_p)(Marker_p m, Byte_array_p src,
                                          FILE* cc_stdin,
                                          void* const context,
                                          Options options);
+/**
+ * @param[in] path file read while expanding the source, e.g. by `#embed`.
+ */
+typedef void (*DependencyCallbackFunction_p)(const char* path,
+                                             void* const context);
 typedef struct IncludeCallback {
   IncludeCallbackFunction_p function;
   void* context;
+  /// Optional, called for each file read by `#embed`.
+  DependencyCallbackFunction_p dependency;
 } MUT_CONST_TYPE_VARIANTS(IncludeCallback);
 
 /* Prototype, defined after unparse_foreach(). */
@@ -2921,13 +3834,15 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
 
   size_t initial_replacements_len = replacements->len;
 
-  mut_Marker_array arguments = init_Marker_array(32);
+  mut_Marker_small_array_buffer arguments_inline;
+  mut_Marker_array arguments =
+      init_Marker_small_array(&arguments_inline);
   Byte_p parse_end =
       parse(src, (Byte_array_slice){rest, text.end_p}, &arguments,
-            options.use_defer_instead_of_auto);
+            options.use_defer_instead_of_auto, options.symbols);
   if (parse_end is_not text.end_p) {
     if (fprintf(out, "#line %zu \"%s\"\n#error %s\n",
-                original_line_number((size_t)(parse_end - src->start), src),
+                line_in_file((size_t)(parse_end - src->start), src, options),
                 src_file_name,
                 error_buffer) < 0) {
       eprintln(LANG("error al escribir la directiva #line",
@@ -2956,7 +3871,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
   if (arg.start_p is arg.end_p) {
     write_error_at(LANG("error sintáctico.",
                         "syntax error."),
-                   original_line_number(arg.start_p->start, src),
+                   line_in_file(arg.start_p->start, src, options),
                    NULL, NULL, src, out);
     m = m_end;
     goto exit;
@@ -2979,7 +3894,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
         if (arg.start_p is arg.end_p) {
           write_error_at(LANG("error sintáctico.",
                               "syntax error."),
-                         original_line_number(arg.start_p->start, src),
+                         line_in_file(arg.start_p->start, src, options),
                          NULL, NULL, src, out);
           m = m_end;
           goto exit;
@@ -2989,7 +3904,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
             write_error_at(
                 LANG("no se permiten llaves con una sola variable.",
                      "braces are not allowed with a single variable."),
-                original_line_number(arg.start_p->start, src),
+                line_in_file(arg.start_p->start, src, options),
                 NULL, NULL, src, out);
             m = m_end;
             goto exit;
@@ -3004,7 +3919,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
                               src)) {
               write_error_at(LANG("argumento duplicado.",
                                   "duplicated argument."),
-                             original_line_number(arg.start_p->start, src),
+                             line_in_file(arg.start_p->start, src, options),
                              NULL, NULL, src, out);
               m = m_end;
               goto exit;
@@ -3022,7 +3937,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
         if (arg.start_p->token_type is_not T_COMMA) {
           write_error_at(LANG("error sintáctico, se esperaba una coma.",
                               "syntax error, expected a comma."),
-                         original_line_number(arg.start_p->start, src),
+                         line_in_file(arg.start_p->start, src, options),
                          NULL, NULL, src, out);
           m = m_end;
           goto exit;
@@ -3033,7 +3948,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
     default:
       write_error_at(LANG("error sintáctico.",
                           "syntax error."),
-                     original_line_number(arg.start_p->start, src),
+                     line_in_file(arg.start_p->start, src, options),
                      NULL, NULL, src, out);
       m = m_end;
       goto exit;
@@ -3043,7 +3958,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
   if (arg.start_p is arg.end_p) {
     write_error_at(LANG("falta la lista de valores.",
                         "missing value list."),
-                   original_line_number(arguments.start->start, src),
+                   line_in_file(arguments.start->start, src, options),
                    NULL, NULL, src, out);
     m = m_end;
     goto exit;
@@ -3054,7 +3969,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
   } else if (arg.start_p->token_type is_not T_BLOCK_START) {
     write_error_at(LANG("error sintáctico en lista de valores.",
                         "syntax error in value list."),
-                   original_line_number(arguments.start->start, src),
+                   line_in_file(arguments.start->start, src, options),
                    NULL, NULL, src, out);
     m = m_end;
     goto exit;
@@ -3069,7 +3984,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
   if (arg.start_p is arg.end_p) {
     write_error_at(LANG("falta la lista de valores.",
                         "missing value list."),
-                   original_line_number(m->start, src),
+                   line_in_file(m->start, src, options),
                    NULL, NULL, src, out);
     m = m_end;
     goto exit;
@@ -3107,7 +4022,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
                 is_not arg.end_p) {
               write_error_at(LANG("contenido inválido tras lista de valores",
                                   "invalid content after value list"),
-                             original_line_number(value.start_p->start, src),
+                             line_in_file(value.start_p->start, src, options),
                              NULL, NULL, src, out);
               m = m_end;
               goto exit;
@@ -3120,7 +4035,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
           if (not nesting) {
             write_error_at(LANG("paréntesis desparejados en argumento.",
                                 "unpaired parentheses in argument."),
-                           original_line_number(value.start_p->start, src),
+                           line_in_file(value.start_p->start, src, options),
                            NULL, NULL, src, out);
             m = m_end;
             goto exit;
@@ -3138,7 +4053,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
     if (nesting) {
       write_error_at(LANG("grupo sin cerrar, error sintáctico",
                           "unclosed group, syntax error."),
-                     original_line_number(value.start_p->start, src),
+                     line_in_file(value.start_p->start, src, options),
                      NULL, NULL, src, out);
       m = m_end;
       goto exit;
@@ -3147,7 +4062,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
     if (value.end_p is arg.end_p) {
       write_error_at(LANG("lista de valores inconclusa",
                           "unfinished value list"),
-                     original_line_number(value.start_p->start, src),
+                     line_in_file(value.start_p->start, src, options),
                      NULL, NULL, src, out);
       m = m_end;
       goto exit;
@@ -3163,7 +4078,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
     if (value.start_p is value.end_p) {
       write_error_at(LANG("valor vacío",
                           "empty value"),
-                     original_line_number(value.end_p->start, src),
+                     line_in_file(value.end_p->start, src, options),
                      NULL, NULL, src, out);
       m = m_end;
       goto exit;
@@ -3189,7 +4104,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
               // This can not happen if the code above is correct.
               write_error_at(LANG("ERROR INTERNO EN CEDRO: 0x01",
                                   "INTERNAL ERROR IN CEDRO: 0x01"),
-                             original_line_number(arg.start_p->start, src),
+                             line_in_file(arg.start_p->start, src, options),
                              NULL, NULL, src, out);
               m = m_end;
               goto exit;
@@ -3200,7 +4115,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
             if (not nesting) {
               write_error_at(LANG("paréntisis desparejados en argumento.",
                                   "unpaired parentheses in argument."),
-                             original_line_number(value.start_p->start, src),
+                             line_in_file(value.start_p->start, src, options),
                              NULL, NULL, src, out);
               m = m_end;
               goto exit;
@@ -3212,7 +4127,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
             if (valueIndex is replacements->len) {
               write_error_at(LANG("mas valores que variables",
                                   "more values than variables"),
-                             original_line_number(value.start_p->start, src),
+                             line_in_file(value.start_p->start, src, options),
                              NULL, NULL, src, out);
               m = m_end;
               goto exit;
@@ -3223,7 +4138,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
             if (value.start_p is value.end_p) {
               write_error_at(LANG("valor vacío",
                                   "empty value"),
-                             original_line_number(value.end_p->start, src),
+                             line_in_file(value.end_p->start, src, options),
                              NULL, NULL, src, out);
               m = m_end;
               goto exit;
@@ -3249,7 +4164,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
         // This can not happen if the code above is correct.
         write_error_at(LANG("ERROR INTERNO EN CEDRO: 0x02",
                             "INTERNAL ERROR IN CEDRO: 0x02"),
-                       original_line_number(value.start_p->start, src),
+                       line_in_file(value.start_p->start, src, options),
                        NULL, NULL, src, out);
         m = m_end;
         goto exit;
@@ -3257,7 +4172,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
       if (valueIndex is replacements->len) {
         write_error_at(LANG("mas valores que variables",
                             "more values than variables"),
-                       original_line_number(value.start_p->start, src),
+                       line_in_file(value.start_p->start, src, options),
                        NULL, NULL, src, out);
         m = m_end;
         goto exit;
@@ -3266,7 +4181,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
       if (value.start_p is value.end_p) {
         write_error_at(LANG("valor vacío",
                             "empty value"),
-                       original_line_number(value.end_p->start, src),
+                       line_in_file(value.end_p->start, src, options),
                        NULL, NULL, src, out);
         m = m_end;
         goto exit;
@@ -3280,7 +4195,7 @@ unparse_foreach(Marker_array_slice markers, size_t previous_marker_end,
       if (valueIndex is_not replacements->len) {
         write_error_at(LANG("menos valores que variables",
                             "fewer values than variables"),
-                       original_line_number(value.start_p->start, src),
+                       line_in_file(value.start_p->start, src, options),
                        NULL, NULL, src, out);
         m = m_end;
         goto exit;
@@ -3354,7 +4269,7 @@ write_pending_space(bool* line_directive_pending, const char* src_file_name,
       }
       size_t line_number = 0;
       if (pending_space is end) {
-        line_number = original_line_number(pending_space->start + len, src);
+        line_number = line_in_file(pending_space->start + len, src, options);
       } else {
         // Skip plain spaces and synthetic tokens:
         Marker_mut_p next = pending_space + 1;
@@ -3366,7 +4281,7 @@ write_pending_space(bool* line_directive_pending, const char* src_file_name,
           ++next;
         }
         if (next is_not end and next->synthetic is true) next = end;
-        line_number = next is end? 0: original_line_number(next->start, src);
+        line_number = next is end? 0: line_in_file(next->start, src, options);
       }
       if (line_number is_not 0 and
           fprintf(out, "#line %zu \"%s\"\n", line_number, src_file_name) < 0) {
@@ -3495,7 +4410,7 @@ unparse_fragment(Marker_p m_start, Marker_p m_end, size_t previous_marker_end,
                 if (rest is_not text.end_p) {
                   write_error_at(LANG("contenido inválido tras `#define }`.",
                                       "invalid content after `#define }`"),
-                                 original_line_number(m->start, src),
+                                 line_in_file(m->start, src, options),
                                  m_start, m, src, out);
                   m = m_end;
                   goto exit;
@@ -3509,7 +4424,7 @@ unparse_fragment(Marker_p m_start, Marker_p m_end, size_t previous_marker_end,
             line_length += len_utf8(text.start_p, text.end_p, &err);
             if (utf8_error(err, (size_t)(text.start_p - src->start))) {
               write_error_at(error_buffer,
-                             original_line_number(m->start, src),
+                             line_in_file(m->start, src, options),
                              m_start, m, src, out);
               error_buffer[0] = 0;
               m = m_end;
@@ -3537,7 +4452,7 @@ unparse_fragment(Marker_p m_start, Marker_p m_end, size_t previous_marker_end,
               line_length += len_utf8(rest, eol, &err);
               if (utf8_error(err, (size_t)(rest - src->start))) {
                 write_error_at(error_buffer,
-                               original_line_number(m->start, src),
+                               line_in_file(m->start, src, options),
                                m_start, m, src, out);
                 error_buffer[0] = 0;
                 m = m_end;
@@ -3564,7 +4479,7 @@ unparse_fragment(Marker_p m_start, Marker_p m_end, size_t previous_marker_end,
             line_length += len_utf8(rest, rest + len, &err);
             if (utf8_error(err, (size_t)(rest - src->start))) {
               write_error_at(error_buffer,
-                             original_line_number(m->start, src),
+                             line_in_file(m->start, src, options),
                              m_start, m, src, out);
               error_buffer[0] = 0;
               m = m_end;
@@ -3582,7 +4497,7 @@ unparse_fragment(Marker_p m_start, Marker_p m_end, size_t previous_marker_end,
         write_error_at(
             LANG("cierre de directiva de bloque sin apertura previa.",
                  "block directive closing without previous opening."),
-            original_line_number(m->start, src),
+            line_in_file(m->start, src, options),
             m_start, m, src, out);
         m = m_end;
         goto exit;
@@ -3625,7 +4540,7 @@ unparse_fragment(Marker_p m_start, Marker_p m_end, size_t previous_marker_end,
             write_error_at(
                 LANG("falta la llave de cierre tras `#include {...`.",
                      "missing closing brace after `#include {...`"),
-                original_line_number(m->start, src),
+                line_in_file(m->start, src, options),
                 m_start, m, src, out);
             m = m_end;
             goto exit;
@@ -3639,7 +4554,7 @@ unparse_fragment(Marker_p m_start, Marker_p m_end, size_t previous_marker_end,
             write_error_at(
                 LANG("falta el fichero para `#embed ...`.",
                      "missing file for `#embed ...`"),
-                original_line_number(m->start, src),
+                line_in_file(m->start, src, options),
                 m_start, m, src, out);
             m = m_end;
             goto exit;
@@ -3660,6 +4575,9 @@ unparse_fragment(Marker_p m_start, Marker_p m_end, size_t previous_marker_end,
         file_name.len = len_Byte_array_slice(dirname);
         append_Byte_array(&file_name, (Byte_array_slice){ rest, end });
         const char* included_file = as_c_string(&file_name);
+        if (include and include->dependency) {
+          include->dependency(included_file, include->context);
+        }
         errno = 0;
         size_t bin_len = get_file_size(included_file);
         if (errno) {
@@ -3796,12 +4714,12 @@ unparse_fragment(Marker_p m_start, Marker_p m_end, size_t previous_marker_end,
             if (len is 10) {
               write_error_at(LANG("contenido inválido tras `#include {...}`.",
                                   "invalid content after `#include {...}`"),
-                             original_line_number(m->start, src),
+                             line_in_file(m->start, src, options),
                              m_start, m, src, out);
             } else {
               write_error_at(LANG("contenido inválido tras `#embed \"...\"`.",
                                   "invalid content after `#embed \"...\"`."),
-                             original_line_number(m->start, src),
+                             line_in_file(m->start, src, options),
                              m_start, m, src, out);
             }
             m = m_end;
@@ -3871,7 +4789,7 @@ unparse_fragment(Marker_p m_start, Marker_p m_end, size_t previous_marker_end,
             if (rest is_not text.end_p) {
               write_error_at(LANG("contenido inválido tras `#foreach }`.",
                                   "invalid content after `#foreach }`"),
-                             original_line_number(m->start, src),
+                             line_in_file(m->start, src, options),
                              m_start, m, src, out);
               m = m_end;
               goto exit;
@@ -3907,7 +4825,7 @@ unparse_fragment(Marker_p m_start, Marker_p m_end, size_t previous_marker_end,
             // TODO: improve error messages, report specific error.
             write_error_at(LANG("error en el `#include`.",
                                 "`#include` error."),
-                           original_line_number(m->start, src),
+                           line_in_file(m->start, src, options),
                            m_start, m, src, out);
             m = m_end;
             goto exit;
@@ -3949,7 +4867,7 @@ unparse_fragment(Marker_p m_start, Marker_p m_end, size_t previous_marker_end,
         if (m is m_end or m->token_type is_not T_IDENTIFIER) {
           write_error_at(LANG("falta el identificador tras `#`.",
                               "missing the identifier after `#`."),
-                         original_line_number(m->start, src),
+                         line_in_file(m->start, src, options),
                          m_start, m, src, out);
           m = m_end;
           goto exit;
@@ -3964,7 +4882,7 @@ unparse_fragment(Marker_p m_start, Marker_p m_end, size_t previous_marker_end,
           text = slice_for_marker(src, m);
           error_append((const char*)text.start_p, (const char*)text.end_p);
           write_error_at(error_buffer,
-                         original_line_number(m->start, src),
+                         line_in_file(m->start, src, options),
                          m_start, m, src, out);
           error_buffer[0] = 0;
           m = m_end;
@@ -4007,7 +4925,7 @@ unparse_fragment(Marker_p m_start, Marker_p m_end, size_t previous_marker_end,
                             " dentro de `#foreach`.",
                             "preprocessor directives are not allowed"
                             " inside `#foreach`."),
-                       original_line_number(m->start, src),
+                       line_in_file(m->start, src, options),
                        m_start, m, src, out);
         m = m_end;
         goto exit;
@@ -4035,7 +4953,7 @@ unparse_fragment(Marker_p m_start, Marker_p m_end, size_t previous_marker_end,
             Marker_mut_p line_start = find_line_start(m, m_start, &err);
             if (err.message) {
               write_error_at(err.message,
-                             original_line_number(m->start, src),
+                             line_in_file(m->start, src, options),
                              m_start, m, src, out);
               m = m_end;
               goto exit;
@@ -4108,11 +5026,18 @@ unparse(Marker_array_slice markers,
   /* We need a special case because unparse_fragment()
    * does not have enough context to decide whether to insert it. */
   if (options.insert_line_directives and m->start is_not 0) {
-    Marker empty = {0};
-    bool line_directive_pending = true;
-    if (not write_pending_space(&line_directive_pending, src_file_name,
-                                &empty, markers.end_p, src,
-                                options, out)) {
+    // Skip plain spaces and synthetic tokens, like write_pending_space().
+    Marker_mut_p next = m;
+    while (next is_not markers.end_p and
+           (next->synthetic is true or
+            (next->token_type is T_SPACE and not has_byte('\n', next, src)))) {
+      ++next;
+    }
+    if (next is_not markers.end_p and next->synthetic is_not true and
+        fprintf(out, "#line %zu \"%s\"\n",
+                line_in_file(next->start, src, options), src_file_name) < 0) {
+      error(LANG("al escribir la directiva #line",
+                 "when writing #line directive"));
       return;
     }
   }
@@ -4132,10 +5057,13 @@ unparse(Marker_array_slice markers,
 }
 
 typedef void (*MacroFunction_p)(mut_Marker_array_p markers,
-                                mut_Byte_array_p src);
+                                mut_Byte_array_p src,
+                                Options_p options, Arena* arena);
 typedef const struct Macro {
   MacroFunction_p function;
   const char* name;
+  /// Token types that the macro looks for, ending with `T_NONE`.
+  TokenType* triggers;
 } Macro, * Macro_p;
 #include "macros.h"
 #define MACROS_DECLARE
@@ -4145,48 +5073,642 @@ static Macro macros[] = {
 };
 #undef  MACROS_DECLARE
 
-#include <time.h>
-/** Returns the time in seconds, as a double precision floating point value. */
-static double
-benchmark(mut_Byte_array_p src_p, const char* src_file_name,
-          mut_Options options)
+/** Find the end of the first top-level function definition
+ * in `[start, end)`, where `start` must be at the top level,
+ * and return the position after its closing `}`.
+ *  The macros never look beyond a function definition,
+ * so they can be applied to each one separately.
+ *  Returns `end` if there is none, or if the fences are unbalanced,
+ * for instance because of `#if`. */
+static Marker_p
+find_top_level_function_end(Marker_p start, Marker_p end)
 {
-  const size_t repetitions = 100;
-  clock_t start = clock();
-
-  mut_Marker_array markers = init_Marker_array(8192);
+  size_t nesting = 0;
+  bool function_body = false;
+  for (Marker_mut_p m = start; m is_not end; ++m) {
+    switch (m->token_type) {
+      case T_BLOCK_START:
+        if (nesting is 0) {
+          Marker_p previous = skip_space_back(start, m);
+          function_body = previous is_not start and
+              (previous - 1)->token_type is T_TUPLE_END;
+        }
+        ++nesting;
+        break;
+      case T_TUPLE_START: case T_INDEX_START:
+        ++nesting;
+        break;
+      case T_BLOCK_END: case T_TUPLE_END: case T_INDEX_END:
+        if (nesting is 0) return end;
+        --nesting;
+        if (nesting is 0 and function_body and
+            m->token_type is T_BLOCK_END) {
+          return m + 1;
+        }
+        break;
+      default: break;
+    }
+  }
+  return end;
+}
 
-  for (size_t i = repetitions + 1; i; --i) {
-    delete_Marker_array(&markers, 0, markers.len);
+/** Check whether `macro` has anything to do in `[start, end)`,
+ * that is, whether any of its trigger tokens appears there. */
+static bool
+is_macro_triggered(Macro_p macro, Marker_p start, Marker_p end)
+{
+  for (Marker_mut_p m = start; m is_not end; ++m) {
+    for (TokenType* t = macro->triggers; *t is_not T_NONE; ++t) {
+      if (m->token_type is *t) return true;
+    }
+  }
+  return false;
+}
+
+/** Check whether the macros inserted an `#error` directive. */
+static bool
+has_macro_error(Marker_array_p markers, Byte_array_p src)
+{
+  Marker_array_slice slice = bounds_of_Marker_array(markers);
+  for (Marker_mut_p m = slice.start_p; m is_not slice.end_p; ++m) {
+    if (m->synthetic and m->token_type is T_PREPROCESSOR and
+        m->len >= 6 and
+        mem_eq("#error", get_Byte_array(src, m->start), 6)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/** Apply one macro, releasing afterwards its temporary arrays
+ *  in `arena` so that it does not grow with the file size.
+ *  If `arena` is `NULL`, they use `malloc()`. */
+static void
+apply_macro(Macro_p macro, mut_Marker_array_p markers, mut_Byte_array_p src,
+            Options_p options, Arena* arena)
+{
+  if (not arena) {
+    macro->function(markers, src, options, NULL);
+    return;
+  }
+  ArenaMark mark = mark_Arena(arena);
+  macro->function(markers, src, options, arena);
+  rewind_Arena(arena, mark);
+}
+
+/** Apply all the macros in `macros[]`, in a single traversal of `markers`.
+ *  Each top-level function definition, together with any declarations
+ * before it, gets copied into a small working array, and only the macros
+ * triggered by its tokens are applied to it, in the same order as in
+ * `macros[]`, while it is still in the cache.
+ * This also makes each insertion move only the markers of that function
+ * instead of those until the end of the file.
+ * The rest is copied to the result without changes.
+ *  If any macro reports an error, they are applied again one after another
+ * to the whole array, because `error_at()` replaces the whole output
+ * with the first error found, which depends on that order.
+ *  The macros allocate their temporary arrays in `arena`,
+ * which must not be used by any other thread meanwhile,
+ * or with `malloc()` if it is `NULL`. */
+static void
+apply_macros(mut_Marker_array_p markers, mut_Byte_array_p src,
+             Options_p options, Arena* arena)
+{
+  const size_t src_len = src->len;
+  bool ok = false;
+  mut_Marker_array result  = {0};
+  mut_Marker_array segment = init_Marker_array(1024);
+  Marker_p start  = start_of_Marker_array(markers);
+  Marker_p end    =   end_of_Marker_array(markers);
+  Marker_mut_p copied = start; // Markers before this are already in `result`.
+  for (Marker_mut_p cursor = start; cursor is_not end; ) {
+    Marker_p segment_end = find_top_level_function_end(cursor, end);
+    bool triggered = false;
+    segment.len = 0;
+    for (Macro_p macro = macros; macro->name and macro->function; ++macro) {
+      if (segment.len is 0) {
+        if (not is_macro_triggered(macro, cursor, segment_end)) continue;
+        Marker_array_slice slice = { cursor, segment_end };
+        if (not append_Marker_array(&segment, slice)) goto exit;
+        triggered = true;
+      } else if (not is_macro_triggered(macro,
+                                        start_of_Marker_array(&segment),
+                                        end_of_Marker_array(&segment))) {
+        continue;
+      }
+      apply_macro(macro, &segment, src, options, arena);
+    }
+    if (triggered) {
+      if (has_macro_error(&segment, src)) goto exit;
+      if (result.capacity is 0) {
+        result = init_Marker_array(markers->len + segment.len);
+      }
+      Marker_array_slice unchanged = { copied, cursor };
+      if (not append_Marker_array(&result, unchanged) or
+          not append_Marker_array(&result, bounds_of_Marker_array(&segment))) {
+        goto exit;
+      }
+      copied = segment_end;
+    }
+    cursor = segment_end;
+  }
+  if (copied is_not start) {
+    Marker_array_slice unchanged = { copied, end };
+    if (not append_Marker_array(&result, unchanged)) goto exit;
+    destruct_Marker_array(markers);
+    *markers = move_Marker_array(&result);
+  }
+  ok = true;
+
+exit:
+  destruct_Marker_array(&segment);
+  destruct_Marker_array(&result);
+  if (not ok) {
+    src->len = src_len;
+    for (Macro_p macro = macros; macro->name and macro->function; ++macro) {
+      apply_macro(macro, markers, src, options, arena);
+    }
+  }
+}
+
+#ifdef CEDRO_THREADS
+#include <pthread.h>
+
+/** Part of the marker array to which a thread applies the macros. */
+typedef struct MacroSegment {
+  /// Markers of the segment, that get replaced by the result.
+  mut_Marker_array markers;
+  /// The original `src`, followed by the synthetic text of this segment,
+  /// see `share_src_with_segments()`.
+  mut_Byte_array src;
+  /// Private mapping of the shared `src` file behind `src`, if any.
+  mut_FileMapping mapping;
+  /// Options for the macros, shared by all the segments.
+  Options_mut_p options;
+  /// Arena for the temporary arrays of the macros in this thread.
+  Arena arena;
+} MUT_CONST_TYPE_VARIANTS(MacroSegment);
+
+/** Thread body: apply all macros to one `MacroSegment`. */
+static void*
+apply_macros_to_segment(void* segment_p)
+{
+  mut_MacroSegment_p segment = segment_p;
+  apply_macros(&segment->markers, &segment->src, segment->options,
+               &segment->arena);
+  return NULL;
+}
+
+/** Split `markers` into at most `count` segments of similar length,
+ * cutting only after top-level function definitions.
+ *  Writes into `ends` the index after the end of each segment,
+ * and returns the number of segments. */
+static size_t
+find_macro_segments(Marker_array_p markers, size_t count, size_t ends[])
+{
+  size_t segments = 0;
+  Marker_p start = start_of_Marker_array(markers);
+  Marker_p end   =   end_of_Marker_array(markers);
+  for (Marker_mut_p m = start; m is_not end and segments + 1 < count; ) {
+    m = find_top_level_function_end(m, end);
+    size_t index = (size_t)(m - start);
+    if (m is_not end and index >= markers->len * (segments + 1) / count) {
+      ends[segments++] = index;
+    }
+  }
+  ends[segments++] = markers->len;
+  return segments;
+}
+
+/** Give each of the `count` segments a `src` array that starts with
+ * the `src_len` bytes of `src`, where the macros append synthetic text.
+ *  In POSIX systems, `src` gets written once to the temporary file
+ * `shared_src`, which each segment maps privately with room after it:
+ * the pages of the original text stay shared because the macros never
+ * modify them, and only those with synthetic text get copied.
+ * Otherwise, or if that fails, each segment gets a view of `src`,
+ * that only gets copied if a macro needs to append something.
+ * Either way, a segment that outgrows its room moves to a heap buffer. */
+static void
+share_src_with_segments(Byte_array_p src, size_t src_len,
+                        mut_MacroSegment segments[], size_t count,
+                        FILE* shared_src)
+{
+#ifdef CEDRO_MMAP
+  long page_size = sysconf(_SC_PAGESIZE);
+  size_t mapping_size = 0;
+  if (shared_src and page_size > 0) {
+    // As much synthetic text as there was source code, at least 64 KiB.
+    // The file gets extended with zeros, which is also the padding.
+    mapping_size = 2 * src_len + 64 * 1024;
+    mapping_size += (size_t)page_size - mapping_size % (size_t)page_size;
+    if (fwrite(src->start, 1, src_len, shared_src) is_not src_len or
+        fflush(shared_src) is_not 0 or
+        ftruncate(fileno(shared_src), (off_t)mapping_size) is_not 0) {
+      mapping_size = 0;
+    }
+  }
+#endif
+  for (size_t i = 0; i is_not count; ++i) {
+#ifdef CEDRO_MMAP
+    void* address = mapping_size?
+        mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+             fileno(shared_src), 0):
+        MAP_FAILED;
+    if (address is_not MAP_FAILED) {
+      segments[i].mapping.address = address;
+      segments[i].mapping.size    = mapping_size;
+      // Not owned, but with room to grow in place as the small arrays.
+      segments[i].src = (mut_Byte_array){
+        .len      = src_len,
+        .capacity = mapping_size | ARRAY_INLINE_BUFFER,
+        .start    = address
+      };
+      continue;
+    }
+#endif
+    // Capacity zero means that the array does not own the memory.
+    segments[i].src = (mut_Byte_array){ .len = src_len, .start = src->start };
+  }
+}
+
+/** Apply the macros in up to `jobs` threads, to segments of `markers`
+ * that end at top-level function definitions, each one sharing `src`
+ * and appending its synthetic text after it,
+ * see `share_src_with_segments()`.
+ * The results are concatenated, and the synthetic text of each segment
+ * appended to `src`, giving the same output as applying them serially.
+ *  Returns `false` without modifying `markers` if that is not possible,
+ * for instance because there is only one function, or if any macro
+ * reported an error: in that case the caller must apply them serially,
+ * so that the error is the same as without threads. */
+static bool
+apply_macros_in_parallel(mut_Marker_array_p markers, mut_Byte_array_p src,
+                         Options_p options, size_t jobs)
+{
+#ifdef CEDRO_STATS
+  // The statistics counters are not thread-safe.
+  return false;
+#endif
+  bool ok = false;
+  const size_t src_len = src->len;
+  size_t* ends = malloc(jobs * sizeof(ends[0]));
+  mut_MacroSegment_p segments = calloc(jobs, sizeof(segments[0]));
+  pthread_t* threads = malloc(jobs * sizeof(threads[0]));
+  mut_Marker_array result = {0};
+  FILE* shared_src = NULL;
+  size_t count = 0, started = 1;
+  if (not ends or not segments or not threads) goto exit;
+
+  count = find_macro_segments(markers, jobs, ends);
+  if (count < 2) goto exit;
+  for (size_t i = 0; i is_not count; ++i) {
+    size_t start = i? ends[i - 1]: 0;
+    Marker_array_slice slice = {
+      markers->start + start, markers->start + ends[i]
+    };
+    segments[i].markers = init_Marker_array(ends[i] - start);
+    segments[i].options = options;
+    if (not append_Marker_array(&segments[i].markers, slice)) goto exit;
+  }
+#ifdef CEDRO_MMAP
+  shared_src = tmpfile();
+#endif
+  share_src_with_segments(src, src_len, segments, count, shared_src);
+
+  // The first segment is done in this thread.
+  while (started is_not count and
+         0 is pthread_create(&threads[started], NULL,
+                             apply_macros_to_segment, &segments[started])) {
+    ++started;
+  }
+  apply_macros_to_segment(&segments[0]);
+  for (size_t i = 1; i is_not started; ++i) pthread_join(threads[i], NULL);
+  for (size_t i = started; i is_not count; ++i) {
+    apply_macros_to_segment(&segments[i]);
+  }
+
+  for (size_t i = 0; i is_not count; ++i) {
+    if (has_macro_error(&segments[i].markers, &segments[i].src)) goto exit;
+  }
+
+  size_t result_len = 0;
+  for (size_t i = 0; i is_not count; ++i) {
+    result_len += segments[i].markers.len;
+  }
+  result = init_Marker_array(result_len);
+  for (size_t i = 0; i is_not count; ++i) {
+    Byte_array_p segment_src = &segments[i].src;
+    size_t base = src->len;
+    Byte_array_slice synthetic = {
+      segment_src->start + src_len, segment_src->start + segment_src->len
+    };
+    if (not append_Byte_array(src, synthetic)) goto exit;
+    Marker_array_slice slice = bounds_of_Marker_array(&segments[i].markers);
+    for (Marker_mut_p m = slice.start_p; m is_not slice.end_p; ++m) {
+      mut_Marker marker = *m;
+      if (marker.start >= src_len) {
+        marker.start = marker.start - src_len + base;
+      } else if (marker.start + marker.len > src_len) {
+        // Text found by Marker_from() across the end of the original.
+        Byte_array_slice text = slice_for_marker(segment_src, &marker);
+        marker.start = src->len;
+        if (not append_Byte_array(src, text)) goto exit;
+      }
+      if (not push_Marker_array(&result, marker)) goto exit;
+    }
+  }
+
+  destruct_Marker_array(markers);
+  *markers = move_Marker_array(&result);
+  ok = true;
+
+exit:
+  if (not ok) src->len = src_len;
+  destruct_Marker_array(&result);
+  if (segments) {
+    for (size_t i = 0; i is_not count; ++i) {
+      destruct_Marker_array(&segments[i].markers);
+      destruct_Byte_array(&segments[i].src);
+      destruct_Arena(&segments[i].arena);
+#ifdef CEDRO_MMAP
+      if (segments[i].mapping.address) {
+        munmap(segments[i].mapping.address, segments[i].mapping.size);
+      }
+#endif
+    }
+  }
+  if (shared_src) fclose(shared_src);
+  free(threads);
+  free(segments);
+  free(ends);
+  return ok;
+}
+#endif // CEDRO_THREADS
+
+#include <time.h>
+
+typedef double MUT_CONST_TYPE_VARIANTS(Seconds);
+DEFINE_ARRAY_OF(Seconds, 0, {});
+
+/** Timing samples for one phase of the processing pipeline. */
+typedef struct BenchmarkPhase {
+  /// Phase name, for instance `"parse"` or `"macro:defer"`.
+  const char* name;
+  /// One sample per measured run, in seconds.
+  mut_Seconds_array samples;
+  /// Fastest, median, and 95th percentile of the samples, in seconds.
+  double min, median, p95;
+} MUT_CONST_TYPE_VARIANTS(BenchmarkPhase);
+DEFINE_ARRAY_OF(BenchmarkPhase, 0, {
+    while (cursor is_not end) destruct_Seconds_array(&(cursor++)->samples);
+  });
+
+/** Settings for `benchmark()`. */
+typedef struct BenchmarkOptions {
+  /// Measured runs.
+  size_t runs;
+  /// Runs done before measuring, to fill caches and grow the buffers.
+  size_t warmup_runs;
+  /// Write the results as JSON to `out` instead of as text to `stderr`.
+  bool json;
+} MUT_CONST_TYPE_VARIANTS(BenchmarkOptions);
+
+static int
+compare_seconds(const void* a, const void* b)
+{
+  Seconds x = *(Seconds_p)a, y = *(Seconds_p)b;
+  return x < y? -1: x > y? 1: 0;
+}
+
+/** Sort the samples and compute the statistics. */
+static void
+compute_benchmark_statistics(mut_BenchmarkPhase_p _)
+{
+  size_t n = _->samples.len;
+  if (n is 0) return;
+  qsort(_->samples.start, n, sizeof(_->samples.start[0]), compare_seconds);
+  _->min    = _->samples.start[0];
+  _->median = n % 2? _->samples.start[n/2]:
+      (_->samples.start[n/2 - 1] + _->samples.start[n/2]) / 2.0;
+  // Nearest rank: the smallest sample not below 95% of them.
+  _->p95    = _->samples.start[(95 * n + 99) / 100 - 1];
+}
+
+/** Write `text` as a JSON string. */
+static void
+fputs_json_string(const char* text, FILE* out)
+{
+  fputc('"', out);
+  for (Byte_mut_p c = (Byte_p)text; *c; ++c) {
+    if      (*c is '"' or *c is '\\') fprintf(out, "\\%c", *c);
+    else if (*c < 0x20)               fprintf(out, "\\u%04X", *c);
+    else                              fputc(*c, out);
+  }
+  fputc('"', out);
+}
+
+#ifdef _WIN32
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+
+/** Run the whole pipeline on `src_p` several times, timing each phase:
+ *  pragma scan, parse, `#embed` preparation, each macro,
+ *  and unparse to the null device.
+ *  `src_p` must contain the file as read, before any processing.
+ *  The times are processor time as measured by `clock()`.
+ *  Returns error code, 0 if it succeeds. */
+static int
+benchmark(mut_Byte_array_p src_p, const char* src_file_name,
+          mut_Options options, BenchmarkOptions benchmark_options,
+          FILE* out)
+{
+  int err = 0;
+  const size_t src_len = src_p->len;
+  size_t token_count = 0;
+
+  FILE* sink = fopen(NULL_DEVICE, "wb");
+  if (not sink) {
+    print_file_error(errno, NULL_DEVICE, 0);
+    return 11;
+  }
+
+  mut_Marker_array markers = init_Marker_array(estimate_marker_count(src_len));
+  mut_BenchmarkPhase_array phases = init_BenchmarkPhase_array(8);
+  const char* const fixed_phases[] = { "pragma", "parse", "embed" };
+  for (size_t i = 0; i < sizeof(fixed_phases)/sizeof(fixed_phases[0]); ++i) {
+    push_BenchmarkPhase_array(&phases, (BenchmarkPhase){
+        .name = fixed_phases[i],
+        .samples = init_Seconds_array(benchmark_options.runs) });
+  }
+  const size_t first_macro_phase = phases.len;
+  for (Macro_p macro = macros; macro->name and macro->function; ++macro) {
+    push_BenchmarkPhase_array(&phases, (BenchmarkPhase){
+        .name = macro->name,
+        .samples = init_Seconds_array(benchmark_options.runs) });
+  }
+  const size_t unparse_phase = phases.len;
+  push_BenchmarkPhase_array(&phases, (BenchmarkPhase){
+      .name = "unparse",
+      .samples = init_Seconds_array(benchmark_options.runs) });
+  const size_t total_phase = phases.len;
+  push_BenchmarkPhase_array(&phases, (BenchmarkPhase){
+      .name = "total",
+      .samples = init_Seconds_array(benchmark_options.runs) });
+
+  Arena arena = {0};
+  const size_t total_runs =
+      benchmark_options.warmup_runs + benchmark_options.runs;
+  for (size_t run = 0; run < total_runs; ++run) {
+    bool measured = run >= benchmark_options.warmup_runs;
+    // Discard anything appended by the previous run,
+    // also from the padding that the lexer reads past the end:
+    src_p->len  = src_len;
+    memset(src_p->start + src_len, 0, PADDING_Byte_ARRAY);
+    markers.len = 0;
+    mut_Options run_options = options;
+    size_t phase = 0;
+    clock_t total_start = clock();
+    clock_t start = total_start;
+#define END_PHASE do {                                                  \
+      clock_t now = clock();                                            \
+      if (measured) {                                                   \
+        push_Seconds_array(&phases.start[phase].samples,                \
+                           (double)(now - start) / CLOCKS_PER_SEC);     \
+      }                                                                 \
+      ++phase;                                                          \
+      start = now;                                                      \
+    } while (0)
+
+    Byte_array_mut_slice region = bounds_of_Byte_array(src_p);
+    region.start_p = parse_skip_until_cedro_pragma(src_p, region, &markers,
+                                                   &run_options);
+    END_PHASE;
 
-    Byte_array_mut_slice region = bounds_of_Byte_array(src_p);
-    region.start_p = parse_skip_until_cedro_pragma(src_p, region, &markers,
-                                                   &options);
     Byte_p parse_end = parse(src_p, region, &markers,
-                             options.use_defer_instead_of_auto);
+                             run_options.use_defer_instead_of_auto,
+                             run_options.symbols);
     if (parse_end is_not region.end_p) {
-      destruct_Marker_array(&markers);
       eprintln("#line %zu \"%s\"\n#error %s\n",
                original_line_number((size_t)(parse_end - src_p->start), src_p),
                src_file_name,
                error_buffer);
       error_buffer[0] = 0;
-      return 0.0; // Error.
+      err = 1;
+      break;
+    }
+    token_count = markers.len;
+    END_PHASE;
+
+    if (run_options.enable_embed_directive and run_options.embed_as_string) {
+      err = prepare_binary_embedding(&markers, src_p, src_file_name);
+      if (err) {
+        eprintln("#line %zu \"%s\"\n#error %s\n",
+                 original_line_number((size_t)(parse_end - src_p->start),
+                                      src_p),
+                 src_file_name,
+                 error_buffer);
+        break;
+      }
     }
+    END_PHASE;
+    size_t original_src_len = src_p->len;
 
-    if (options.apply_macros) {
-      Macro_p macro = macros;
-      while (macro->name and macro->function) {
-        macro->function(&markers, src_p);
-        ++macro;
+    bool has_pragma = not is_without_cedro_pragma(&markers, src_p);
+    for (Macro_p macro = macros; macro->name and macro->function; ++macro) {
+      if (run_options.apply_macros and has_pragma) {
+        apply_macro(macro, &markers, src_p, &run_options, &arena);
+      }
+      END_PHASE;
+    }
+    assert(phase is unparse_phase);
+
+    unparse(bounds_of_Marker_array(&markers),
+            src_p, original_src_len,
+            src_file_name,
+            run_options, sink);
+    fflush(sink);
+    END_PHASE;
+#undef END_PHASE
+
+    if (measured) {
+      push_Seconds_array(&phases.start[total_phase].samples,
+                         (double)(start - total_start) / CLOCKS_PER_SEC);
+    }
+    if (not benchmark_options.json) fputc('.', stderr);
+  }
+  if (not benchmark_options.json) fputc('\n', stderr);
+  src_p->len = src_len;
+  memset(src_p->start + src_len, 0, PADDING_Byte_ARRAY);
+
+  if (not err) {
+    for (mut_BenchmarkPhase_mut_p phase = phases.start;
+         phase is_not phases.start + phases.len;
+         ++phase) {
+      compute_benchmark_statistics(phase);
+    }
+    double total = phases.start[total_phase].median;
+    double tokens_per_second = total > 0.0? (double)token_count / total: 0.0;
+    double megabytes_per_second =
+        total > 0.0? (double)src_len / total / 1e6: 0.0;
+
+    if (benchmark_options.json) {
+      fputs("{\"file\": ", out);
+      fputs_json_string(src_file_name, out);
+      fprintf(out,
+              ", \"bytes\": %zu, \"tokens\": %zu"
+              ", \"runs\": %zu, \"warmup_runs\": %zu"
+              ", \"clock\": \"process\"",
+              src_len, token_count,
+              benchmark_options.runs, benchmark_options.warmup_runs);
+      fputs(",\n \"phases\": [", out);
+      for (size_t i = 0; i < phases.len; ++i) {
+        BenchmarkPhase_p phase = phases.start + i;
+        fprintf(out, "%s\n  {\"name\": ", i? ",": "");
+        if (i >= first_macro_phase and i < unparse_phase) {
+          fprintf(out, "\"macro:%s\"", phase->name);
+        } else {
+          fputs_json_string(phase->name, out);
+        }
+        fprintf(out,
+                ", \"min\": %.9f, \"median\": %.9f, \"p95\": %.9f}",
+                phase->min, phase->median, phase->p95);
+      }
+      fprintf(out,
+              "\n ],\n \"tokens_per_second\": %.0f"
+              ", \"megabytes_per_second\": %.3f}\n",
+              tokens_per_second, megabytes_per_second);
+    } else {
+      eprintln(LANG("%s: %zu octetos, %zu lexemas,"
+                    " %zu repeticiones tras %zu de calentamiento.",
+                    "%s: %zu bytes, %zu tokens,"
+                    " %zu runs after %zu warm-up runs."),
+               src_file_name, src_len, token_count,
+               benchmark_options.runs, benchmark_options.warmup_runs);
+      eprintln("%-16s %10s %10s %10s (ms)",
+               LANG("fase", "phase"), LANG("mínimo", "min"),
+               LANG("mediana", "median"), "p95");
+      for (size_t i = 0; i < phases.len; ++i) {
+        BenchmarkPhase_p phase = phases.start + i;
+        eprintln("%s%-*s %10.3f %10.3f %10.3f",
+                 i >= first_macro_phase and i < unparse_phase? "macro:": "",
+                 i >= first_macro_phase and i < unparse_phase? 10: 16,
+                 phase->name,
+                 phase->min * 1e3, phase->median * 1e3, phase->p95 * 1e3);
       }
+      eprintln(LANG("%.0f lexemas/s, %.3f MB/s (mediana del total)",
+                    "%.0f tokens/s, %.3f MB/s (median of total)"),
+               tokens_per_second, megabytes_per_second);
     }
-    fputc('.', stderr);
   }
 
-  clock_t end = clock();
+  destruct_BenchmarkPhase_array(&phases);
   destruct_Marker_array(&markers);
-  return ((double)(end - start))/CLOCKS_PER_SEC / (double) repetitions;
+  destruct_Arena(&arena);
+  fclose(sink);
+  return err;
 }
 
 /** Validates equivalence of input file to the given reference file.
@@ -4197,14 +5719,16 @@ validate_eq(mut_Byte_array_p src, mut_Byte_array_p src_ref,
             const char* src_file_name, const char* src_ref_file_name)
 {
   bool result = true;
-  mut_Marker_array markers     = init_Marker_array(8192);
-  mut_Marker_array markers_ref = init_Marker_array(8192);
+  mut_Marker_array markers     =
+      init_Marker_array(estimate_marker_count(src->len));
+  mut_Marker_array markers_ref =
+      init_Marker_array(estimate_marker_count(src_ref->len));
 
   /* Do not apply macros or anything else, just a straight tokenization. */
   Byte_array_mut_slice region;
   Byte_mut_p parse_end;
   region    = bounds_of_Byte_array(src);
-  parse_end = parse(src, region, &markers, false);
+  parse_end = parse(src, region, &markers, false, NULL);
   if (parse_end is_not region.end_p) {
     result = false;
     eprintln("#line %zu \"%s\"\n#error %s\n",
@@ -4215,7 +5739,7 @@ validate_eq(mut_Byte_array_p src, mut_Byte_array_p src_ref,
     goto exit;
   }
   region    = bounds_of_Byte_array(src_ref);
-  parse_end = parse(src_ref, region, &markers_ref, false);
+  parse_end = parse(src_ref, region, &markers_ref, false, NULL);
   if (parse_end is_not region.end_p) {
     result = false;
     eprintln("#line %zu \"%s\"\n#error %s\n",
@@ -4285,20 +5809,451 @@ exit:
 }
 
 
+/** Bytes of one line of the original source, before and after
+ * applying the macros, for `report_expansion()`. */
+typedef struct ExpansionLine {
+  /// Position in `src` where the line starts.
+  size_t start;
+  /// Bytes in markers that come from this line, before the macros.
+  size_t before;
+  /// Same after the macros, including synthetic text after them.
+  size_t after;
+} MUT_CONST_TYPE_VARIANTS(ExpansionLine);
+DEFINE_ARRAY_OF(ExpansionLine, 0, {});
+
+/** Function definition found at the top level, for `report_expansion()`. */
+typedef struct ExpansionFunction {
+  /// Position and length in `src` of the function name,
+  /// length 0 if not found.
+  size_t name_start, name_len;
+  /// Line range, as indices in the `ExpansionLine` array.
+  size_t first_line, last_line;
+  /// Bytes of those lines before and after applying the macros.
+  size_t before, after;
+} MUT_CONST_TYPE_VARIANTS(ExpansionFunction);
+DEFINE_ARRAY_OF(ExpansionFunction, 0, {});
+
+/** Index in `lines` of the line that contains `position`. */
+static size_t
+expansion_line_index(ExpansionLine_array_p lines, size_t position)
+{
+  size_t low = 0, high = lines->len;
+  while (high - low > 1) {
+    size_t middle = low + (high - low) / 2;
+    if (lines->start[middle].start <= position) low  = middle;
+    else                                         high = middle;
+  }
+  return low;
+}
+
+static int
+compare_markers_by_position(const void* a, const void* b)
+{
+  Marker_p x = a, y = b;
+  if (x->start      is_not y->start)      return x->start < y->start? -1: 1;
+  if (x->len        is_not y->len)        return x->len   < y->len?   -1: 1;
+  if (x->token_type is_not y->token_type) {
+    return x->token_type < y->token_type? -1: 1;
+  }
+  return 0;
+}
+
+/** Count the markers in `after` that are not in `before` and vice versa,
+ * where both are sorted with `compare_markers_by_position()`.
+ * Copies count as added markers. */
+static void
+count_marker_changes(Marker_array_p before, Marker_array_p after,
+                     size_t* added, size_t* removed)
+{
+  *added = *removed = 0;
+  Marker_mut_p b = before->start, b_end = before->start + before->len;
+  Marker_mut_p a = after->start,  a_end = after->start  + after->len;
+  while (b is_not b_end and a is_not a_end) {
+    int order = compare_markers_by_position(b, a);
+    if      (order < 0) { ++*removed; ++b; }
+    else if (order > 0) { ++*added;   ++a; }
+    else                { ++b; ++a; }
+  }
+  *removed += (size_t)(b_end - b);
+  *added   += (size_t)(a_end - a);
+}
+
+static int
+compare_expansion_lines_by_growth(const void* a, const void* b)
+{
+  ExpansionLine_p x = a, y = b;
+  long growth_x = (long)x->after - (long)x->before;
+  long growth_y = (long)y->after - (long)y->before;
+  return growth_x > growth_y? -1: growth_x < growth_y? 1: 0;
+}
+
+static int
+compare_expansion_functions_by_growth(const void* a, const void* b)
+{
+  ExpansionFunction_p x = a, y = b;
+  long growth_x = (long)x->after - (long)x->before;
+  long growth_y = (long)y->after - (long)y->before;
+  return growth_x > growth_y? -1: growth_x < growth_y? 1: 0;
+}
+
+/** Find the function definitions at the top level:
+ * a block that follows a closing parenthesis. */
+static bool
+find_expansion_functions(Marker_array_p markers, ExpansionLine_array_p lines,
+                         mut_ExpansionFunction_array_p functions)
+{
+  size_t depth = 0;
+  Marker_mut_p previous = NULL; // Previous token, skipping space/comments.
+  Marker_mut_p function_start = NULL;
+  mut_ExpansionFunction function = {0};
+  Marker_p end = markers->start + markers->len;
+  for (Marker_mut_p m = markers->start; m is_not end; ++m) {
+    if (m->token_type is T_SPACE or m->token_type is T_COMMENT) continue;
+    if (m->token_type is T_BLOCK_START) {
+      if (depth is 0 and previous and previous->token_type is T_TUPLE_END) {
+        // Go back to the opening parenthesis, then to the name before it.
+        size_t nesting = 0;
+        Marker_mut_p p = previous;
+        while (p is_not markers->start) {
+          if      (p->token_type is T_TUPLE_END)   ++nesting;
+          else if (p->token_type is T_TUPLE_START) --nesting;
+          if (nesting is 0) break;
+          --p;
+        }
+        function_start = m;
+        function.name_len = 0;
+        while (p is_not markers->start) {
+          --p;
+          if (p->token_type is T_SPACE or p->token_type is T_COMMENT) continue;
+          if (p->token_type is T_IDENTIFIER) {
+            function_start      = p;
+            function.name_start = p->start;
+            function.name_len   = p->len;
+          }
+          break;
+        }
+      }
+      ++depth;
+    } else if (m->token_type is T_BLOCK_END and depth) {
+      --depth;
+      if (depth is 0 and function_start) {
+        function.first_line = expansion_line_index(lines,
+                                                   function_start->start);
+        function.last_line  = expansion_line_index(lines, m->start);
+        if (not push_ExpansionFunction_array(functions, function)) {
+          return false;
+        }
+        function_start = NULL;
+      }
+    }
+    previous = m;
+  }
+  return true;
+}
+
+/** Apply the macros like `main()` does, and report on `stderr`
+ * for each macro the time it took, markers added and removed,
+ * and bytes of synthetic text appended to `src`,
+ * then the functions and lines whose output grew the most. */
+static void
+report_expansion(mut_Marker_array_p markers, mut_Byte_array_p src,
+                 Options_p options, const char* src_file_name)
+{
+  const size_t top = 10; // How many functions and lines to list.
+  const size_t src_len = src->len;
+  bool ok = false;
+  mut_ExpansionLine_array lines = init_ExpansionLine_array(1024);
+  mut_ExpansionFunction_array functions = init_ExpansionFunction_array(64);
+  mut_Marker_array before = init_Marker_array(markers->len);
+  mut_Marker_array after  = init_Marker_array(markers->len);
+
+  // Line starts, then the bytes per line before the macros.
+  ExpansionLine first_line = { .start = 0 };
+  if (not push_ExpansionLine_array(&lines, first_line)) goto exit;
+  for (size_t i = 0; i < src_len; ++i) {
+    if (src->start[i] is '\n' and i + 1 < src_len) {
+      ExpansionLine line = { .start = i + 1 };
+      if (not push_ExpansionLine_array(&lines, line)) goto exit;
+    }
+  }
+  Marker_array_slice all = bounds_of_Marker_array(markers);
+  for (Marker_mut_p m = all.start_p; m is_not all.end_p; ++m) {
+    if (m->start >= src_len) continue;
+    lines.start[expansion_line_index(&lines, m->start)].before += m->len;
+  }
+  if (not find_expansion_functions(markers, &lines, &functions)) goto exit;
+  if (not splice_Marker_array(&before, 0, 0, NULL, all)) goto exit;
+  qsort(before.start, before.len, sizeof(before.start[0]),
+        compare_markers_by_position);
+  ok = true;
+
+  eprintln(LANG("Expansión de %s:", "Expansion of %s:"), src_file_name);
+  eprintln("%-12s %10s %10s %10s %10s",
+           "macro", "ms",
+           LANG("+marcas", "+markers"), LANG("-marcas", "-markers"),
+           LANG("+octetos", "+bytes"));
+  for (Macro_p macro = macros; macro->name and macro->function; ++macro) {
+    size_t src_len_before = src->len;
+    clock_t start = clock();
+    macro->function(markers, src, options, NULL);
+    clock_t end = clock();
+    size_t added = 0, removed = 0;
+    after.len = 0;
+    if (splice_Marker_array(&after, 0, 0, NULL,
+                            bounds_of_Marker_array(markers))) {
+      qsort(after.start, after.len, sizeof(after.start[0]),
+            compare_markers_by_position);
+      count_marker_changes(&before, &after, &added, &removed);
+    }
+    eprintln("%-12s %10.3f %10zu %10zu %10zu",
+             macro->name, (double)(end - start) * 1e3 / CLOCKS_PER_SEC,
+             added, removed, src->len - src_len_before);
+    mut_Marker_array swap = before;
+    before = after;
+    after  = swap;
+  }
+
+  // Attribute synthetic text to the line of the previous original token.
+  size_t line = 0;
+  Marker_array_slice result = bounds_of_Marker_array(markers);
+  for (Marker_mut_p m = result.start_p; m is_not result.end_p; ++m) {
+    if (not m->synthetic and m->start < src_len) {
+      line = expansion_line_index(&lines, m->start);
+    }
+    lines.start[line].after += m->len;
+  }
+  size_t before_total = 0, after_total = 0;
+  for (size_t i = 0; i < lines.len; ++i) {
+    before_total += lines.start[i].before;
+    after_total  += lines.start[i].after;
+  }
+  eprintln(LANG("Total: %zu → %zu octetos.", "Total: %zu → %zu bytes."),
+           before_total, after_total);
+
+  for (size_t i = 0; i < functions.len; ++i) {
+    mut_ExpansionFunction_p f = &functions.start[i];
+    for (size_t j = f->first_line; j <= f->last_line; ++j) {
+      f->before += lines.start[j].before;
+      f->after  += lines.start[j].after;
+    }
+  }
+  qsort(functions.start, functions.len, sizeof(functions.start[0]),
+        compare_expansion_functions_by_growth);
+  if (functions.len) {
+    eprintln(LANG("Funciones que más crecen:",
+                  "Functions that grow the most:"));
+  }
+  for (size_t i = 0; i < functions.len and i < top; ++i) {
+    ExpansionFunction_p f = &functions.start[i];
+    if (f->after <= f->before) break;
+    eprintln("  %s:%zu: %.*s %zu → %zu (+%zu)",
+             src_file_name, f->first_line + 1,
+             f->name_len? (int)f->name_len: 1,
+             f->name_len? (const char*)src->start + f->name_start: "?",
+             f->before, f->after, f->after - f->before);
+  }
+
+  for (size_t i = 0; i < lines.len; ++i) {
+    // Keep the line number in .start, it is no longer needed as position.
+    lines.start[i].start = i + 1;
+  }
+  qsort(lines.start, lines.len, sizeof(lines.start[0]),
+        compare_expansion_lines_by_growth);
+  eprintln(LANG("Líneas que más crecen:", "Lines that grow the most:"));
+  for (size_t i = 0; i < lines.len and i < top; ++i) {
+    ExpansionLine_p l = &lines.start[i];
+    if (l->after <= l->before) break;
+    eprintln("  %s:%zu: %zu → %zu (+%zu)",
+             src_file_name, l->start, l->before, l->after,
+             l->after - l->before);
+  }
+
+exit:
+  if (not ok) {
+    eprintln(LANG("Error: falta memoria para el informe de expansión.",
+                  "Error: out of memory for the expansion report."));
+    for (Macro_p macro = macros; macro->name and macro->function; ++macro) {
+      macro->function(markers, src, options, NULL);
+    }
+  }
+  destruct_Marker_array(&after);
+  destruct_Marker_array(&before);
+  destruct_ExpansionFunction_array(&functions);
+  destruct_ExpansionLine_array(&lines);
+}
+
+
 static Options DEFAULT_OPTIONS = {
   .apply_macros              = true,
   .escape_ucn                = false,
   .discard_comments          = false,
   .discard_space             = false,
   .insert_line_directives    = false,
+  .line_offset               = 0,
   .enable_embed_directive    = false,
   .embed_as_string           = 0,
   .use_defer_instead_of_auto = false,
-  .c_standard                = C99
+  .c_standard                = C99,
+  .symbols                   = NULL
 };
 
 #ifndef USE_CEDRO_AS_LIBRARY
 
+/** Read into `buffer` at most `size` bytes from `input`, without waiting
+ * for more than are already available when it is a pipe or a terminal,
+ * so that `process_stream()` can write out each piece as soon as it has
+ * all of it.
+ *  Returns the number of bytes read, 0 at the end of the input
+ * or if there was an error, in which case `*err` gets its code. */
+static size_t
+read_available(FILE* input, mut_Byte_p buffer, size_t size, int* err)
+{
+#ifdef CEDRO_MMAP
+  ssize_t count;
+  do {
+    count = read(fileno(input), buffer, size);
+  } while (count is -1 and errno is EINTR);
+  if (count is -1) {
+    *err = errno;
+    return 0;
+  }
+  return (size_t)count;
+#else
+  size_t count = fread(buffer, 1, size, input);
+  if (count is 0 and ferror(input)) *err = errno;
+  return count;
+#endif
+}
+
+/** Process the input in pieces that end at top-level declarations,
+ * writing out the result of each one as soon as it is complete,
+ * so that only the current piece needs to be kept in memory.
+ *  While it runs, `options->line_offset` tracks the number of lines
+ * before the current piece, for the line numbers in the output.
+ * Returns error code, 0 if it succeeds. */
+static int
+process_stream(FILE* input, const char* src_file_name,
+               mut_Marker_array_p markers, mut_Byte_array_p src,
+               mut_Options_p options, bool opt_print_markers,
+               Arena* arena, FILE* out)
+{
+  int err = 0;
+  mut_StreamScanner scanner = { .line_start = true };
+  bool pragma_found = false;
+  bool skip_space   = false;
+  mut_Byte chunk[4096];
+  size_t chunk_len = 0, chunk_pos = 0;
+  bool at_end = false;
+  options->line_offset = 0;
+
+  for (;;) {
+    if (chunk_pos is chunk_len and not at_end) {
+      chunk_len = read_available(input, chunk, sizeof(chunk), &err);
+      chunk_pos = 0;
+      if (err) {
+        print_file_error(err, src_file_name, src->len);
+        err = 11;
+        break;
+      }
+      at_end = chunk_len is 0;
+    }
+    if (not at_end) {
+      // Take the bytes until the end of the piece, or all if not there.
+      size_t piece_start = chunk_pos;
+      bool piece_end = false;
+      while (chunk_pos is_not chunk_len and not piece_end) {
+        piece_end = scan_stream_byte(&scanner, chunk[chunk_pos++]);
+      }
+      Byte_array_slice bytes = { chunk + piece_start, chunk + chunk_pos };
+      if (not append_Byte_array(src, bytes)) {
+        print_file_error(ENOMEM, src_file_name, src->len);
+        err = 11;
+        break;
+      }
+      if (not piece_end) continue;
+    } else if (src->len is 0) {
+      break;
+    }
+
+    memset(src->start + src->len, 0,
+           (src->capacity - src->len) * sizeof(src->start[0]));
+    markers->len = 0;
+
+    Byte_array_mut_slice region = bounds_of_Byte_array(src);
+    if (not pragma_found) {
+      region.start_p = parse_skip_until_cedro_pragma(src, region, markers,
+                                                     options);
+      pragma_found = not is_without_cedro_pragma(markers, src);
+      skip_space = pragma_found and region.start_p is region.end_p;
+    } else if (skip_space) {
+      // Same as parse_skip_until_cedro_pragma() when the pragma line
+      // was at the end of the previous piece.
+      while (region.start_p is_not region.end_p and
+             ('\n' is *region.start_p or ' ' is *region.start_p)) {
+        ++region.start_p;
+      }
+      skip_space = false;
+    }
+    Byte_p parse_end = parse(src, region, markers,
+                             options->use_defer_instead_of_auto,
+                             options->symbols);
+    if (parse_end is_not region.end_p) {
+      eprintln("#line %zu \"%s\"\n#error %s\n",
+               line_in_file((size_t)(parse_end - src->start), src, *options),
+               src_file_name,
+               error_buffer);
+      error_buffer[0] = 0;
+      err = 1;
+      break;
+    }
+
+    if (options->enable_embed_directive and options->embed_as_string) {
+      err = prepare_binary_embedding(markers, src, src_file_name);
+      if (err) {
+        eprintln("#line %zu \"%s\"\n#error %s\n",
+                 line_in_file((size_t)(parse_end - src->start), src,
+                              *options),
+                 src_file_name,
+                 error_buffer);
+        break;
+      }
+    }
+
+    size_t original_src_len = src->len;
+
+    if (options->apply_macros and pragma_found) {
+      apply_macros(markers, src, options, arena);
+    }
+
+    if (markers->len is 0) {
+      // Nothing to write, for instance only the pragma.
+    } else if (opt_print_markers) {
+      print_markers(markers, src, "", 0, markers->len);
+    } else {
+      // unparse() inserts the directive itself if the first marker
+      // does not start at 0, for instance right after the pragma.
+      if (options->insert_line_directives and options->line_offset and
+          markers->start[0].start is 0) {
+        fprintf(out, "#line %zu \"%s\"\n",
+                options->line_offset + 1, src_file_name);
+      }
+      unparse(bounds_of_Marker_array(markers),
+              src, original_src_len,
+              src_file_name,
+              *options, out);
+    }
+    fflush(out);
+
+    if (at_end) break;
+    // The piece ends with '\n', so its line number is the line count.
+    options->line_offset = line_in_file(original_src_len - 1, src, *options);
+    src->len = 0;
+  }
+
+  options->line_offset = 0;
+  return err;
+}
+
 static const char* const
 usage_es =
     "Uso: cedro [opciones] <fichero.c>…\n"
@@ -4312,7 +6267,17 @@ usage_es =
     "    --insert-line-directives\n"
     "  Sólo se modifica el código tras la línea `#pragma Cedro 1.0`,\n"
     " que puede incluir ciertas opciones: `#pragma Cedro 1.0 defer,#embed`\n"
+    "  Con `goto-ladder`, `auto` sale de la función por una escalera de\n"
+    " etiquetas en vez de copiar las acciones diferidas en cada `return`.\n"
+    " Así el valor devuelto se evalúa antes de las acciones, no después,\n"
+    " y las funciones que puedan declarar matrices de longitud variable\n"
+    " siguen con las copias, porque `goto` no puede saltar sus declaraciones.\n"
     "\n"
+    ;
+/** Second part of `usage_es`, because ISO C99 compilers are only required
+ * to support string literals of up to 4095 bytes. */
+static const char* const
+usage_options_es =
     "  --apply-macros     Aplica las macros: pespunte, diferido, etc. (implícito)\n"
     "  --no-apply-macros  No aplica las macros.\n"
     "  --escape-ucn       Encapsula los caracteres no-ASCII en identificadores.\n"
@@ -4342,7 +6307,31 @@ usage_es =
     "\n"
     "  --print-markers    Imprime los marcadores.\n"
     "  --no-print-markers No imprime los marcadores. (implícito)\n"
-    "  --benchmark        Realiza una medición de rendimiento.\n"
+    "  --benchmark        Mide el tiempo de cada fase del proceso.\n"
+    "  --benchmark-runs=<n>   Repeticiones medidas. Valor implícito: 20\n"
+    "  --benchmark-warmup=<n> Repeticiones previas sin medir."
+    " Valor implícito: 2\n"
+    "  --benchmark-json   Como --benchmark, con el resultado en JSON.\n"
+    "  --report-expansion Informa del crecimiento producido por cada macro,\n"
+    "                     y de las funciones y líneas que más crecen.\n"
+    "  --stats            Imprime estadísticas de uso de memoria de las\n"
+    "                     tablas (arrays) al terminar."
+    " Requiere -DCEDRO_STATS.\n"
+    "  --intern-identifiers    Asigna a cada identificador un número al leerlo,\n"
+    "                          para compararlos más rápido.\n"
+    "  --no-intern-identifiers No asigna números a los identificadores."
+    " (implícito)\n"
+    "  --jobs=<n>         Aplica las macros en <n> hilos, cada uno a una parte\n"
+    "                     del fichero que termina en una función."
+    " Valor implícito: 1\n"
+    "                     Requiere -DCEDRO_THREADS.\n"
+    "  --stream           Procesa stdin (-) por partes, cada una al terminar\n"
+    "                     una declaración al nivel superior.\n"
+    "  --no-stream        Lee stdin completo antes de procesarlo. (implícito)\n"
+    "  --emit-tokens      Escribe los marcadores y el código fuente en un\n"
+    "                     formato binario, en vez de aplicar las macros.\n"
+    "  --load-tokens      Lee los ficheros escritos con --emit-tokens\n"
+    "                     en vez de código fuente, sin volver a analizarlos.\n"
     "  --validate=ref.c   Compara el resultado con el fichero «ref.c» dado.\n"
     "      No aplica las macros: para comparar el resultado de aplicar Cedro\n"
     "      a un fichero, pase la salida a través de esta opción, por ejemplo:\n"
@@ -4364,7 +6353,17 @@ usage_en =
     "    --insert-line-directives\n"
     "  Code gets modified only after the line `#pragma Cedro 1.0`,\n"
     " which can include certain options: `#pragma Cedro 1.0 defer,#embed`\n"
+    "  With `goto-ladder`, `auto` exits the function through a ladder of\n"
+    " labels instead of copying the deferred actions at each `return`.\n"
+    " Then the returned value gets evaluated before the actions, not after,\n"
+    " and functions that might declare variable length arrays keep\n"
+    " the copies, because `goto` can not jump over their declarations.\n"
     "\n"
+    ;
+/** Second part of `usage_en`, because ISO C99 compilers are only required
+ * to support string literals of up to 4095 bytes. */
+static const char* const
+usage_options_en =
     "  --apply-macros     Applies the macros: backstitch, defer, etc. (default)\n"
     "  --no-apply-macros  Does not apply the macros.\n"
     "  --escape-ucn       Escape non-ASCII in identifiers as UCN.\n"
@@ -4395,7 +6394,28 @@ usage_en =
     "\n"
     "  --print-markers    Prints the markers.\n"
     "  --no-print-markers Does not print the markers. (default)\n"
-    "  --benchmark        Run a performance benchmark.\n"
+    "  --benchmark        Measure the time taken by each processing phase.\n"
+    "  --benchmark-runs=<n>   Measured runs. Default value: 20\n"
+    "  --benchmark-warmup=<n> Previous runs, not measured. Default value: 2\n"
+    "  --benchmark-json   Like --benchmark, with the result as JSON.\n"
+    "  --report-expansion Report the growth produced by each macro,\n"
+    "                     and the functions and lines that grow the most.\n"
+    "  --stats            Print memory usage statistics for the arrays\n"
+    "                     when finished. Requires -DCEDRO_STATS.\n"
+    "  --intern-identifiers    Assign a number to each identifier when reading it,\n"
+    "                          to compare them faster.\n"
+    "  --no-intern-identifiers Do not assign numbers to identifiers. (default)\n"
+    "  --jobs=<n>         Apply the macros in <n> threads, each one to a part\n"
+    "                     of the file that ends at a function."
+    " Default value: 1\n"
+    "                     Requires -DCEDRO_THREADS.\n"
+    "  --stream           Process stdin (-) in pieces, each one as soon as\n"
+    "                     a top-level declaration is complete.\n"
+    "  --no-stream        Read all of stdin before processing it. (default)\n"
+    "  --emit-tokens      Write the markers and the source code in a binary\n"
+    "                     format, instead of applying the macros.\n"
+    "  --load-tokens      Read files written with --emit-tokens instead of\n"
+    "                     source code, without parsing them again.\n"
     "  --validate=ref.c   Compares the input to the given “ref.c” file.\n"
     "      Does not apply any macros: to compare the result of running Cedro\n"
     "      on a file, pipe its output through this option, for instance:\n"
@@ -4405,6 +6425,30 @@ usage_en =
     " `#pragma Cedro " CEDRO_VERSION "`"
     ;
 
+#ifdef CEDRO_STATS
+#ifdef CEDRO_MMAP
+#include <sys/resource.h>
+#endif
+/** Print the peak resident set size of the process, where available. */
+static void
+print_peak_memory(FILE* out)
+{
+#ifdef CEDRO_MMAP
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) is 0) {
+#ifdef __APPLE__
+    long kilobytes = usage.ru_maxrss / 1024; // macOS gives it in bytes.
+#else
+    long kilobytes = usage.ru_maxrss;
+#endif
+    fprintf(out, "peak RSS: %ld KiB\n", kilobytes);
+  }
+#else
+  (void) out;
+#endif
+}
+#endif
+
 int main(int argc, char** argv)
 {
   mut_Options options = DEFAULT_OPTIONS;
@@ -4430,6 +6474,16 @@ int main(int argc, char** argv)
 
   bool opt_print_markers    = false;
   bool opt_run_benchmark    = false;
+  mut_BenchmarkOptions benchmark_options = {
+    .runs = 20, .warmup_runs = 2, .json = false
+  };
+  bool opt_stream           = false;
+  bool opt_report_expansion = false;
+  bool opt_stats            = false;
+  bool opt_intern_identifiers = false;
+  bool opt_emit_tokens      = false;
+  bool opt_load_tokens      = false;
+  size_t opt_jobs           = 1;
   const char* opt_validate  = NULL;
 
   FILE* out = stdout;
@@ -4501,14 +6555,81 @@ int main(int argc, char** argv)
         opt_print_markers = flag_value;
       } else if (str_eq("--benchmark", arg)) {
         opt_run_benchmark = true;
+      } else if (str_eq("--benchmark-json", arg)) {
+        opt_run_benchmark = true;
+        benchmark_options.json = true;
+      } else if (strn_eq("--benchmark-runs=", arg,
+                         strlen("--benchmark-runs=")) or
+                 strn_eq("--benchmark-warmup=", arg,
+                         strlen("--benchmark-warmup="))) {
+        char* end = strchr(arg, '=') + 1;
+        errno = 0;
+        long value = strtol(end, &end, 10);
+        if (errno or end is_not arg + strlen(arg) or value < 0 or
+            (value is 0 and arg[strlen("--benchmark-")] is 'r')) {
+          fprintf(out, "#error Value must be a positive integer: %s\n", arg);
+          err = 12;
+          return err;
+        } else if (arg[strlen("--benchmark-")] is 'r') {
+          benchmark_options.runs = (size_t)value;
+        } else {
+          benchmark_options.warmup_runs = (size_t)value;
+        }
+        opt_run_benchmark = true;
+      } else if (str_eq("--report-expansion", arg) or
+                 str_eq("--no-report-expansion", arg)) {
+        opt_report_expansion = flag_value;
+      } else if (str_eq("--stats", arg) or
+                 str_eq("--no-stats", arg)) {
+        opt_stats = flag_value;
+#ifndef CEDRO_STATS
+        if (opt_stats) {
+          eprintln(LANG("Aviso: compilado sin CEDRO_STATS,"
+                        " no hay estadísticas.",
+                        "Warning: compiled without CEDRO_STATS,"
+                        " there are no statistics."));
+        }
+#endif
+      } else if (str_eq("--intern-identifiers", arg) or
+                 str_eq("--no-intern-identifiers", arg)) {
+        opt_intern_identifiers = flag_value;
+      } else if (str_eq("--emit-tokens", arg) or
+                 str_eq("--no-emit-tokens", arg)) {
+        opt_emit_tokens = flag_value;
+      } else if (str_eq("--load-tokens", arg) or
+                 str_eq("--no-load-tokens", arg)) {
+        opt_load_tokens = flag_value;
+      } else if (strn_eq("--jobs=", arg, strlen("--jobs="))) {
+        char* end = arg + strlen("--jobs=");
+        errno = 0;
+        long value = strtol(end, &end, 10);
+        if (errno or end is_not arg + strlen(arg) or value <= 0) {
+          fprintf(out, "#error Value must be a positive integer: %s\n", arg);
+          err = 12;
+          return err;
+        }
+        opt_jobs = (size_t)value;
+#ifndef CEDRO_THREADS
+        if (opt_jobs > 1) {
+          eprintln(LANG("Aviso: compilado sin CEDRO_THREADS,"
+                        " se usa un solo hilo.",
+                        "Warning: compiled without CEDRO_THREADS,"
+                        " using a single thread."));
+        }
+#endif
+      } else if (str_eq("--stream", arg) or
+                 str_eq("--no-stream", arg)) {
+        opt_stream = flag_value;
       } else if (strn_eq("--validate=", arg, strlen("--validate="))) {
         opt_validate = arg + strlen("--validate=");
       } else if (str_eq("--version", arg)) {
         fputs(CEDRO_VERSION, stderr);
       } else if (str_eq("-h", arg) or str_eq("--help", arg)) {
         fputs(LANG(usage_es, usage_en), stderr);
+        fputs(LANG(usage_options_es, usage_options_en), stderr);
       } else {
         fputs(LANG(usage_es, usage_en), stderr);
+        fputs(LANG(usage_options_es, usage_options_en), stderr);
         eprintln(LANG("Error: opción desconocida: %s",
                       "Error: unknown option: %s"),
                  arg);
@@ -4519,12 +6640,22 @@ int main(int argc, char** argv)
   }
 
   if (opt_run_benchmark) {
-    options.apply_macros = false;
     opt_print_markers    = false;
   }
 
-  mut_Marker_array markers = init_Marker_array(8192);
-  mut_Byte_array src = init_Byte_array(16384);
+  // Reserved for each file according to its size.
+  mut_Marker_array markers = init_Marker_array(1024);
+  mut_Byte_array src = init_Byte_array(4096);
+  mut_FileMapping mapping = {0};
+  mut_TokenStream token_stream = {0};
+  // For the temporary arrays of the macros, reset after each file.
+  Arena arena = {0};
+  // Shared by all files, so each identifier keeps the same ID.
+  mut_SymbolTable symbols = {0};
+  if (opt_intern_identifiers) {
+    symbols = init_SymbolTable();
+    options.symbols = &symbols;
+  }
 
   for (int i = 1; not err and i < argc; ++i) {
     char* src_file_name = argv[i];
@@ -4539,13 +6670,36 @@ int main(int argc, char** argv)
     }
 
     // Re-use arrays:
+    unload_token_stream(&token_stream, &markers, &src);
+    unmap_or_keep_file(&src, &mapping);
     markers.len = 0;
     src.len = 0;
+    reset_Arena(&arena);
+
+    if (opt_stream and src_file_name[0] is '\0' and
+        not opt_run_benchmark and not opt_validate and
+        not opt_report_expansion) {
+      err = process_stream(stdin, src_file_name, &markers, &src,
+                           &options, opt_print_markers, &arena, out);
+      continue;
+    }
 
-    int err = src_file_name[0]?
-        read_file(&src, src_file_name):
+    int err =
+        opt_load_tokens?
+        load_token_stream(&token_stream, src_file_name, NULL,
+                          &markers, &src, &options):
+        src_file_name[0]?
+        map_or_read_file(&src, &mapping, src_file_name):
         read_stream(&src, stdin);
-    if (err) {
+    if (err is EINVAL and opt_load_tokens) {
+      eprintln(LANG("Error: «%s» no es un fichero de --emit-tokens válido"
+                    " para esta versión.",
+                    "Error: “%s” is not a valid --emit-tokens file"
+                    " for this version."),
+               src_file_name);
+      err = 11;
+      break;
+    } else if (err) {
       print_file_error(err, src_file_name, src.len);
       if (src_file_name[0] is '\0') {
         fprintf(out, "#error The file name is the empty string.\n");
@@ -4554,19 +6708,49 @@ int main(int argc, char** argv)
       break;
     }
 
-    Byte_array_mut_slice region = bounds_of_Byte_array(&src);
-    region.start_p = parse_skip_until_cedro_pragma(&src, region, &markers,
-                                                   &options);
-    Byte_p parse_end = parse(&src, region, &markers,
-                             options.use_defer_instead_of_auto);
-    if (parse_end is_not region.end_p) {
-      err = 1;
-      eprintln("#line %zu \"%s\"\n#error %s\n",
-               original_line_number((size_t)(parse_end - src.start), &src),
-               src_file_name,
-               error_buffer);
-      error_buffer[0] = 0;
-      break;
+    if (opt_run_benchmark) {
+      err = benchmark(&src, src_file_name, options, benchmark_options, out);
+      if (err) break;
+      continue;
+    }
+
+    Byte_mut_p parse_end = end_of_Byte_array(&src);
+    if (not opt_load_tokens) {
+      Options options_before_pragma = options;
+      Byte_array_mut_slice region = bounds_of_Byte_array(&src);
+      region.start_p = parse_skip_until_cedro_pragma(&src, region, &markers,
+                                                     &options);
+      // Reserve the markers at once, after giving back any excess
+      // left by a much bigger file before this one.
+      size_t marker_count = markers.len +
+          estimate_marker_count((size_t)(region.end_p - region.start_p));
+      shrink_Marker_array(&markers, marker_count);
+      ensure_capacity_Marker_array(&markers, marker_count);
+      parse_end = parse(&src, region, &markers,
+                        options.use_defer_instead_of_auto,
+                        options.symbols);
+      if (parse_end is_not region.end_p) {
+        err = 1;
+        eprintln("#line %zu \"%s\"\n#error %s\n",
+                 original_line_number((size_t)(parse_end - src.start), &src),
+                 src_file_name,
+                 error_buffer);
+        error_buffer[0] = 0;
+        break;
+      }
+
+      if (opt_emit_tokens) {
+        err = write_token_stream(
+            out, &markers, &src,
+            token_stream_options(options_before_pragma, options));
+        if (err) {
+          eprintln(LANG("Error al escribir los marcadores: %s",
+                        "Error when writing the markers: %s"),
+                   strerror(err));
+          break;
+        }
+        continue;
+      }
     }
 
     if (options.enable_embed_directive and options.embed_as_string) {
@@ -4582,11 +6766,7 @@ int main(int argc, char** argv)
 
     size_t original_src_len = src.len;
 
-    if (opt_run_benchmark) {
-      double t = benchmark(&src, src_file_name, options);
-      if (t < 1.0) eprintln("%.fms for %s", t * 1000.0, src_file_name);
-      else         eprintln("%.1fs for %s", t         , src_file_name);
-    } else if (opt_validate) {
+    if (opt_validate) {
       mut_Byte_array src_ref = {0};
       err = read_file(&src_ref, opt_validate);
       if (err) {
@@ -4598,12 +6778,21 @@ int main(int argc, char** argv)
       }
       destruct_Byte_array(&src_ref);
     } else {
-      if (options.apply_macros) {
-        Macro_p macro = macros;
-        while (macro->name and macro->function) {
-          macro->function(&markers, &src);
-          ++macro;
-        }
+      // Without the pragma the macros have nothing to do, and skipping them
+      // avoids copying a mapped file when they append synthetic text.
+      if (not options.apply_macros or
+          is_without_cedro_pragma(&markers, &src)) {
+        // Nothing to do.
+      } else if (opt_report_expansion) {
+        report_expansion(&markers, &src, &options, src_file_name);
+#ifdef CEDRO_THREADS
+      } else if (opt_jobs > 1 and
+                 apply_macros_in_parallel(&markers, &src, &options,
+                                          opt_jobs)) {
+        // Done.
+#endif
+      } else {
+        apply_macros(&markers, &src, &options, &arena);
       }
 
       if (opt_print_markers) {
@@ -4620,8 +6809,19 @@ int main(int argc, char** argv)
   }
 
   fflush(out);
+  unload_token_stream(&token_stream, &markers, &src);
+  unmap_or_keep_file(&src, &mapping);
   destruct_Byte_array(&src);
   destruct_Marker_array(&markers);
+  destruct_SymbolTable(&symbols);
+  destruct_Arena(&arena);
+
+#ifdef CEDRO_STATS
+  if (opt_stats) {
+    print_array_stats(stderr);
+    print_peak_memory(stderr);
+  }
+#endif
 
   return err;
 }
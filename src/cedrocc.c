@@ -24,8 +24,12 @@
 
 #pragma Cedro 1.0
 
-/* _POSIX_C_SOURCE is needed for popen()/pclose(). */
-#define _POSIX_C_SOURCE 200112L
+/* _POSIX_C_SOURCE is needed for popen()/pclose() and open_memstream(). */
+#define _POSIX_C_SOURCE 200809L
+/* In Linux, _GNU_SOURCE is needed for memfd_create() and F_SETPIPE_SZ. */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
 /* In Solaris 8, we need __EXTENSIONS__ for popen()/pclose() and vsnprintf(). */
 #define __EXTENSIONS__
 
@@ -34,6 +38,11 @@
 
 #include <unistd.h>
 #include <sys/wait.h> // For WEXITSTATUS etc.
+#include <sys/stat.h> // For mkdir(), stat().
+#include <dirent.h>   // For opendir(), readdir().
+#include <fcntl.h>    // For open(), fcntl().
+#include <utime.h>    // For utime().
+#include <sys/mman.h> // For mmap().
 
 typedef size_t mut_size_t, * mut_size_t_mut_p, * const mut_size_t_p;
 typedef const size_t * size_t_mut_p, * const size_t_p;
@@ -154,7 +163,144 @@ get_SourceFile_for_path(mut_SourceFile_array_p _, Byte_array path)
 
   return NULL;
 }
-/** Find a file in the given paths.
+typedef struct StringMapEntry {
+  size_t offset; ///< Start of the key in `StringMap.text`.
+  size_t len;    ///< Length of the key.
+  size_t value;
+} MUT_CONST_TYPE_VARIANTS(StringMapEntry);
+DEFINE_ARRAY_OF(StringMapEntry, 0, {});
+/** Hash table from byte strings to `size_t` values, with linear probing.
+ * Entries can not be removed. */
+typedef struct StringMap {
+  mut_Byte_array text;              ///< All the keys, concatenated.
+  mut_StringMapEntry_array entries;
+  mut_size_t_array slots;           ///< `0` if empty, else entry index + 1.
+} MUT_CONST_TYPE_VARIANTS(StringMap);
+static void
+destruct_StringMap(mut_StringMap_p _)
+{
+  destruct_Byte_array(&_->text);
+  destruct_StringMapEntry_array(&_->entries);
+  destruct_size_t_array(&_->slots);
+}
+/** Find the slot for `key`: the one that holds it,
+ * or the empty one where it would go. */
+static size_t
+find_slot_StringMap(StringMap_p _, Byte_array_slice key)
+{
+  size_t len = (size_t)(key.end_p - key.start_p);
+  size_t mask = _->slots.len - 1;
+  size_t i = (size_t)hash_bytes(HASH_SEED, key) & mask;
+  for (;;) {
+    size_t slot = _->slots.start[i];
+    if (slot is 0) return i;
+    StringMapEntry_p entry = get_StringMapEntry_array(&_->entries, slot - 1);
+    if (entry->len is len and
+        mem_eq(_->text.start + entry->offset, key.start_p, len)) {
+      return i;
+    }
+    i = (i + 1) & mask;
+  }
+}
+/** Return the entry for `key`, or `NULL` if not found. */
+static StringMapEntry_mut_p
+get_StringMap(StringMap_p _, Byte_array_slice key)
+{
+  if (_->slots.len is 0) return NULL;
+  size_t slot = _->slots.start[find_slot_StringMap(_, key)];
+  return slot? get_StringMapEntry_array(&_->entries, slot - 1): NULL;
+}
+/** Set the value for `key`, adding it if not already there.
+ * Returns `false` if (re)allocation failed. */
+static bool
+put_StringMap(mut_StringMap_p _, Byte_array_slice key, size_t value)
+{
+  if ((_->entries.len + 1) * 2 > _->slots.len) {
+    // Keep it at most half full, and re-insert all entries.
+    size_t capacity = _->slots.len? 2 * _->slots.len: 64;
+    if (not ensure_capacity_size_t_array(&_->slots, capacity)) return false;
+    _->slots.len = capacity;
+    memset(_->slots.start, 0, capacity * sizeof(_->slots.start[0]));
+    for (size_t i = 0; i is_not _->entries.len; ++i) {
+      StringMapEntry_p entry = get_StringMapEntry_array(&_->entries, i);
+      Byte_p start = _->text.start + entry->offset;
+      _->slots.start[find_slot_StringMap(_, (Byte_array_slice){
+            start, start + entry->len
+          })] = i + 1;
+    }
+  }
+
+  size_t i = find_slot_StringMap(_, key);
+  if (_->slots.start[i]) {
+    get_mut_StringMapEntry_array(&_->entries, _->slots.start[i] - 1)->value =
+        value;
+    return true;
+  }
+  mut_StringMapEntry entry = {
+    .offset = _->text.len,
+    .len    = (size_t)(key.end_p - key.start_p),
+    .value  = value
+  };
+  if (not append_Byte_array(&_->text, key) or
+      not push_StringMapEntry_array(&_->entries, entry)) {
+    return false;
+  }
+  _->slots.start[i] = _->entries.len;
+  return true;
+}
+
+/** Per-process cache of directory listings, so that resolving `#include`
+ * file names takes hash lookups instead of an `access()` call
+ * for each include path every time.
+ *  `listed_directories` has the directory paths as given,
+ * and `directory_entries` has `directory/name` for each entry in them. */
+static mut_StringMap listed_directories = {0};
+static mut_StringMap directory_entries  = {0};
+
+/** Same as `access(path, F_OK) is 0` for the result of joining
+ * a directory and a file name with `/`,
+ * but reading each directory only once per process. */
+static bool
+file_exists(Byte_array_slice path)
+{
+  Byte_mut_p name = path.end_p;
+  while (name is_not path.start_p and *(name - 1) is_not '/') --name;
+  if (name is path.start_p) {
+    mut_Byte_array buffer = {0};
+    auto destruct_Byte_array(&buffer);
+    append_Byte_array(&buffer, path);
+    bool exists = access(as_c_string(&buffer), F_OK) is 0;
+    return exists;
+  }
+  Byte_array_slice directory = { path.start_p, name - 1 };
+
+  if (not get_StringMap(&listed_directories, directory)) {
+    put_StringMap(&listed_directories, directory, 1);
+    mut_Byte_array entry_path = {0};
+    auto destruct_Byte_array(&entry_path);
+    append_Byte_array(&entry_path, directory);
+    DIR* dir = opendir(entry_path.len? as_c_string(&entry_path): "/");
+    if (dir) {
+      push_Byte_array(&entry_path, '/');
+      size_t directory_len = entry_path.len;
+      struct dirent* entry;
+      while ((entry = readdir(dir))) {
+        if (str_eq(entry->d_name, ".") or str_eq(entry->d_name, "..")) {
+          continue;
+        }
+        entry_path.len = directory_len;
+        push_str(&entry_path, entry->d_name);
+        put_StringMap(&directory_entries,
+                      bounds_of_Byte_array(&entry_path), 1);
+      }
+      closedir(dir);
+    }
+  }
+
+  return get_StringMap(&directory_entries, path) is_not NULL;
+}
+
+/** Find a file in the given paths, starting with the last one.
  * `result` is modified only if the file is found.
  */
 static bool
@@ -164,211 +310,1826 @@ find_include_file(IncludePaths_p _, Byte_array_slice path,
   bool found = false;
 
   mut_Byte_array path_buffer = init_Byte_array(256);
+  Byte_mut_p directory_end = end_of_Byte_array(&_->text);
   size_t i = len_IncludePaths(_);
   while (i is_not 0) {
     --i;
+    size_t len = *get_size_t_array(&_->lengths, i);
     path_buffer.len = 0;
-    append_Byte_array(&path_buffer, get_IncludePaths(_, i));
+    append_Byte_array(&path_buffer, (Byte_array_slice){
+        directory_end - len, directory_end
+      });
+    directory_end -= len;
     push_Byte_array(&path_buffer, '/');
     append_Byte_array(&path_buffer, path);
-    if (access(as_c_string(&path_buffer), F_OK) is 0) {
+    if (file_exists(bounds_of_Byte_array(&path_buffer))) {
       result->len = 0;
       append_Byte_array(result, bounds_of_Byte_array(&path_buffer));
       found = true;
       break;
     }
   }
-  destruct_Byte_array(&path_buffer);
-
-  return found;
+  destruct_Byte_array(&path_buffer);
+
+  return found;
+}
+
+/** A Cedro file included from the main file,
+ * being expanded in advance in another process. */
+typedef struct Prefetch {
+  pid_t pid;        ///< 0 if not started yet, -1 when done.
+  int output;       ///< Anonymous file with the expanded code.
+  int dependencies; ///< Anonymous file with the files read, one per line.
+} MUT_CONST_TYPE_VARIANTS(Prefetch);
+DEFINE_ARRAY_OF(Prefetch, 0, {
+    while (cursor is_not end) {
+      if (cursor->pid > 0) waitpid(cursor->pid, NULL, 0);
+      if (cursor->output       is_not -1) close(cursor->output);
+      if (cursor->dependencies is_not -1) close(cursor->dependencies);
+      ++cursor;
+    }
+  });
+typedef struct Prefetcher {
+  /// Path for each entry in `prefetches`, at the same index.
+  mut_IncludePaths paths;
+  mut_Prefetch_array prefetches;
+  size_t running;
+} MUT_CONST_TYPE_VARIANTS(Prefetcher);
+static void
+destruct_Prefetcher(mut_Prefetcher_p _)
+{
+  destruct_Prefetch_array(&_->prefetches);
+  destruct_IncludePaths(&_->paths);
+}
+
+typedef struct IncludeContext {
+  size_t level;
+  mut_IncludePaths paths;
+  mut_IncludePaths paths_quote;
+  /// Every file read while expanding the main file: includes and `#embed`.
+  mut_IncludePaths dependencies;
+  /// Maximum number of included files to expand in advance at the same time,
+  /// 0 to expand each one when reached.
+  size_t prefetch_jobs;
+  /// The files included from the main file being expanded in advance,
+  /// or `NULL`.
+  mut_Prefetcher_mut_p prefetcher;
+  /// Directory where the token streams of the Cedro files get cached,
+  /// or `NULL` to parse them every time.
+  const char* token_cache;
+} mut_IncludeContext, *mut_IncludeContext_p;
+typedef const struct IncludeContext IncludeContext,
+  * const IncludeContext_p, * IncludeContext_mut_p;
+
+static int
+include(const char* file_name, FILE* cc_stdin,
+        mut_IncludeContext_p context,
+        Options options);
+static int
+anonymous_file(void);
+static int
+exit_code(int status);
+
+/** Returns the wall clock time in seconds. */
+static double
+wall_time(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
+
+/** File for the trace events given with `--cedro:trace=file.json`,
+ * or `-1` if not tracing.
+ *  The events use the Trace Event Format of `chrome://tracing`
+ * and Perfetto, as a JSON array without the closing `]`, which both accept.
+ * That way the processes started with `fork()` can append their events
+ * to the same file, each one with a single `write()`. */
+static int trace_fd = -1;
+
+/** Begin (`phase` = `'B'`) or end (`'E'`) a span named `name`.
+ *  `file` is added as argument if not `NULL`,
+ * and `level` too if not negative.
+ *  Does nothing if not tracing. */
+static void
+trace_event(char phase, const char* name, const char* file, int level)
+{
+  if (trace_fd is -1) return;
+
+  mut_Byte_array event = {0};
+  auto destruct_Byte_array(&event);
+  push_fmt(&event,
+           "{\"name\":\"%s\",\"cat\":\"cedrocc\",\"ph\":\"%c\","
+           "\"ts\":%.3f,\"pid\":%ld,\"tid\":%ld",
+           name, phase, wall_time() * 1e6, (long)getpid(), (long)getpid());
+  if (file or level >= 0) {
+    push_str(&event, ",\"args\":{");
+    if (file) {
+      push_str(&event, "\"file\":\"");
+      for (const char* c = file; *c; ++c) {
+        if      (*c is '"' or *c is '\\') push_fmt(&event, "\\%c", *c);
+        else if ((unsigned char)*c < 0x20) push_fmt(&event, "\\u%04X", *c);
+        else                              push_Byte_array(&event, (Byte)*c);
+      }
+      push_str(&event, level >= 0? "\",": "\"");
+    }
+    if (level >= 0) push_fmt(&event, "\"level\":%d", level);
+    push_str(&event, "}");
+  }
+  push_str(&event, "},\n");
+
+  if (write(trace_fd, event.start, event.len) is_not (ssize_t)event.len) {
+    perror("--cedro:trace");
+    close(trace_fd);
+    trace_fd = -1;
+  }
+}
+
+static void
+dependency_callback(const char* path, void* context)
+{
+  mut_IncludeContext_p _ = context;
+  append_path(&_->dependencies, path, strlen(path));
+}
+
+/** Extract the file name from the `#include` line in `m`,
+ * which is empty if there is none.
+ *  `quoted` is set if the name is between quotes instead of `<>`. */
+static Byte_array_slice
+include_file_name(Marker_p m, Byte_array_p src, bool* quoted)
+{
+  Byte_array_mut_slice content = slice_for_marker(src, m);
+  Byte_mut_p text = content.start_p;
+  *quoted = false;
+  const size_t len = 10; // = strlen("#include <");
+  if        (m->len >= len and strn_eq("#include <",  (char*)text, len)) {
+    content.start_p += len;
+    // TODO: check whether the C standard allows escaped '>' here.
+    content.end_p = memchr(text + len, '>', m->len - len);
+  } else if (m->len >= len and strn_eq("#include \"", (char*)text, len)) {
+    *quoted = true;
+    content.start_p += len;
+    // TODO: check whether the C standard allows escaped '"' here.
+    content.end_p = memchr(text + len, '"', m->len - len);
+  }
+  if (not (content.end_p > content.start_p)) content.end_p = content.start_p;
+
+  return content;
+}
+
+/** Index of `path` in `paths`, or `len_IncludePaths(paths)` if not there. */
+static size_t
+index_of_path(IncludePaths_p paths, Byte_array_slice path)
+{
+  size_t path_len = (size_t)(path.end_p - path.start_p);
+  size_t index = 0;
+  Byte_mut_p start = start_of_Byte_array(&paths->text);
+  while (index is_not paths->lengths.len) {
+    size_t len = *get_size_t_array(&paths->lengths, index);
+    if (len is path_len and mem_eq(start, path.start_p, len)) break;
+    start += len;
+    ++index;
+  }
+  return index;
+}
+
+/** Exit code for a prefetch process when `include()` returns `-1`. */
+#define PREFETCH_NOT_CEDRO 255
+
+/** Start expanding in another process the file
+ * at `index` in `context->prefetcher`.
+ * If that is not possible, it will be expanded when reached. */
+static void
+start_prefetch(mut_IncludeContext_p context, size_t index,
+               FILE* cc_stdin, Options options)
+{
+  mut_Prefetcher_p prefetcher = context->prefetcher;
+  mut_Prefetch_p prefetch = get_mut_Prefetch_array(&prefetcher->prefetches,
+                                                   index);
+  prefetch->pid = -1;
+  prefetch->output       = anonymous_file();
+  prefetch->dependencies = anonymous_file();
+  if (prefetch->output is -1 or prefetch->dependencies is -1) return;
+
+  fflush(cc_stdin);
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid is 0) {
+    // Same as in `include_callback()` for a file included from the main one.
+    mut_Byte_array path = {0};
+    append_Byte_array(&path, get_IncludePaths(&prefetcher->paths, index));
+    context->prefetcher = NULL;
+    truncate_IncludePaths(&context->dependencies, 0);
+    ++context->level;
+    const char* file_name = as_c_string(&path);
+    const char* file_dir_name_end = strrchr(file_name, '/');
+    if (file_dir_name_end) {
+      append_path(&context->paths_quote, file_name,
+                  (size_t)(file_dir_name_end - file_name));
+    }
+    FILE* output = fdopen(prefetch->output, "w");
+    int return_code = output?
+        include(file_name, output, context, options):
+        errno;
+    if (output and fclose(output) and return_code is EXIT_SUCCESS) {
+      return_code = errno;
+    }
+    FILE* dependencies = fdopen(prefetch->dependencies, "w");
+    if (dependencies) {
+      for (size_t i = 0; i is_not len_IncludePaths(&context->dependencies);
+           ++i) {
+        Byte_array_slice dependency = get_IncludePaths(&context->dependencies,
+                                                       i);
+        fwrite(dependency.start_p, sizeof(dependency.start_p[0]),
+               (size_t)(dependency.end_p - dependency.start_p), dependencies);
+        fputc('\n', dependencies);
+      }
+      if (fclose(dependencies) and return_code is EXIT_SUCCESS) {
+        return_code = errno;
+      }
+    } else if (return_code is EXIT_SUCCESS) {
+      return_code = errno;
+    }
+    // `_exit()` because the buffers inherited from the parent process,
+    // such as the one for `cc_stdin`, must not be written again.
+    fflush(stderr);
+    _exit(return_code is -1? PREFETCH_NOT_CEDRO: return_code);
+  } else if (pid is_not -1) {
+    prefetch->pid = pid;
+    ++prefetcher->running;
+  }
+}
+
+/** Start expanding in advance the pending files,
+ * up to `context->prefetch_jobs` at the same time. */
+static void
+start_pending_prefetches(mut_IncludeContext_p context,
+                         FILE* cc_stdin, Options options)
+{
+  mut_Prefetcher_p prefetcher = context->prefetcher;
+  for (size_t i = 0;
+       i is_not prefetcher->prefetches.len and
+           prefetcher->running < context->prefetch_jobs;
+       ++i) {
+    if (get_Prefetch_array(&prefetcher->prefetches, i)->pid is 0) {
+      start_prefetch(context, i, cc_stdin, options);
+    }
+  }
+}
+
+/** Read the whole content of the file `fd` from its start,
+ * appending it to `_`.
+ * Returns error code, 0 if it succeeds. */
+static int
+read_whole_fd(mut_Byte_array_p _, int fd)
+{
+  if (lseek(fd, 0, SEEK_SET) is -1) return errno;
+  for (;;) {
+    if (not ensure_capacity_Byte_array(_, _->len + 65536)) return ENOMEM;
+    ssize_t count = read(fd, (mut_Byte_p)_->start + _->len, 65536);
+    if (count is 0) break;
+    if (count is -1) {
+      if (errno is EINTR) continue;
+      return errno;
+    }
+    _->len += (size_t)count;
+  }
+  return 0;
+}
+
+/** Wait for the file at `index` in `context->prefetcher` to be expanded,
+ * and write the result to `cc_stdin`.
+ * Returns the same as `include()` would have returned. */
+static int
+finish_prefetch(mut_IncludeContext_p context, size_t index,
+                FILE* cc_stdin, Options options)
+{
+  mut_Prefetcher_p prefetcher = context->prefetcher;
+  mut_Prefetch_p prefetch = get_mut_Prefetch_array(&prefetcher->prefetches,
+                                                   index);
+  int return_code = EXIT_SUCCESS;
+  int status;
+  while (waitpid(prefetch->pid, &status, 0) is -1) {
+    if (errno is_not EINTR) {
+      return_code = errno;
+      perror("waitpid()");
+      break;
+    }
+  }
+  prefetch->pid = -1;
+  --prefetcher->running;
+  if (return_code is EXIT_SUCCESS) {
+    return_code = exit_code(status);
+    if (return_code is PREFETCH_NOT_CEDRO) return_code = -1;
+  }
+
+  mut_Byte_array buffer = {0};
+  int err = read_whole_fd(&buffer, prefetch->dependencies);
+  if (not err) {
+    Byte_mut_p start = start_of_Byte_array(&buffer);
+    Byte_p     end   =   end_of_Byte_array(&buffer);
+    while (start is_not end) {
+      Byte_mut_p line_end = memchr(start, '\n', (size_t)(end - start));
+      if (not line_end) line_end = end;
+      append_path(&context->dependencies, (const char*)start,
+                  (size_t)(line_end - start));
+      start = line_end is end? end: line_end + 1;
+    }
+    buffer.len = 0;
+    err = read_whole_fd(&buffer, prefetch->output);
+  }
+  if (not err) {
+    fwrite(buffer.start, sizeof(buffer.start[0]), buffer.len, cc_stdin);
+  } else if (return_code is EXIT_SUCCESS or return_code is -1) {
+    return_code = err;
+  }
+  destruct_Byte_array(&buffer);
+  close(prefetch->output);
+  close(prefetch->dependencies);
+  prefetch->output = prefetch->dependencies = -1;
+
+  start_pending_prefetches(context, cc_stdin, options);
+
+  return return_code;
+}
+
+/**
+ * @param[in] m marker for the `#include` line.
+ */
+static int
+include_callback(Marker_p m, Byte_array_p src, FILE* cc_stdin,
+                 void* context, Options options)
+{
+  mut_IncludeContext_p _ = context;
+
+  int return_code = EXIT_SUCCESS;
+
+  bool quoted_include;
+  Byte_array_slice content = include_file_name(m, src, &quoted_include);
+
+  if (content.end_p > content.start_p) {
+    ++_->level;
+    mut_Byte_array s = {0};
+    auto destruct_Byte_array(&s);
+    trace_event('B', "include_callback", NULL, -1);
+    auto trace_event('E', "include_callback", NULL, -1);
+    if ((quoted_include and
+         find_include_file(&_->paths_quote, content, &s)) or
+        find_include_file(&_->paths, content, &s)) {
+      // TODO: check #define guards?
+      size_t prefetched = _->prefetcher and _->level is 1?
+          index_of_path(&_->prefetcher->paths, bounds_of_Byte_array(&s)):
+          SIZE_MAX;
+      Prefetch_p prefetch =
+          _->prefetcher and prefetched < _->prefetcher->prefetches.len?
+          get_Prefetch_array(&_->prefetcher->prefetches, prefetched): NULL;
+      if (prefetch and prefetch->pid > 0) {
+        return_code = finish_prefetch(_, prefetched, cc_stdin, options);
+      } else {
+        // Not started yet, or included again: expand it here.
+        if (prefetch) {
+          get_mut_Prefetch_array(&_->prefetcher->prefetches,
+                                 prefetched)->pid = -1;
+        }
+        size_t previous_len = len_IncludePaths(&_->paths_quote);
+        const char* file_dir_name_end = strrchr(as_c_string(&s), '/');
+        if (file_dir_name_end) {
+          append_path(&_->paths_quote, as_c_string(&s),
+                      (size_t)(file_dir_name_end - as_c_string(&s)));
+        }
+        return_code = include(as_c_string(&s), cc_stdin, _, options);
+        truncate_IncludePaths(&_->paths_quote, previous_len);
+      }
+      if (return_code is EXIT_SUCCESS) {
+        fprintf(cc_stdin, "\n#line %zu \"",
+                original_line_number(m->start, src));
+        fwrite(content.start_p, sizeof(content.start_p[0]),
+               (size_t)(content.end_p - content.start_p), cc_stdin);
+        fprintf(cc_stdin, "\"\n");
+      }
+    } else {
+      // The file was not found, assume it’s not a Cedro file.
+      return_code = -1;
+    }
+    --_->level;
+  } else {
+    fprintf(cc_stdin, LANG("\n#error #include vacío.\n",
+                           "\n#error empty #include.\n"));
+  }
+
+  return return_code;
+}
+
+/** Per-process memo of included files known not to contain
+ * the Cedro `#pragma`, so that they are checked only once. */
+static mut_StringMap non_cedro_files = {0};
+
+/** Quick check for `CEDRO_PRAGMA` anywhere in the file,
+ * without tokenizing it.
+ *  This can give false positives, for instance if the text is inside
+ * a comment, but never false negatives, so that only the files for which
+ * it returns `true` need the full check with `parse_skip_until_cedro_pragma()`.
+ *  If the file can not be read it returns `true`,
+ * so that `include()` reports the error as usual. */
+static bool
+might_be_cedro_file(const char* file_name)
+{
+  int fd = open(file_name, O_RDONLY);
+  if (fd is -1) return true;
+  struct stat file_status;
+  if (fstat(fd, &file_status) is -1) {
+    close(fd);
+    return true;
+  }
+  if (file_status.st_size < CEDRO_PRAGMA_LEN) {
+    close(fd);
+    return false;
+  }
+  size_t size = (size_t)file_status.st_size;
+  Byte_mut_p start = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (start is MAP_FAILED) return true;
+
+  bool found = false;
+  Byte_mut_p cursor = start;
+  Byte_p last = start + size - CEDRO_PRAGMA_LEN;
+  while (cursor <= last and
+         (cursor = memchr(cursor, '#', (size_t)(last - cursor) + 1))) {
+    if (mem_eq(cursor, CEDRO_PRAGMA, CEDRO_PRAGMA_LEN)) {
+      found = true;
+      break;
+    }
+    ++cursor;
+  }
+  munmap((void*)start, size);
+
+  return found;
+}
+
+/** Start expanding in advance, in other processes,
+ * the Cedro files included from the main file in `markers`,
+ * to be spliced into the output when their `#include` line is reached. */
+static void
+prefetch_includes(Marker_array_p markers, Byte_array_p src,
+                  mut_IncludeContext_p context,
+                  FILE* cc_stdin, Options options)
+{
+  mut_Prefetcher_p prefetcher = context->prefetcher;
+  mut_Byte_array path = {0};
+  auto destruct_Byte_array(&path);
+  for (Marker_mut_p m = start_of_Marker_array(markers);
+       m is_not end_of_Marker_array(markers); ++m) {
+    if (m->token_type is_not T_PREPROCESSOR) continue;
+    bool quoted_include;
+    Byte_array_slice name = include_file_name(m, src, &quoted_include);
+    if (name.start_p is name.end_p) continue;
+    if ((quoted_include and
+         find_include_file(&context->paths_quote, name, &path)) or
+        find_include_file(&context->paths, name, &path)) {
+      Byte_array_slice path_slice = bounds_of_Byte_array(&path);
+      if (index_of_path(&prefetcher->paths, path_slice) is
+          len_IncludePaths(&prefetcher->paths) and
+          not get_StringMap(&non_cedro_files, path_slice) and
+          might_be_cedro_file(as_c_string(&path))) {
+        append_path(&prefetcher->paths, (const char*)path.start, path.len);
+        push_Prefetch_array(&prefetcher->prefetches, (Prefetch){
+            .pid = 0, .output = -1, .dependencies = -1
+          });
+      }
+    }
+  }
+  start_pending_prefetches(context, cc_stdin, options);
+}
+
+/** Put in `path` the name of the token stream cache file
+ * for source code with the given hash, and return it as a C string. */
+static const char*
+token_cache_path(IncludeContext_p context, uint64_t hash,
+                 mut_Byte_array_p path)
+{
+  path->len = 0;
+  push_fmt(path, "%s/%016llX.tokens",
+           context->token_cache, (unsigned long long)hash);
+  return as_c_string(path);
+}
+
+/** Write the token stream cache file atomically, like `store_in_cache()`:
+ * first into a temporary file, which then gets renamed. */
+static bool
+store_token_stream(mut_Byte_array_p path,
+                   Marker_array_p markers, Byte_array_p src, uint32_t options)
+{
+  mut_Byte_array temporary = {0};
+  auto destruct_Byte_array(&temporary);
+  append_Byte_array(&temporary, bounds_of_Byte_array(path));
+  push_fmt(&temporary, ".%ld.tmp", (long)getpid());
+
+  FILE* file = fopen(as_c_string(&temporary), "wb");
+  if (not file) return false;
+  bool ok = write_token_stream(file, markers, src, options) is 0;
+  if (fclose(file) is_not 0) ok = false;
+  if (ok) ok = rename(as_c_string(&temporary), as_c_string(path)) is 0;
+  if (not ok) remove(as_c_string(&temporary));
+
+  return ok;
+}
+
+/**
+   Returns either `EXIT_SUCCESS` (that is, `0`),
+   an error code as defined in errno.h
+   (“Values for errno are now required to be distinct positive values”),
+   or `-1` if there was no error but the included file does not contain
+   the Cedro `#pragma` so it does not need to be expanded in place.
+ */
+static int
+include(const char* file_name, FILE* cc_stdin,
+        mut_IncludeContext_p context,
+        mut_Options options)
+{
+  if (context->level > 10) {
+    eprintln(LANG("Error: demasiada recursión de «include» en: %s",
+                  "Error: too much “include” recursion at: %s"),
+             file_name);
+    return EINVAL;
+  }
+
+  Byte_array_slice file_name_slice = {
+    (Byte_p)file_name, (Byte_p)file_name + strlen(file_name)
+  };
+  if (context->level is_not 0) {
+    // The memo lasts for the whole process, but the dependencies
+    // are per file compiled, so they get recorded on each hit.
+    if (get_StringMap(&non_cedro_files, file_name_slice)) {
+      append_path(&context->dependencies, file_name, strlen(file_name));
+      return -1;
+    } else if (not might_be_cedro_file(file_name)) {
+      put_StringMap(&non_cedro_files, file_name_slice, 1);
+      append_path(&context->dependencies, file_name, strlen(file_name));
+      return -1;
+    }
+  }
+
+  int return_code = EXIT_SUCCESS;
+
+  trace_event('B', "include", file_name, (int)context->level);
+  auto trace_event('E', "include", NULL, -1);
+
+  mut_Marker_array markers = {0}; // Reserved below, once we know the size.
+  auto destruct_Marker_array(&markers);
+
+  mut_Prefetcher prefetcher = {0};
+  auto destruct_Prefetcher(&prefetcher);
+  auto if (context->prefetcher is &prefetcher) context->prefetcher = NULL;
+
+  mut_Byte_array src = {0};
+  auto destruct_Byte_array(&src);
+  // Declared after `markers` and `src` so that it gets unloaded first.
+  mut_TokenStream token_stream = {0};
+  auto unload_token_stream(&token_stream, &markers, &src);
+  int err = read_file(&src, file_name);
+  if (err) {
+    print_file_error(err, file_name, src.len);
+    return err;
+  } else {
+    append_path(&context->dependencies, file_name, strlen(file_name));
+    Byte_array_mut_slice region = bounds_of_Byte_array(&src);
+    trace_event('B', "parse", NULL, -1);
+    // `parse()` below gets `false` for `use_defer_instead_of_auto`,
+    // so that is what the cached token streams must have.
+    mut_Options options_before_pragma = options;
+    options_before_pragma.use_defer_instead_of_auto = false;
+    mut_Byte_array token_cache_file = {0};
+    auto destruct_Byte_array(&token_cache_file);
+    bool tokens_from_cache = false;
+    if (context->token_cache) {
+      uint64_t hash = hash_bytes(HASH_SEED, region);
+      token_cache_path(context, hash, &token_cache_file);
+      mut_Options loaded_options = options_before_pragma;
+      if (load_token_stream(&token_stream, as_c_string(&token_cache_file),
+                            &hash, &markers, &src, &loaded_options) is 0) {
+        tokens_from_cache = true;
+        // The parsed region starts after the inert marker for the text
+        // before the pragma, if there is any.
+        size_t first = markers.len > 1 and
+            markers.start[0].token_type is T_NONE? 1: 0;
+        region = bounds_of_Byte_array(&src);
+        region.start_p = src.start + markers.start[first].start;
+        options.enable_embed_directive = loaded_options.enable_embed_directive;
+        options.use_goto_ladder_for_defer =
+            loaded_options.use_goto_ladder_for_defer;
+        if (loaded_options.use_defer_instead_of_auto) {
+          options.use_defer_instead_of_auto = true;
+        }
+        // Update the modification time for the cache eviction.
+        utime(as_c_string(&token_cache_file), NULL);
+      } else {
+        unload_token_stream(&token_stream, &markers, &src);
+      }
+    }
+    Byte_mut_p parse_end = end_of_Byte_array(&src);
+    if (not tokens_from_cache) {
+      region.start_p = parse_skip_until_cedro_pragma(&src, region, &markers,
+                                                     &options);
+      ensure_capacity_Marker_array(&markers, markers.len +
+          estimate_marker_count((size_t)(region.end_p - region.start_p)));
+      parse_end = parse(&src, region, &markers, false, options.symbols);
+      // Only the Cedro files, the others are not expanded.
+      if (context->token_cache and parse_end is region.end_p and
+          markers.len > 1) {
+        store_token_stream(&token_cache_file, &markers, &src,
+                           token_stream_options(options_before_pragma,
+                                                options));
+      }
+    }
+    trace_event('E', "parse", NULL, -1);
+    if (parse_end is_not region.end_p) {
+      if (fprintf(cc_stdin, "#line %zu \"%s\"\n#error %s\n",
+                  original_line_number((size_t)(parse_end - src.start), &src),
+                  file_name,
+                  error_buffer) < 0) {
+        eprintln(LANG("error al escribir la directiva #line",
+                      "error when writing #line directive"));
+      }
+      error_buffer[0] = 0;
+    }
+
+    if (context->level is 0 and context->prefetch_jobs) {
+      // Expand the included files while applying the macros to this one.
+      context->prefetcher = &prefetcher;
+      prefetch_includes(&markers, &src, context, cc_stdin, options);
+    }
+
+    if (options.enable_embed_directive and options.embed_as_string) {
+      err = prepare_binary_embedding(&markers, &src, file_name);
+      if (err) {
+        eprintln("#line %zu \"%s\"\n#error %s\n",
+                 original_line_number((size_t)(parse_end - src.start), &src),
+                 file_name,
+                 error_buffer);
+        return 73;
+      }
+    }
+
+    if (context->level is_not 0) {
+      if (markers.len is 1) {
+        // Included file is not a Cedro file.
+        put_StringMap(&non_cedro_files, file_name_slice, 1);
+        return -1;
+      } else {
+        // Does not depend on options.insert_line_directives
+        // because it does not cause syntax problems
+        // as it is right at the beginning of an input file.
+        fprintf(cc_stdin, "\n#line %zu \"%s\"\n",
+                original_line_number((size_t)(region.start_p - src.start),
+                                     &src),
+            file_name);
+      }
+    }
+
+    size_t original_src_len = src.len;
+
+    trace_event('B', "macros", NULL, -1);
+    apply_macros(&markers, &src, &options, NULL);
+    trace_event('E', "macros", NULL, -1);
+
+    fflush(stderr);
+    fflush(stdout);
+
+    IncludeCallback include = {
+      &include_callback,
+      context,
+      &dependency_callback
+    };
+    mut_Replacement_array replacements = {0};
+    trace_event('B', "unparse_fragment", NULL, -1);
+    unparse_fragment(markers.start, end_of_Marker_array(&markers), 0,
+                     &src, original_src_len,
+                     file_name, &include,
+                     &replacements, false,
+                     options, cc_stdin);
+    trace_event('E', "unparse_fragment", NULL, -1);
+    destruct_Replacement_array(&replacements);
+
+    if (error_buffer[0]) {
+      fprintf(cc_stdin, "\n#error %s\n", error_buffer);
+      error_buffer[0] = 0;
+    }
+  }
+
+  return return_code;
+}
+
+/* Cache for the expanded C code and the compiled object files,
+ * similar to `ccache` in its “direct mode”:
+ * the key is the hash of the main file and everything else that affects
+ * the result except for the included files, which are listed with their
+ * own hashes in a manifest that gets checked on each lookup.
+ *
+ * For key `K`, the cache directory contains:
+ *   K.manifest  `<hash> <path>` for each dependency, one per line.
+ *   K.c         the expanded C code.
+ *   K.o         the object file, only when compiling with `-c -o file`.
+ *   stats       hit and miss counters.
+ */
+
+/** Hash the contents of the file at `path`.
+ * Returns error code, 0 if it succeeds. */
+static int
+hash_file(uint64_t* hash, const char* path)
+{
+  mut_Byte_array content = {0};
+  auto destruct_Byte_array(&content);
+  int err = read_file(&content, path);
+  if (not err) *hash = hash_bytes(HASH_SEED, bounds_of_Byte_array(&content));
+  return err;
+}
+
+/** Copy the file `from` to `to`. Returns error code, 0 if it succeeds. */
+static int
+copy_file(const char* from, const char* to)
+{
+  mut_Byte_array content = {0};
+  auto destruct_Byte_array(&content);
+  int err = read_file(&content, from);
+  if (err) return err;
+  FILE* file = fopen(to, "wb");
+  if (not file) return errno;
+  if (fwrite(content.start, sizeof(content.start[0]), content.len, file)
+      is_not content.len) {
+    err = errno;
+  }
+  if (fclose(file) is_not 0 and not err) err = errno;
+  return err;
+}
+
+typedef struct Cache {
+  /// Cache directory. Empty if the cache is disabled.
+  mut_Byte_array dir;
+  /// Maximum total size of the files in the cache directory, in bytes.
+  size_t max_size;
+  /// Key for the current compilation.
+  uint64_t key;
+  /// Resolved compiler path, size and modification time, see
+  /// `compiler_identity()`, so that upgrading the compiler
+  /// invalidates the entries.
+  mut_Byte_array compiler;
+} MUT_CONST_TYPE_VARIANTS(Cache);
+
+static void
+destruct_Cache(mut_Cache_p _)
+{
+  destruct_Byte_array(&_->dir);
+  destruct_Byte_array(&_->compiler);
+}
+
+/** Append to `result` the path, size and modification time
+ * of the compiler executable, the first word in `cc`,
+ * looking for it in `PATH` if it has no slash.
+ * If it can not be found, appends just its name. */
+static void
+compiler_identity(const char* cc, mut_Byte_array_p result)
+{
+  while (*cc is ' ') ++cc;
+  size_t name_len = strcspn(cc, " ");
+  mut_Byte_array path = {0};
+  auto destruct_Byte_array(&path);
+  struct stat info;
+  bool found = false;
+  if (memchr(cc, '/', name_len)) {
+    append_Byte_array(&path, (Byte_array_slice){ B(cc), B(cc + name_len) });
+    found = stat(as_c_string(&path), &info) is 0;
+  } else {
+    const char* dir = getenv("PATH");
+    while (dir and *dir and not found) {
+      size_t dir_len = strcspn(dir, ":");
+      path.len = 0;
+      if (dir_len is 0) {
+        push_str(&path, ".");
+      } else {
+        append_Byte_array(&path,
+                          (Byte_array_slice){ B(dir), B(dir + dir_len) });
+      }
+      push_Byte_array(&path, '/');
+      append_Byte_array(&path, (Byte_array_slice){ B(cc), B(cc + name_len) });
+      found = stat(as_c_string(&path), &info) is 0 and S_ISREG(info.st_mode);
+      dir += dir_len;
+      if (*dir is ':') ++dir;
+    }
+  }
+  if (found) {
+    push_fmt(result, "%s %lld %lld", as_c_string(&path),
+             (long long)info.st_size, (long long)info.st_mtime);
+  } else {
+    append_Byte_array(result, (Byte_array_slice){ B(cc), B(cc + name_len) });
+  }
+}
+
+/** Build in `path` the file name for the cache entry with the given extension.
+ * Returns it as a C string. */
+static const char*
+cache_path(Cache_p _, const char* extension, mut_Byte_array_p path)
+{
+  path->len = 0;
+  append_Byte_array(path, bounds_of_Byte_array(&_->dir));
+  push_fmt(path, "/%016llX%s", (unsigned long long)_->key, extension);
+  return as_c_string(path);
+}
+
+/** Create the directory and any missing parents, like `mkdir -p`. */
+static bool
+make_directories(mut_Byte_array_p path)
+{
+  const char* dir = as_c_string(path);
+  for (size_t i = 1; i <= path->len; ++i) {
+    if (i is_not path->len and path->start[i] is_not '/') continue;
+    mut_Byte separator = path->start[i];
+    path->start[i] = 0;
+    int err = mkdir(dir, 0777)? errno: 0;
+    path->start[i] = separator;
+    if (err and err is_not EEXIST) return false;
+  }
+  return true;
+}
+
+/** Prepare the cache in the given directory, creating it if needed,
+ * for compiling with the compiler command `cc`.
+ * Returns `false` if the cache can not be used. */
+static bool
+init_Cache(mut_Cache_p _, const char* dir, const char* cc)
+{
+  _->dir.len = 0;
+  push_str(&_->dir, dir);
+  while (_->dir.len > 1 and _->dir.start[_->dir.len - 1] is '/') --_->dir.len;
+  if (not make_directories(&_->dir)) {
+    eprintln(LANG("Aviso: no se puede crear el directorio de caché «%s»: %s",
+                  "Warning: can not create the cache directory “%s”: %s"),
+             as_c_string(&_->dir), strerror(errno));
+    return false;
+  }
+
+  _->max_size = 512 * 1024 * 1024;
+  char* max_size = getenv("CEDRO_CACHE_SIZE");
+  if (max_size and max_size[0]) {
+    char* end = max_size;
+    unsigned long megabytes = strtoul(max_size, &end, 10);
+    if (*end is 0 and megabytes is_not 0) {
+      _->max_size = (size_t)megabytes * 1024 * 1024;
+    }
+  }
+
+  _->compiler.len = 0;
+  compiler_identity(cc, &_->compiler);
+
+  return true;
+}
+
+/** Compute the key for compiling `file_name` with `cmd`
+ * and the compiler identified in `init_Cache()`.
+ * Returns `false` if the file can not be read. */
+static bool
+set_cache_key(mut_Cache_p _, const char* file_name, const char* cmd,
+              Options options)
+{
+  uint64_t hash = 0;
+  if (hash_file(&hash, file_name)) return false;
+
+  mut_Byte_array text = {0};
+  auto destruct_Byte_array(&text);
+  // Relative paths in the expansion depend on the working directory.
+  char cwd[4096];
+  if (not getcwd(cwd, sizeof(cwd))) return false;
+  push_fmt(&text, "%s\n%s\n%s\n%s\n%s\n%llX\n"
+           "%d %d %d %d %d %d %zu %d %d",
+           CEDRO_VERSION, as_c_string(&_->compiler), cwd, cmd, file_name,
+           (unsigned long long)hash,
+           options.apply_macros, options.escape_ucn,
+           options.discard_space, options.discard_comments,
+           options.insert_line_directives, options.enable_embed_directive,
+           options.embed_as_string, options.use_defer_instead_of_auto,
+           options.c_standard);
+  _->key = hash_bytes(HASH_SEED, bounds_of_Byte_array(&text));
+
+  return true;
+}
+
+/** Check that every file listed in the manifest still has the same hash,
+ * and add those files to `dependencies`. */
+static bool
+check_manifest(Cache_p _, mut_IncludePaths_p dependencies)
+{
+  mut_Byte_array path = {0};
+  auto destruct_Byte_array(&path);
+  mut_Byte_array manifest = {0};
+  auto destruct_Byte_array(&manifest);
+  if (read_file(&manifest, cache_path(_, ".manifest", &path))) return false;
+
+  Byte_mut_p cursor = start_of_Byte_array(&manifest);
+  Byte_p     end    =   end_of_Byte_array(&manifest);
+  while (cursor is_not end) {
+    Byte_mut_p line_end = memchr(cursor, '\n', (size_t)(end - cursor));
+    if (not line_end) return false; // Truncated.
+    char* path_start = NULL;
+    uint64_t expected = strtoull((const char*)cursor, &path_start, 16);
+    if (*path_start is_not ' ') return false;
+    ++path_start;
+    path.len = 0;
+    append_Byte_array(&path, (Byte_array_slice){ B(path_start), line_end });
+    uint64_t hash = 0;
+    if (hash_file(&hash, as_c_string(&path)) or hash is_not expected) {
+      return false;
+    }
+    append_path(dependencies, (const char*)path.start, path.len);
+    cursor = line_end + 1;
+  }
+
+  return true;
+}
+
+/** Write the cache entry file atomically:
+ * first into a temporary file, which then gets renamed. */
+static bool
+store_in_cache(Cache_p _, const char* extension, Byte_array_slice content)
+{
+  mut_Byte_array path = {0};
+  auto destruct_Byte_array(&path);
+  mut_Byte_array temporary = {0};
+  auto destruct_Byte_array(&temporary);
+  cache_path(_, extension, &path);
+  append_Byte_array(&temporary, bounds_of_Byte_array(&path));
+  push_fmt(&temporary, ".%ld.tmp", (long)getpid());
+
+  FILE* file = fopen(as_c_string(&temporary), "wb");
+  if (not file) return false;
+  size_t len = (size_t)(content.end_p - content.start_p);
+  bool ok = fwrite(content.start_p, sizeof(content.start_p[0]), len, file)
+      is len;
+  if (fclose(file) is_not 0) ok = false;
+  if (ok) ok = rename(as_c_string(&temporary), as_c_string(&path)) is 0;
+  if (not ok) remove(as_c_string(&temporary));
+
+  return ok;
+}
+
+/** Write the manifest listing all the dependencies with their hashes. */
+static bool
+write_manifest(Cache_p _, IncludePaths_p dependencies)
+{
+  mut_Byte_array manifest = {0};
+  auto destruct_Byte_array(&manifest);
+  mut_Byte_array path = {0};
+  auto destruct_Byte_array(&path);
+  for (size_t i = 0; i is_not len_IncludePaths(dependencies); ++i) {
+    path.len = 0;
+    append_Byte_array(&path, get_IncludePaths(dependencies, i));
+    uint64_t hash = 0;
+    if (hash_file(&hash, as_c_string(&path))) return false;
+    push_fmt(&manifest, "%016llX %s\n",
+             (unsigned long long)hash, as_c_string(&path));
+  }
+
+  bool ok = store_in_cache(_, ".manifest", bounds_of_Byte_array(&manifest));
+  return ok;
+}
+
+/** Update the modification time of the current entry files,
+ * which is what the eviction uses to find the least recently used ones. */
+static void
+touch_cache_entry(Cache_p _)
+{
+  mut_Byte_array path = {0};
+  auto destruct_Byte_array(&path);
+  utime(cache_path(_, ".manifest", &path), NULL);
+  utime(cache_path(_, ".c",        &path), NULL);
+  utime(cache_path(_, ".o",        &path), NULL);
+}
+
+typedef struct CacheFile {
+  mut_Byte_array path;
+  time_t mtime;
+  size_t size;
+} MUT_CONST_TYPE_VARIANTS(CacheFile);
+DEFINE_ARRAY_OF(CacheFile, 0, {
+    while (cursor is_not end) {
+      destruct_Byte_array(&cursor->path);
+      ++cursor;
+    }
+  });
+
+/** List the entry files in the cache directory.
+ * Returns their total size in bytes. */
+static size_t
+scan_cache(mut_Cache_p _, mut_CacheFile_array_p files)
+{
+  size_t total = 0;
+  DIR* dir = opendir(as_c_string(&_->dir));
+  if (not dir) return total;
+  struct dirent* entry;
+  while ((entry = readdir(dir))) {
+    if (entry->d_name[0] is '.' or str_eq(entry->d_name, "stats")) continue;
+    mut_CacheFile file = { .path = {0} };
+    append_Byte_array(&file.path, bounds_of_Byte_array(&_->dir));
+    push_fmt(&file.path, "/%s", entry->d_name);
+    struct stat file_stat;
+    if (stat(as_c_string(&file.path), &file_stat) is_not 0 or
+        not S_ISREG(file_stat.st_mode)) {
+      destruct_Byte_array(&file.path);
+      continue;
+    }
+    file.mtime = file_stat.st_mtime;
+    file.size  = (size_t)file_stat.st_size;
+    total += file.size;
+    push_CacheFile_array(files, file);
+  }
+  closedir(dir);
+
+  return total;
+}
+
+static int
+compare_CacheFile_mtime(const void* a, const void* b)
+{
+  CacheFile_p file_a = a;
+  CacheFile_p file_b = b;
+  return
+      file_a->mtime < file_b->mtime? -1:
+      file_a->mtime > file_b->mtime?  1:
+      0;
+}
+
+/** If the cache is over its size limit, delete the least recently used
+ * files until it is at 80% of the limit, to avoid doing this every time. */
+static void
+evict_cache(mut_Cache_p _)
+{
+  mut_CacheFile_array files = init_CacheFile_array(64);
+  auto destruct_CacheFile_array(&files);
+  size_t total = scan_cache(_, &files);
+  if (total <= _->max_size) return;
+
+  qsort((void*)files.start, files.len, sizeof(files.start[0]),
+        &compare_CacheFile_mtime);
+  size_t target = _->max_size / 10 * 8;
+  for (CacheFile_mut_p file = start_of_CacheFile_array(&files);
+       file is_not end_of_CacheFile_array(&files) and total > target;
+       ++file) {
+    if (remove((const char*)file->path.start) is 0) total -= file->size;
+  }
+}
+
+/** Add one to the hit or miss count in the `stats` file of the cache.
+ * The file is locked because several compilations might run in parallel. */
+static void
+count_cache_result(Cache_p _, bool hit)
+{
+  mut_Byte_array path = {0};
+  auto destruct_Byte_array(&path);
+  append_Byte_array(&path, bounds_of_Byte_array(&_->dir));
+  push_str(&path, "/stats");
+  int fd = open(as_c_string(&path), O_RDWR | O_CREAT, 0666);
+  if (fd is -1) return;
+  auto close(fd);
+  struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+  if (fcntl(fd, F_SETLKW, &lock) is -1) return;
+
+  char text[80] = {0};
+  size_t hits = 0, misses = 0;
+  if (read(fd, text, sizeof(text) - 1) > 0) {
+    sscanf(text, "%zu hits %zu misses", &hits, &misses);
+  }
+  if (hit) ++hits; else ++misses;
+  int len = snprintf(text, sizeof(text), "%zu hits\n%zu misses\n",
+                     hits, misses);
+  if (lseek(fd, 0, SEEK_SET) is 0 and ftruncate(fd, 0) is 0) {
+    if (write(fd, text, (size_t)len) is_not len) {
+      eprintln(LANG("Aviso: error al escribir «%s».",
+                    "Warning: error writing “%s”."),
+               as_c_string(&path));
+    }
+  }
+}
+
+static void
+print_cache_stats(mut_Cache_p _)
+{
+  mut_Byte_array path = {0};
+  auto destruct_Byte_array(&path);
+  append_Byte_array(&path, bounds_of_Byte_array(&_->dir));
+  push_str(&path, "/stats");
+  mut_Byte_array text = {0};
+  auto destruct_Byte_array(&text);
+  size_t hits = 0, misses = 0;
+  if (not read_file(&text, as_c_string(&path))) {
+    sscanf(as_c_string(&text), "%zu hits %zu misses", &hits, &misses);
+  }
+  mut_CacheFile_array files = init_CacheFile_array(64);
+  auto destruct_CacheFile_array(&files);
+  size_t total = scan_cache(_, &files);
+  eprintln(LANG("Caché:     %s\n"
+                "Aciertos:  %zu\n"
+                "Fallos:    %zu\n"
+                "Ficheros:  %zu\n"
+                "Tamaño:    %.1f MiB de %.1f MiB",
+                "Cache:     %s\n"
+                "Hits:      %zu\n"
+                "Misses:    %zu\n"
+                "Files:     %zu\n"
+                "Size:      %.1f MiB of %.1f MiB"),
+           as_c_string(&_->dir),
+           hits, misses, files.len,
+           (double)total / (1024 * 1024),
+           (double)_->max_size / (1024 * 1024));
+}
+
+/** Add to `dependencies` the prerequisites listed in a `make` rule file
+ * as written by the compiler with `-MD -MF file`.
+ * Returns error code, 0 if it succeeds. */
+static int
+read_dependency_file(const char* path, mut_IncludePaths_p dependencies)
+{
+  mut_Byte_array content = {0};
+  auto destruct_Byte_array(&content);
+  int err = read_file(&content, path);
+  if (err) return err;
+
+  mut_Byte_array name = {0};
+  auto destruct_Byte_array(&name);
+  Byte_mut_p cursor = start_of_Byte_array(&content);
+  Byte_p     end    =   end_of_Byte_array(&content);
+  while (cursor is_not end) {
+    if (*cursor is '\\' and cursor + 1 is_not end and
+        (cursor[1] is '\n' or cursor[1] is '\r')) {
+      cursor += 2; // Line continuation.
+      continue;
+    }
+    if (*cursor is ' ' or *cursor is '\t' or
+        *cursor is '\n' or *cursor is '\r') {
+      ++cursor;
+      continue;
+    }
+    name.len = 0;
+    while (cursor is_not end and
+           *cursor is_not ' '  and *cursor is_not '\t' and
+           *cursor is_not '\n' and *cursor is_not '\r') {
+      if (*cursor is '\\' and cursor + 1 is_not end) {
+        if (cursor[1] is '\n' or cursor[1] is '\r') break;
+        if (cursor[1] is ' '  or cursor[1] is '#' ) ++cursor;
+      } else if (*cursor is '$' and cursor + 1 is_not end and
+                 cursor[1] is '$') {
+        ++cursor;
+      }
+      push_Byte_array(&name, *cursor++);
+    }
+    if (name.len is 0 or name.start[name.len - 1] is ':') continue; // Target.
+    append_path(dependencies, (const char*)name.start, name.len);
+  }
+
+  return 0;
+}
+
+/** Translate the status returned by `pclose()` into an exit code. */
+static int
+exit_code(int status)
+{
+  // https://www.man7.org/linux/man-pages/man3/wait.3p.html
+  if      (WIFEXITED  (status)) return WEXITSTATUS(status);
+  else if (WIFSIGNALED(status)) return 111;
+  else if (WIFSTOPPED (status)) return 112;
+  else                          return 113;
+}
+
+/** Directory for temporary files: `$TMPDIR` or `/tmp`. */
+static const char*
+temporary_directory(void)
+{
+  const char* tmp_dir = getenv("TMPDIR");
+  return (tmp_dir and tmp_dir[0])? tmp_dir: "/tmp";
+}
+
+/** Same as `popen(cmd, "w")`, but with larger buffers where possible
+ * so that the compiler does not wait for many small writes. */
+static FILE*
+popen_compiler(const char* cmd)
+{
+  FILE* cc_stdin = popen(cmd, "w");
+  if (cc_stdin) {
+    setvbuf(cc_stdin, NULL, _IOFBF, 1 << 16);
+#ifdef F_SETPIPE_SZ
+    // Fails silently if over /proc/sys/fs/pipe-max-size, which is fine.
+    fcntl(fileno(cc_stdin), F_SETPIPE_SZ, 1 << 20);
+#endif
+  }
+  return cc_stdin;
+}
+
+/** Create an anonymous file, in memory with `memfd_create()` if available,
+ * or otherwise as a temporary file that is deleted right away.
+ * Returns its file descriptor, or `-1` if there was an error. */
+static int
+anonymous_file(void)
+{
+#ifdef MFD_CLOEXEC
+  int fd = memfd_create("cedrocc", MFD_CLOEXEC);
+  if (fd is_not -1) return fd;
+#endif
+  mut_Byte_array path = {0};
+  auto destruct_Byte_array(&path);
+  push_fmt(&path, "%s/cedrocc-XXXXXX", temporary_directory());
+  int temporary_fd = mkstemp((char*)as_c_string(&path));
+  if (temporary_fd is_not -1) unlink(as_c_string(&path));
+  return temporary_fd;
+}
+
+/** Run the compiler command with `stdin` reading from `fd`,
+ * from the start of the file, instead of a pipe.
+ * The compiler can then read it as fast as it wants,
+ * or even map it in memory.
+ * Returns the compiler’s exit code. */
+static int
+run_compiler_on_file(const char* cmd, int fd)
+{
+  if (lseek(fd, 0, SEEK_SET) is -1) {
+    int err = errno;
+    perror("lseek()");
+    return err;
+  }
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid is 0) {
+    dup2(fd, STDIN_FILENO);
+    close(fd);
+    execl("/bin/sh", "sh", "-c", cmd, (char*)NULL);
+    _exit(127);
+  } else if (pid is -1) {
+    int err = errno;
+    perror("fork()");
+    return err;
+  }
+  int status;
+  trace_event('B', "compiler", NULL, -1);
+  auto trace_event('E', "compiler", NULL, -1);
+  while (waitpid(pid, &status, 0) is -1) {
+    if (errno is_not EINTR) {
+      int err = errno;
+      perror("waitpid()");
+      return err;
+    }
+  }
+  return exit_code(status);
+}
+
+/** Run the compiler command with the given input as its `stdin`,
+ * through a pipe, or from an anonymous file if `use_memfd` is set.
+ * Returns the compiler’s exit code. */
+static int
+run_compiler(const char* cmd, Byte_array_slice input, bool use_memfd)
+{
+  size_t len = (size_t)(input.end_p - input.start_p);
+  int fd = use_memfd? anonymous_file(): -1;
+  if (fd is_not -1) {
+    int return_code = EXIT_SUCCESS;
+    for (Byte_mut_p p = input.start_p; p is_not input.end_p;) {
+      ssize_t written = write(fd, p, (size_t)(input.end_p - p));
+      if (written is -1) {
+        if (errno is EINTR) continue;
+        return_code = errno;
+        perror("write()");
+        break;
+      }
+      p += written;
+    }
+    if (return_code is EXIT_SUCCESS) {
+      return_code = run_compiler_on_file(cmd, fd);
+    }
+    close(fd);
+    return return_code;
+  }
+
+  FILE* cc_stdin = popen_compiler(cmd);
+  if (not cc_stdin) {
+    perror(cmd);
+    return errno;
+  }
+  trace_event('B', "compiler", NULL, -1);
+  fwrite(input.start_p, sizeof(input.start_p[0]), len, cc_stdin);
+  int status = pclose(cc_stdin);
+  trace_event('E', "compiler", NULL, -1);
+  return exit_code(status);
+}
+
+/** Compile `file_name` with `cmd`, using the cache when possible.
+ *  If `object_file` is not `NULL`, it gets cached too,
+ * and the compiler is asked to write a dependency file listing
+ * the headers it read, so that the cached object can be validated
+ * against them later. */
+static int
+compile_with_cache(const char* file_name, const char* cmd,
+                   const char* object_file,
+                   mut_IncludeContext_p context, Options options,
+                   mut_Cache_p cache, bool use_memfd)
+{
+  int return_code = EXIT_SUCCESS;
+
+  mut_Byte_array path = {0};
+  auto destruct_Byte_array(&path);
+  mut_Byte_array expansion = {0};
+  auto destruct_Byte_array(&expansion);
+
+  bool hit = check_manifest(cache, &context->dependencies);
+  if (hit and object_file and
+      copy_file(cache_path(cache, ".o", &path), object_file) is 0) {
+    touch_cache_entry(cache);
+    count_cache_result(cache, true);
+    return EXIT_SUCCESS;
+  }
+  if (not hit or read_file(&expansion, cache_path(cache, ".c", &path))) {
+    hit = false;
+    truncate_IncludePaths(&context->dependencies, 0);
+    destruct_Byte_array(&expansion);
+    char* buffer = NULL;
+    size_t size = 0;
+    FILE* stream = open_memstream(&buffer, &size);
+    if (not stream) {
+      return_code = errno;
+      perror(file_name);
+      return return_code;
+    }
+    return_code = include(file_name, stream, context, options);
+    fclose(stream);
+    expansion = (mut_Byte_array){
+      .len = size, .capacity = size + 1, .start = (mut_Byte_p)buffer
+    };
+  }
+
+  mut_Byte_array dependency_file = {0};
+  auto destruct_Byte_array(&dependency_file);
+  mut_Byte_array cmd_with_options = {0};
+  auto destruct_Byte_array(&cmd_with_options);
+  push_str(&cmd_with_options, cmd);
+  if (object_file) {
+    cache_path(cache, "", &dependency_file);
+    push_fmt(&dependency_file, ".%ld.d", (long)getpid());
+    push_fmt(&cmd_with_options, " -MD -MF %s", as_c_string(&dependency_file));
+  }
+
+  int compiler_return_code =
+      run_compiler(as_c_string(&cmd_with_options),
+                   bounds_of_Byte_array(&expansion), use_memfd);
+  if (return_code is EXIT_SUCCESS) return_code = compiler_return_code;
+
+  if (return_code is EXIT_SUCCESS) {
+    bool ok = hit or
+        store_in_cache(cache, ".c", bounds_of_Byte_array(&expansion));
+    if (ok and object_file) {
+      mut_Byte_array object = {0};
+      ok = read_dependency_file(as_c_string(&dependency_file),
+                                &context->dependencies) is 0 and
+          read_file(&object, object_file) is 0 and
+          store_in_cache(cache, ".o", bounds_of_Byte_array(&object));
+      destruct_Byte_array(&object);
+    }
+    // The manifest goes last because it is what makes the entry valid.
+    if (ok) write_manifest(cache, &context->dependencies);
+    evict_cache(cache);
+    count_cache_result(cache, hit);
+  }
+  if (object_file) remove(as_c_string(&dependency_file));
+
+  return return_code;
+}
+
+/** Append `path` with its extension, if any, replaced by `extension`. */
+static void
+push_with_extension(mut_Byte_array_p _, const char* path,
+                    const char* extension)
+{
+  const char* base_name = strrchr(path, '/');
+  base_name = base_name? base_name + 1: path;
+  const char* end = strrchr(base_name, '.');
+  if (not end) end = base_name + strlen(base_name);
+  append_Byte_array(_, (Byte_array_slice){ B(path), B(end) });
+  push_str(_, extension);
+}
+
+/** Append `name` quoted for `make`, like GCC does for `-MQ`. */
+static void
+push_make_quoted(mut_Byte_array_p _, const char* name)
+{
+  for (const char* c = name; *c; ++c) {
+    switch (*c) {
+      case ' ': case '\t': case '#': push_Byte_array(_, '\\'); break;
+      case '$':                      push_Byte_array(_, '$');  break;
+    }
+    push_Byte_array(_, (Byte)*c);
+  }
+}
+
+/** Settings shared by all the files compiled in one run. */
+typedef struct Build {
+  /// Compiler command, from `CEDRO_CC`, at the start of every `cmd`.
+  const char* cc;
+  /// Compiler command with the options, but without the input files
+  /// nor the output file, which can be temporary: the part of `cmd`
+  /// that goes into the cache key.
+  const char* cache_cmd;
+  mut_Options options;
+  /// `NULL` if the cache is disabled.
+  mut_Cache_mut_p cache;
+  /// Whether object files can be cached.
+  bool cache_objects;
+  /// `-MD` or `-MMD` if given, to write a dependency file
+  /// for each object file, otherwise `NULL`.
+  const char* dependency_option;
+  /// From `-MF`, or `NULL` to put it next to the object file.
+  const char* dependency_file;
+  /// From `-MT` and `-MQ`, or empty to use the object file name.
+  mut_Byte_array dependency_targets;
+  /// From `-MP`.
+  bool phony_targets;
+  /// Give the expanded code to the compiler in an anonymous file
+  /// instead of a pipe.
+  bool use_memfd;
+  /// Give files without the Cedro `#pragma` directly to the compiler.
+  bool passthrough;
+} MUT_CONST_TYPE_VARIANTS(Build);
+
+/** Make in `result` the command to compile `file_name` without Cedro:
+ * the same as `cmd`, with the argument `-` for `stdin` in the compiler
+ * command `cc` replaced by the file name.
+ * Returns `false` if there is no such argument in `cc`. */
+static bool
+direct_compiler_command(const char* cc, const char* cmd,
+                        const char* file_name, mut_Byte_array_p result)
+{
+  size_t cc_len = strlen(cc);
+  if (not strn_eq(cmd, cc, cc_len)) return false;
+  const char* token = cc;
+  while (*token) {
+    while (*token is ' ') ++token;
+    const char* token_end = token;
+    while (*token_end and *token_end is_not ' ') ++token_end;
+    if (token_end - token is 1 and *token is '-') {
+      append_Byte_array(result, (Byte_array_slice){
+          B(cmd), B(cmd + (token - cc))
+        });
+      push_str(result, file_name);
+      push_str(result, cmd + (token_end - cc));
+      return true;
+    }
+    token = token_end;
+  }
+  return false;
 }
 
-typedef struct IncludeContext {
-  size_t level;
-  mut_IncludePaths paths;
-  mut_IncludePaths paths_quote;
-} mut_IncludeContext, *mut_IncludeContext_p;
-typedef const struct IncludeContext IncludeContext,
-  * const IncludeContext_p, * IncludeContext_mut_p;
-
+/** Write a `make` rule with `dependencies` as prerequisites, like `cc -MD`,
+ * for `target` unless there are `-MT`/`-MQ` targets in `build`.
+ * Returns error code, 0 if it succeeds. */
 static int
-include(const char* file_name, FILE* cc_stdin,
-        mut_IncludeContext_p context,
-        Options options);
+write_dependency_file(const char* path, const char* target,
+                      IncludePaths_p dependencies, Build_p build)
+{
+  mut_Byte_array rule = {0};
+  auto destruct_Byte_array(&rule);
+  if (build->dependency_targets.len) {
+    append_Byte_array(&rule, bounds_of_Byte_array(&build->dependency_targets));
+  } else {
+    push_make_quoted(&rule, target);
+  }
+  push_str(&rule, ":");
+  mut_Byte_array name = {0};
+  auto destruct_Byte_array(&name);
+  for (size_t i = 0; i is_not len_IncludePaths(dependencies); ++i) {
+    name.len = 0;
+    append_Byte_array(&name, get_IncludePaths(dependencies, i));
+    push_str(&rule, i? " \\\n ": " ");
+    push_make_quoted(&rule, as_c_string(&name));
+  }
+  push_str(&rule, "\n");
+  if (build->phony_targets) {
+    // The first one is the main file, as with GCC.
+    for (size_t i = 1; i < len_IncludePaths(dependencies); ++i) {
+      name.len = 0;
+      append_Byte_array(&name, get_IncludePaths(dependencies, i));
+      push_Byte_array(&rule, '\n');
+      push_make_quoted(&rule, as_c_string(&name));
+      push_str(&rule, ":\n");
+    }
+  }
 
-/**
- * @param[in] m marker for the `#include` line.
- */
+  FILE* file = fopen(path, "w");
+  if (not file) {
+    int err = errno;
+    perror(path);
+    return err;
+  }
+  fwrite(rule.start, sizeof(rule.start[0]), rule.len, file);
+  if (fclose(file)) {
+    int err = errno;
+    perror(path);
+    return err;
+  }
+
+  return 0;
+}
+
+/** Expand `file_name` and compile it with `cmd`.
+ *  If `object_file` is not `NULL`, it gets compiled with `-c -o object_file`,
+ * and cached if `build->cache_objects` is set.
+ *  `target` is the object file name as seen by `make`,
+ * for the dependency file if requested with `-MD` or `-MMD`.
+ * It includes all the files read by Cedro, and those read by the compiler.
+ *  If `cmd` is `NULL`, the expanded code is written to `stdout`. */
 static int
-include_callback(Marker_p m, Byte_array_p src, FILE* cc_stdin,
-                 void* context, Options options)
+compile_file(const char* file_name, const char* cmd,
+             const char* object_file, const char* target,
+             mut_IncludeContext_p context, Build_p build)
 {
-  mut_IncludeContext_p _ = context;
-
   int return_code = EXIT_SUCCESS;
 
-  Byte_array_mut_slice content = slice_for_marker(src, m);
-  Byte_mut_p text = content.start_p;
-  bool quoted_include = false;
-  const size_t len = 10; // = strlen("#include <");
-  if        (m->len >= len and strn_eq("#include <",  (char*)text, len)) {
-    content.start_p += len;
-    // TODO: check whether the C standard allows escaped '>' here.
-    content.end_p = memchr(text + len, '>', m->len - len);
-  } else if (m->len >= len and strn_eq("#include \"", (char*)text, len)) {
-    quoted_include = true;
-    content.start_p += len;
-    // TODO: check whether the C standard allows escaped '"' here.
-    content.end_p = memchr(text + len, '"', m->len - len);
+  truncate_IncludePaths(&context->dependencies, 0);
+  // The last path gets searched first, as for nested includes.
+  size_t previous_len = len_IncludePaths(&context->paths_quote);
+  const char* file_dir_name_end = strrchr(file_name, '/');
+  if (file_dir_name_end) {
+    append_path(&context->paths_quote,
+                file_name,
+                (size_t)(file_dir_name_end - file_name));
   }
 
-  if (content.end_p > content.start_p) {
-    ++_->level;
-    mut_Byte_array s = {0};
-    auto destruct_Byte_array(&s);
-    if ((quoted_include and
-         find_include_file(&_->paths_quote, content, &s)) or
-        find_include_file(&_->paths, content, &s)) {
-      // TODO: check #define guards?
-      size_t previous_len = len_IncludePaths(&_->paths_quote);
-      const char* file_dir_name_end = strrchr(as_c_string(&s), '/');
-      if (file_dir_name_end) {
-        append_path(&_->paths_quote, as_c_string(&s),
-                    (size_t)(file_dir_name_end - as_c_string(&s)));
-      }
-      return_code = include(as_c_string(&s), cc_stdin, _, options);
-      truncate_IncludePaths(&_->paths_quote, previous_len);
-      if (return_code is EXIT_SUCCESS) {
-        fprintf(cc_stdin, "\n#line %zu \"",
-                original_line_number(m->start, src));
-        fwrite(content.start_p, sizeof(content.start_p[0]),
-               (size_t)(content.end_p - content.start_p), cc_stdin);
-        fprintf(cc_stdin, "\"\n");
+  if (not cmd) {
+    return_code = include(file_name, stdout, context, build->options);
+  } else {
+    mut_Byte_array full_cmd = {0};
+    auto destruct_Byte_array(&full_cmd);
+    push_str(&full_cmd, cmd);
+    if (object_file) push_fmt(&full_cmd, " -c -o %s", object_file);
+    if (file_dir_name_end) {
+      push_str(&full_cmd, " -iquote ");
+      append_Byte_array(&full_cmd, (Byte_array_slice){
+          B(file_name), B(file_dir_name_end)
+        });
+    }
+
+    // Only objects get cached with the compiler’s dependencies,
+    // so those entries are kept apart from the ones for linking.
+    mut_Byte_array key_cmd = {0};
+    auto destruct_Byte_array(&key_cmd);
+    push_str(&key_cmd, build->cache_cmd);
+    if (object_file) push_str(&key_cmd, " -c");
+    bool use_cache = build->cache and
+        set_cache_key(build->cache, file_name, as_c_string(&key_cmd),
+                      build->options);
+    bool cache_object = use_cache and object_file and build->cache_objects;
+    int fd = -1;
+
+    // When caching the object file, `compile_with_cache()` already gets
+    // the compiler’s dependencies into `context->dependencies`.
+    mut_Byte_array compiler_dependency_file = {0};
+    auto destruct_Byte_array(&compiler_dependency_file);
+    if (build->dependency_option and not cache_object) {
+      push_fmt(&compiler_dependency_file, "%s.%ld.d", target, (long)getpid());
+      push_fmt(&full_cmd, " %s -MF %s", build->dependency_option,
+               as_c_string(&compiler_dependency_file));
+    }
+
+    // Without the cache, files that are not Cedro files
+    // get compiled directly, as if Cedro was not there.
+    mut_Byte_array direct_cmd = {0};
+    auto destruct_Byte_array(&direct_cmd);
+    bool direct = build->passthrough and not use_cache and
+        not might_be_cedro_file(file_name) and
+        direct_compiler_command(build->cc, as_c_string(&full_cmd), file_name,
+                                &direct_cmd);
+
+    if (direct) {
+      fflush(stdout);
+      fflush(stderr);
+      trace_event('B', "compiler", NULL, -1);
+      int status = system(as_c_string(&direct_cmd));
+      trace_event('E', "compiler", NULL, -1);
+      if (status is -1) {
+        return_code = errno;
+        perror(as_c_string(&direct_cmd));
+      } else {
+        return_code = exit_code(status);
+      }
+    } else if (use_cache) {
+      return_code = compile_with_cache(file_name, as_c_string(&full_cmd),
+                                       cache_object? object_file: NULL,
+                                       context, build->options, build->cache,
+                                       build->use_memfd);
+    } else if (build->use_memfd and (fd = anonymous_file()) is_not -1) {
+      // `include()` writes directly into the anonymous file.
+      FILE* cc_stdin = fdopen(dup(fd), "w");
+      if (cc_stdin) {
+        setvbuf(cc_stdin, NULL, _IOFBF, 1 << 16);
+        return_code = include(file_name, cc_stdin, context, build->options);
+        if (fclose(cc_stdin) and return_code is EXIT_SUCCESS) {
+          return_code = errno;
+          perror(file_name);
+        }
+        if (return_code is EXIT_SUCCESS) {
+          return_code = run_compiler_on_file(as_c_string(&full_cmd), fd);
+        }
+      } else {
+        return_code = errno;
+        perror("fdopen()");
       }
+      close(fd);
     } else {
-      // The file was not found, assume it’s not a Cedro file.
-      return_code = -1;
+      FILE* cc_stdin = popen_compiler(as_c_string(&full_cmd));
+      if (cc_stdin) {
+        return_code = include(file_name, cc_stdin, context, build->options);
+        trace_event('B', "compiler", NULL, -1);
+        if (return_code is_not EXIT_SUCCESS) {
+          pclose(cc_stdin);
+        } else {
+          return_code = exit_code(pclose(cc_stdin));
+        }
+        trace_event('E', "compiler", NULL, -1);
+      } else {
+        perror(as_c_string(&full_cmd));
+        return_code = errno;
+      }
+    }
+
+    if (build->dependency_option and return_code is EXIT_SUCCESS) {
+      if (compiler_dependency_file.len) {
+        return_code = read_dependency_file(
+            as_c_string(&compiler_dependency_file), &context->dependencies);
+        if (return_code) perror(as_c_string(&compiler_dependency_file));
+      }
+      mut_Byte_array dependency_file = {0};
+      auto destruct_Byte_array(&dependency_file);
+      if (build->dependency_file) {
+        push_str(&dependency_file, build->dependency_file);
+      } else {
+        push_with_extension(&dependency_file, target, ".d");
+      }
+      if (return_code is EXIT_SUCCESS) {
+        return_code = write_dependency_file(as_c_string(&dependency_file),
+                                            target, &context->dependencies,
+                                            build);
+      }
+    }
+    if (compiler_dependency_file.len) {
+      remove(as_c_string(&compiler_dependency_file));
     }
-    --_->level;
-  } else {
-    fprintf(cc_stdin, LANG("\n#error #include vacío.\n",
-                           "\n#error empty #include.\n"));
   }
 
+  truncate_IncludePaths(&context->paths_quote, previous_len);
+
   return return_code;
 }
 
-/**
-   Returns either `EXIT_SUCCESS` (that is, `0`),
-   an error code as defined in errno.h
-   (“Values for errno are now required to be distinct positive values”),
-   or `-1` if there was no error but the included file does not contain
-   the Cedro `#pragma` so it does not need to be expanded in place.
- */
+typedef struct Job {
+  pid_t pid;
+  const char* file_name;
+} MUT_CONST_TYPE_VARIANTS(Job);
+DEFINE_ARRAY_OF(Job, 0, {});
+
+/** Wait for one of the `jobs` to finish, and remove it from the list.
+ * Returns its exit code, after reporting it if it is an error. */
 static int
-include(const char* file_name, FILE* cc_stdin,
-        mut_IncludeContext_p context,
-        mut_Options options)
+wait_for_job(mut_Job_array_p jobs)
 {
-  if (context->level > 10) {
-    eprintln(LANG("Error: demasiada recursión de «include» en: %s",
-                  "Error: too much “include” recursion at: %s"),
-             file_name);
-    return EINVAL;
+  int status;
+  pid_t pid = wait(&status);
+  if (pid is -1) {
+    int err = errno;
+    perror("wait()");
+    truncate_Job_array(jobs, 0);
+    return err;
+  }
+  for (size_t i = 0; i is_not jobs->len; ++i) {
+    Job_p job = get_Job_array(jobs, i);
+    if (job->pid is pid) {
+      int return_code = exit_code(status);
+      if (return_code is_not EXIT_SUCCESS) {
+        eprintln(LANG("Error %d al compilar %s",
+                      "Error %d when compiling %s"),
+                 return_code, job->file_name);
+      }
+      delete_Job_array(jobs, i, 1);
+      return return_code;
+    }
   }
+  return EXIT_SUCCESS;
+}
+
+/** Number of jobs to run at the same time if not specified. */
+static size_t
+default_job_count(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  if (count > 0) return (size_t)count;
+#endif
+  return 1;
+}
 
+/** Compile each of the `count` files in `file_names` into the
+ * corresponding file in `object_files` as in `compile_file()`,
+ * each in its own process, with at most `max_jobs` running at the same time.
+ *  Returns the first error code, after all of them have finished. */
+static int
+compile_files(char* const file_names[], char* const object_files[],
+              char* const targets[], size_t count, size_t max_jobs,
+              const char* cmd, mut_IncludeContext_p context, Build_p build)
+{
   int return_code = EXIT_SUCCESS;
 
-  mut_Marker_array markers = init_Marker_array(8192);
-  auto destruct_Marker_array(&markers);
+  mut_Job_array jobs = init_Job_array(max_jobs);
+  auto destruct_Job_array(&jobs);
 
-  mut_Byte_array src = {0};
-  auto destruct_Byte_array(&src);
-  int err = read_file(&src, file_name);
-  if (err) {
-    print_file_error(err, file_name, src.len);
-    return err;
-  } else {
-    Byte_array_mut_slice region = bounds_of_Byte_array(&src);
-    region.start_p = parse_skip_until_cedro_pragma(&src, region, &markers,
-                                                   &options);
-    Byte_p parse_end = parse(&src, region, &markers, false);
-    if (parse_end is_not region.end_p) {
-      if (fprintf(cc_stdin, "#line %zu \"%s\"\n#error %s\n",
-                  original_line_number((size_t)(parse_end - src.start), &src),
-                  file_name,
-                  error_buffer) < 0) {
-        eprintln(LANG("error al escribir la directiva #line",
-                      "error when writing #line directive"));
-      }
-      error_buffer[0] = 0;
+  for (size_t i = 0; i is_not count; ++i) {
+    while (jobs.len >= max_jobs) {
+      int err = wait_for_job(&jobs);
+      if (return_code is EXIT_SUCCESS) return_code = err;
     }
-
-    if (options.enable_embed_directive and options.embed_as_string) {
-      err = prepare_binary_embedding(&markers, &src, file_name);
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid is 0) {
+      exit(compile_file(file_names[i], cmd, object_files[i], targets[i],
+                        context, build));
+    } else if (pid is -1) {
+      // Could not start a new process: do it in this one.
+      int err = compile_file(file_names[i], cmd, object_files[i], targets[i],
+                             context, build);
       if (err) {
-        eprintln("#line %zu \"%s\"\n#error %s\n",
-                 original_line_number((size_t)(parse_end - src.start), &src),
-                 file_name,
-                 error_buffer);
-        return 73;
-      }
-    }
-
-    if (context->level is_not 0) {
-      if (markers.len is 1) {
-        // Included file is not a Cedro file.
-        return -1;
-      } else {
-        // Does not depend on options.insert_line_directives
-        // because it does not cause syntax problems
-        // as it is right at the beginning of an input file.
-        fprintf(cc_stdin, "\n#line %zu \"%s\"\n",
-                original_line_number((size_t)(region.start_p - src.start),
-                                     &src),
-            file_name);
+        eprintln(LANG("Error %d al compilar %s",
+                      "Error %d when compiling %s"),
+                 err, file_names[i]);
+        if (return_code is EXIT_SUCCESS) return_code = err;
       }
+    } else {
+      push_Job_array(&jobs, (Job){ .pid = pid, .file_name = file_names[i] });
     }
+  }
+  while (jobs.len) {
+    int err = wait_for_job(&jobs);
+    if (return_code is EXIT_SUCCESS) return_code = err;
+  }
 
-    size_t original_src_len = src.len;
+  return return_code;
+}
 
-    Macro_p macro = macros;
-    while (macro->name and macro->function) {
-      macro->function(&markers, &src);
-      ++macro;
-    }
+/** Compile `file_name` several times, giving the expanded code
+ * to the compiler alternately through a pipe and through an anonymous file,
+ * and print the average wall time for each.
+ * The cache is not used, and the object file is discarded. */
+static int
+benchmark_handoff(const char* file_name, const char* cmd,
+                  mut_IncludeContext_p context, Build_p build)
+{
+  const size_t repetitions = 10;
+  mut_Build settings = *build;
+  settings.cache = NULL;
+  settings.dependency_option = NULL;
+  settings.passthrough = false;
 
-    fflush(stderr);
-    fflush(stdout);
+  double pipe_time = 0.0, memfd_time = 0.0;
+  for (size_t i = 0; i is_not repetitions; ++i) {
+    settings.use_memfd = false;
+    double start = wall_time();
+    int err = compile_file(file_name, cmd, "/dev/null", "/dev/null",
+                           context, &settings);
+    pipe_time += wall_time() - start;
+    if (err) return err;
 
-    IncludeCallback include = {
-      &include_callback,
-      context
-    };
-    mut_Replacement_array replacements = {0};
-    unparse_fragment(markers.start, end_of_Marker_array(&markers), 0,
-                     &src, original_src_len,
-                     file_name, &include,
-                     &replacements, false,
-                     options, cc_stdin);
-    destruct_Replacement_array(&replacements);
+    settings.use_memfd = true;
+    start = wall_time();
+    err = compile_file(file_name, cmd, "/dev/null", "/dev/null",
+                       context, &settings);
+    memfd_time += wall_time() - start;
+    if (err) return err;
 
-    if (error_buffer[0]) {
-      fprintf(cc_stdin, "\n#error %s\n", error_buffer);
-      error_buffer[0] = 0;
-    }
+    fputc('.', stderr);
   }
+  fputc('\n', stderr);
+  eprintln(LANG("tubería: %.1fms, memfd: %.1fms para %s",
+                "pipe: %.1fms, memfd: %.1fms for %s"),
+           pipe_time  * 1000.0 / (double)repetitions,
+           memfd_time * 1000.0 / (double)repetitions,
+           file_name);
 
-  return return_code;
+  return EXIT_SUCCESS;
 }
 
 static const char* const
 usage_es =
-    "Uso: cedrocc [opciones] <fichero.c> [<fichero2.o>…]\n"
-    "  Ejecuta Cedro en el primer nombre de fichero que acabe en «.c»,\n"
+    "Uso: cedrocc [opciones] <fichero.c> [<fichero2.c>…] [<fichero3.o>…]\n"
+    "  Ejecuta Cedro en cada nombre de fichero que acabe en «.c»,\n"
     " y compila el resultado con «%s» mas los otros argumentos.\n"
     "    cedrocc -o fichero fichero.c\n"
     "    cedro fichero.c | cc -x c - -o fichero\n"
+    "  Con varios ficheros «.c», los compila en paralelo, cada uno a su\n"
+    " fichero objeto con «-c», o si no a ficheros temporales que luego\n"
+    " se enlazan con el primero.\n"
+    "    --cedro:jobs=N Número máximo de compilaciones simultáneas.\n"
+    "                   Por omisión, el número de procesadores.\n"
     "  Las opciones se pasan tal cual al compilador, excepto las que\n"
     " empiecen con «--cedro:…» que corresponden a opciones de cedro,\n"
     " por ejemplo «--cedro:escape-ucn» es como «cedro --escape-ucn».\n"
@@ -384,6 +2145,37 @@ usage_es =
     "  Además, para cada `#include`, si encuentra el fichero lo lee y\n"
     " si encuentra `#pragma Cedro 1.0` lo procesa e inserta el resultado\n"
     " en lugar del `#include`.\n"
+    "  Si no se usa la caché, los ficheros «.c» sin ese `#pragma` se\n"
+    " compilan directamente, sin pasar por Cedro, si `CEDRO_CC` tiene\n"
+    " un argumento «-» para usar `stdin` que se pueda sustituir por\n"
+    " el nombre del fichero. «--cedro:no-passthrough» lo desactiva.\n"
+    "  Con «--cedro:prefetch-includes», los ficheros Cedro incluidos\n"
+    " desde el principal se procesan por adelantado en paralelo, hasta\n"
+    " «--cedro:jobs» a la vez, mientras se procesa el principal.\n"
+    "  Con «-MD» o «-MMD», el fichero de dependencias incluye también\n"
+    " los ficheros leídos por Cedro, como los de `#embed`.\n"
+    "\n"
+    "  Si la variable de entorno CEDRO_CACHE_DIR indica un directorio,\n"
+    " o con la opción «--cedro:cache» (directorio implícito ~/.cache/cedro),\n"
+    " guarda ahí el código expandido, y el fichero objeto si se compila con\n"
+    " «-c -o fichero.o», para reutilizarlos mientras no cambien el fichero,\n"
+    " sus dependencias, las opciones, ni el compilador.\n"
+    "  También guarda los tokens de cada fichero Cedro, para no tener que\n"
+    " volver a analizarlo si se incluye desde otro fichero.\n"
+    "    CEDRO_CACHE_SIZE=512 Tamaño máximo en MiB. Al superarlo se eliminan\n"
+    "                         los ficheros usados menos recientemente.\n"
+    "    --cedro:no-cache     Desactiva la caché.\n"
+    "    --cedro:cache-stats  Muestra los aciertos, fallos y tamaño.\n"
+    "\n"
+    "  El código expandido se pasa al compilador por una tubería, o con\n"
+    " «--cedro:memfd» en un fichero anónimo en memoria que puede leer\n"
+    " a toda velocidad. «--cedro:benchmark» compila cada fichero varias\n"
+    " veces de las dos maneras y muestra el tiempo medio de cada una.\n"
+    "\n"
+    "  «--cedro:trace=fichero.json» escribe el tiempo de cada fase:\n"
+    " include, parse, cada macro, unparse_fragment, include_callback,\n"
+    " y la espera al compilador, como intervalos anidados que se pueden\n"
+    " ver en chrome://tracing o https://ui.perfetto.dev\n"
     "\n"
     "  Se puede especificar el compilador, p.ej. `gcc`:\n"
     "    CEDRO_CC='gcc -x c - -x none' cedrocc …\n"
@@ -393,11 +2185,16 @@ usage_es =
     ;
 static const char* const
 usage_en =
-    "Usage: cedrocc [options] <file.c> [<file2.o>…]\n"
-    "  Runs Cedro on the first file name that ends with “.c”,\n"
+    "Usage: cedrocc [options] <file.c> [<file2.c>…] [<file3.o>…]\n"
+    "  Runs Cedro on each file name that ends with “.c”,\n"
     " and compiles the result with “%s” plus the other arguments.\n"
     "    cedrocc -o file file.c\n"
     "    cedro file.c | cc -x c - -o file\n"
+    "  With several “.c” files, compiles them in parallel, each one to its\n"
+    " object file with “-c”, or otherwise to temporary files that then\n"
+    " get linked with the first one.\n"
+    "    --cedro:jobs=N Maximum number of simultaneous compilations.\n"
+    "                   By default, the number of processors.\n"
     "  The options get passed as is to the compiler, except for those that\n"
     " start with “--cedro:…” that correspond to cedro options,\n"
     " for instance “--cedro:escape-ucn” is like “cedro --escape-ucn”.\n"
@@ -413,6 +2210,37 @@ usage_en =
     "  In addition, for each `#include`, if it finds the file it reads it and\n"
     " if it finds `#pragma Cedro 1.0` processes it and inserts the result\n"
     " in place of the `#include`.\n"
+    "  If the cache is not used, the “.c” files without that `#pragma`\n"
+    " get compiled directly, without going through Cedro, if `CEDRO_CC` has\n"
+    " an argument “-” for `stdin` that can be replaced by the file name.\n"
+    " “--cedro:no-passthrough” disables this.\n"
+    "  With “--cedro:prefetch-includes”, the Cedro files included\n"
+    " from the main one get processed in advance in parallel, up to\n"
+    " “--cedro:jobs” at a time, while processing the main one.\n"
+    "  With “-MD” or “-MMD”, the dependency file includes also\n"
+    " the files read by Cedro, such as those from `#embed`.\n"
+    "\n"
+    "  If the environment variable CEDRO_CACHE_DIR names a directory,\n"
+    " or with the option “--cedro:cache” (default directory ~/.cache/cedro),\n"
+    " it stores there the expanded code, and the object file when compiling\n"
+    " with “-c -o file.o”, to reuse them as long as neither the file,\n"
+    " its dependencies, the options, nor the compiler change.\n"
+    "  It also stores the tokens of each Cedro file, so that it does not\n"
+    " need to parse it again when included from another file.\n"
+    "    CEDRO_CACHE_SIZE=512 Maximum size in MiB. When exceeded, the least\n"
+    "                         recently used files get deleted.\n"
+    "    --cedro:no-cache     Disables the cache.\n"
+    "    --cedro:cache-stats  Shows the hits, misses, and size.\n"
+    "\n"
+    "  The expanded code goes to the compiler through a pipe, or with\n"
+    " “--cedro:memfd” in an anonymous file in memory that it can read\n"
+    " at full speed. “--cedro:benchmark” compiles each file several\n"
+    " times both ways and shows the average time for each one.\n"
+    "\n"
+    "  “--cedro:trace=file.json” writes the time taken by each phase:\n"
+    " include, parse, each macro, unparse_fragment, include_callback,\n"
+    " and the wait for the compiler, as nested spans that can be viewed\n"
+    " in chrome://tracing or https://ui.perfetto.dev\n"
     "\n"
     "  You can specify the compiler, e.g. `gcc`:\n"
     "    CEDRO_CC='gcc -x c - -x none' cedrocc …\n"
@@ -435,27 +2263,65 @@ int main(int argc, char* argv[])
     cc = "cc -x c - -x none";
   }
 
-  char* file_name = NULL;
-
   mut_IncludeContext include_context = (mut_IncludeContext){
-    .paths       = init_IncludePaths(10),
-    .paths_quote = init_IncludePaths(10)
+    .paths        = init_IncludePaths(10),
+    .paths_quote  = init_IncludePaths(10),
+    .dependencies = init_IncludePaths(10)
   };
   auto destruct_IncludePaths(&include_context.paths);
   auto destruct_IncludePaths(&include_context.paths_quote);
+  auto destruct_IncludePaths(&include_context.dependencies);
 
+  char* cache_dir = getenv("CEDRO_CACHE_DIR");
+  bool use_cache = cache_dir and cache_dir[0];
+  bool print_cache_statistics = false;
+  bool use_memfd = false;
+  bool passthrough = true;
+  bool prefetch_includes = false;
+  bool run_benchmark = false;
+  // Object files get cached only for `-c -o file.o`, and not if the
+  // compiler is already writing a dependency file with `-M…`.
+  bool compile_only = false;
+  bool dependency_options = false;
+  char* output_file = NULL;
+  // `-MD`/`-MMD` are handled here to include the files read by Cedro.
+  // The options that modify them get passed to the compiler
+  // if given without those, for instance with `-M`.
+  const char* dependency_option = NULL;
+  const char* dependency_file = NULL;
+  mut_Byte_array dependency_targets = {0};
+  auto destruct_Byte_array(&dependency_targets);
+  bool phony_targets = false;
+  char** dependency_args = malloc(sizeof(char*) * (size_t)argc);
+  auto free(dependency_args);
+  int dependency_args_len = 0;
+  size_t max_jobs = default_job_count();
+
+  // The .c file names, in the order given.
+  char** file_names = malloc(sizeof(char*) * (size_t)argc);
+  auto free(file_names);
+  size_t file_count = 0;
   // The number of arguments is either the same if no .c file name given,
-  // or one less when extracting the .c file name.
+  // or one less when extracting the first .c file name.
+  // The others stay in place, to be replaced by their object files
+  // when linking.
   char** args = malloc(sizeof(char*) * (size_t)argc);
   auto free(args);
   int i = 0;
   args[i++] = cc;
+  // Same as `args` but without .c file names, `-c`, or `-o`,
+  // to compile each .c file on its own.
+  char** compile_args = malloc(sizeof(char*) * (size_t)argc);
+  auto free(compile_args);
+  int compile_args_len = 0;
+  compile_args[compile_args_len++] = cc;
   for (int j = 1; j < argc; ++j) {
     char* arg = argv[j];
-    if (not file_name and arg[0] is_not '-') {
+    if (arg[0] is_not '-') {
       char* extension = strrchr(arg, '.');
       if (extension and str_eq(extension, ".c")) {
-        file_name = arg;
+        file_names[file_count++] = arg;
+        if (file_count is_not 1) args[i++] = arg;
         continue;
       }
     }
@@ -526,6 +2392,15 @@ int main(int argc, char* argv[])
         } else {
           options.embed_as_string = (size_t)value;
         }
+      } else if (strn_eq("--cedro:jobs=", arg, strlen("--cedro:jobs="))) {
+        char* end = arg + strlen("--cedro:jobs=");
+        long value = strtol(end, &end, 10);
+        if (errno or end is_not arg + strlen(arg) or value < 1) {
+          eprintln("#error Value must be a positive integer: %s\n", arg);
+          return 12;
+        } else {
+          max_jobs = (size_t)value;
+        }
       } else if (str_eq("--cedro:defer-instead-of-auto", arg) or
                  str_eq("--cedro:no-defer-instead-of-auto", arg)) {
         eprintln(LANG("Error: la opción «%s» está obsoleta,\n"
@@ -534,6 +2409,31 @@ int main(int argc, char* argv[])
                       "       use `#pragma Cedro 1.0 defer`."),
                  arg);
         return 13;
+      } else if (str_eq("--cedro:cache", arg) or
+                 str_eq("--cedro:no-cache", arg)) {
+        use_cache = flag_value;
+      } else if (str_eq("--cedro:cache-stats", arg)) {
+        print_cache_statistics = true;
+      } else if (str_eq("--cedro:memfd", arg) or
+                 str_eq("--cedro:no-memfd", arg)) {
+        use_memfd = flag_value;
+      } else if (str_eq("--cedro:passthrough", arg) or
+                 str_eq("--cedro:no-passthrough", arg)) {
+        passthrough = flag_value;
+      } else if (str_eq("--cedro:prefetch-includes", arg) or
+                 str_eq("--cedro:no-prefetch-includes", arg)) {
+        prefetch_includes = flag_value;
+      } else if (str_eq("--cedro:benchmark", arg)) {
+        run_benchmark = true;
+      } else if (strn_eq("--cedro:trace=", arg, strlen("--cedro:trace="))) {
+        const char* trace_file = arg + strlen("--cedro:trace=");
+        if (trace_fd is_not -1) close(trace_fd);
+        trace_fd = open(trace_file, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+                        0666);
+        if (trace_fd is -1 or write(trace_fd, "[\n", 2) is_not 2) {
+          perror(trace_file);
+          return errno;
+        }
       } else if (str_eq("--cedro:version", arg)) {
         eprintln(CEDRO_VERSION);
         return EXIT_SUCCESS;
@@ -556,7 +2456,8 @@ int main(int argc, char* argv[])
                  arg);
         return EINVAL;
       }
-      append_path(&include_context.paths, path, strlen(path));
+      // Searched from the last one, so that the first -I wins as in cc.
+      prepend_path(&include_context.paths, path, strlen(path));
     } else if (str_eq(arg, "-iquote")) {
       char* path = (j + 1 < argc)? argv[j + 1]: "";
       if (path[0] is '\0' or path[0] is '-') {
@@ -565,61 +2466,223 @@ int main(int argc, char* argv[])
                  arg);
         return EINVAL;
       }
-      append_path(&include_context.paths_quote, path, strlen(path));
+      prepend_path(&include_context.paths_quote, path, strlen(path));
+    } else if (str_eq(arg, "-c")) {
+      compile_only = true;
+      args[i++] = arg;
+      continue;
+    } else if (strn_eq(arg, "-o", 2)) {
+      output_file = arg[2]? arg + 2: (j + 1 < argc)? argv[j + 1]: NULL;
+      args[i++] = arg;
+      if (not arg[2] and output_file) args[i++] = argv[++j];
+      continue;
+    } else if (str_eq(arg, "-MD") or str_eq(arg, "-MMD")) {
+      dependency_option = arg;
+      continue;
+    } else if (strn_eq(arg, "-MF", 3)) {
+      dependency_args[dependency_args_len++] = arg;
+      if (not arg[3] and j + 1 < argc) {
+        dependency_args[dependency_args_len++] = argv[++j];
+      }
+      dependency_file = arg[3]? arg + 3: argv[j];
+      continue;
+    } else if (strn_eq(arg, "-MT", 3) or strn_eq(arg, "-MQ", 3)) {
+      dependency_args[dependency_args_len++] = arg;
+      if (not arg[3] and j + 1 < argc) {
+        dependency_args[dependency_args_len++] = argv[++j];
+      }
+      const char* target = arg[3]? arg + 3: argv[j];
+      if (dependency_targets.len) push_str(&dependency_targets, " ");
+      if (arg[2] is 'Q') push_make_quoted(&dependency_targets, target);
+      else               push_str        (&dependency_targets, target);
+      continue;
+    } else if (str_eq(arg, "-MP")) {
+      dependency_args[dependency_args_len++] = arg;
+      phony_targets = true;
+      continue;
+    } else if (strn_eq(arg, "-M", 2)) {
+      dependency_options = true;
     }
     args[i++] = arg;
+    compile_args[compile_args_len++] = arg;
+  }
+  if (not dependency_option) {
+    for (int j = 0; j < dependency_args_len; ++j) {
+      args[i++] = compile_args[compile_args_len++] = dependency_args[j];
+    }
   }
   assert(i <= argc);
 
-  if (not file_name) {
+  mut_Cache cache = { .dir = {0} };
+  auto destruct_Cache(&cache);
+  if (use_cache or print_cache_statistics) {
+    mut_Byte_array default_cache_dir = {0};
+    auto destruct_Byte_array(&default_cache_dir);
+    if (not (cache_dir and cache_dir[0])) {
+      char* xdg_cache_home = getenv("XDG_CACHE_HOME");
+      char* home           = getenv("HOME");
+      if      (xdg_cache_home and xdg_cache_home[0]) {
+        push_fmt(&default_cache_dir, "%s/cedro", xdg_cache_home);
+      } else if (home and home[0]) {
+        push_fmt(&default_cache_dir, "%s/.cache/cedro", home);
+      } else {
+        push_str(&default_cache_dir, ".cedro-cache");
+      }
+      cache_dir = (char*)as_c_string(&default_cache_dir);
+    }
+    use_cache = init_Cache(&cache, cache_dir, cc) and use_cache;
+    if (print_cache_statistics) {
+      print_cache_stats(&cache);
+      if (file_count is 0) return EXIT_SUCCESS;
+    }
+  }
+
+  if (file_count is 0) {
     eprintln(LANG("Falta el nombre de fichero.", "Missing file name."));
     return ENOENT;
   }
+  if (compile_only and output_file and file_count is_not 1) {
+    eprintln(LANG("Error: no se puede usar -o con -c y varios ficheros.",
+                  "Error: can not use -o with -c and several files."));
+    return EINVAL;
+  }
+  if (dependency_option and dependency_file and file_count is_not 1) {
+    eprintln(LANG("Error: no se puede usar -MF con varios ficheros.",
+                  "Error: can not use -MF with several files."));
+    return EINVAL;
+  }
 
-  const char* file_dir_name_end = strrchr(file_name, '/');
-  if (file_dir_name_end) {
-    prepend_path(&include_context.paths_quote,
-                 file_name,
-                 (size_t)(file_dir_name_end - file_name));
+  if (prefetch_includes) include_context.prefetch_jobs = max_jobs;
+  if (use_cache) include_context.token_cache = as_c_string(&cache.dir);
+
+  // Compiler and options without the file names nor `-o`.
+  mut_Byte_array compile_cmd = {0};
+  auto destruct_Byte_array(&compile_cmd);
+  for (int j = 0; j < compile_args_len; ++j) {
+    if (j is_not 0) push_str(&compile_cmd, " ");
+    push_str(&compile_cmd, compile_args[j]);
   }
 
-  if (cc[0] is_not 0) { // Only add options if `cc` is not "".
+  Build build = {
+    .cc                 = cc,
+    .cache_cmd          = as_c_string(&compile_cmd),
+    .options            = options,
+    .cache              = use_cache? &cache: NULL,
+    .cache_objects      = not dependency_options,
+    .dependency_option  = dependency_option,
+    .dependency_file    = dependency_file,
+    .dependency_targets = dependency_targets,
+    .phony_targets      = phony_targets,
+    .use_memfd          = use_memfd,
+    .passthrough        = passthrough
+  };
+
+  if (cc[0] is 0) { // Only add options if `cc` is not "".
+    for (size_t k = 0; k is_not file_count; ++k) {
+      int err = compile_file(file_names[k], NULL, NULL, NULL,
+                             &include_context, &build);
+      if (return_code is EXIT_SUCCESS) return_code = err;
+    }
+  } else {
     mut_Byte_array cmd = {0};
     auto destruct_Byte_array(&cmd);
 
-    for (int j = 0; j < i; ++j) {
-      if (j is_not 0) push_str(&cmd, " ");
-      push_str(&cmd, args[j]);
+    // For each .c file, the object file name as seen by `make`,
+    // and the actual object file: the same for `-c`,
+    // or a temporary one to link with the first .c file, which has none.
+    mut_Byte_array names = {0};
+    auto destruct_Byte_array(&names);
+    mut_size_t_array name_offsets = init_size_t_array(2 * file_count);
+    auto destruct_size_t_array(&name_offsets);
+    char** targets = malloc(sizeof(char*) * file_count);
+    auto free(targets);
+    char** object_files = malloc(sizeof(char*) * file_count);
+    auto free(object_files);
+    const char* tmp_dir = temporary_directory();
+    for (size_t k = 0; k is_not file_count; ++k) {
+      push_size_t_array(&name_offsets, names.len);
+      if (compile_only and output_file) {
+        push_str(&names, output_file);
+      } else {
+        const char* base_name = strrchr(file_names[k], '/');
+        push_with_extension(&names, base_name? base_name + 1: file_names[k],
+                            ".o");
+      }
+      push_Byte_array(&names, '\0');
+      push_size_t_array(&name_offsets, names.len);
+      if (not compile_only and k is_not 0) {
+        push_fmt(&names, "%s/cedrocc-XXXXXX", tmp_dir);
+      }
+      push_Byte_array(&names, '\0');
     }
-    if (file_dir_name_end) {
-      push_str(&cmd, " -iquote ");
-      append_Byte_array(&cmd, (Byte_array_slice){
-          B(file_name), B(file_dir_name_end)
-        });
+    for (size_t k = 0; k is_not file_count; ++k) {
+      targets[k] = (char*)get_mut_Byte_array(
+          &names, *get_size_t_array(&name_offsets, 2 * k));
+      object_files[k] = compile_only? targets[k]:
+          k is 0? NULL:
+          (char*)get_mut_Byte_array(
+              &names, *get_size_t_array(&name_offsets, 2 * k + 1));
     }
 
-    FILE* cc_stdin = popen(as_c_string(&cmd), "w");
-    if (cc_stdin) {
-      return_code = include(file_name, cc_stdin, &include_context, options);
-      if (return_code is_not EXIT_SUCCESS) {
-        pclose(cc_stdin);
+    if (run_benchmark) {
+      for (size_t k = 0; k is_not file_count; ++k) {
+        return_code = benchmark_handoff(file_names[k],
+                                        as_c_string(&compile_cmd),
+                                        &include_context, &build);
+        if (return_code) break;
+      }
+    } else if (compile_only) {
+      if (file_count is 1) {
+        return_code = compile_file(file_names[0], as_c_string(&compile_cmd),
+                                   object_files[0], targets[0],
+                                   &include_context, &build);
       } else {
-        return_code = pclose(cc_stdin);
-        // https://www.man7.org/linux/man-pages/man3/wait.3p.html
-        if (WIFEXITED(return_code)) return_code = WEXITSTATUS(return_code);
-        else if (WIFSIGNALED(return_code)) return_code = 111;
-        else if (WIFSTOPPED (return_code)) return_code = 112;
-        else                               return_code = 113;
+        return_code = compile_files(file_names, object_files, targets,
+                                    file_count, max_jobs,
+                                    as_c_string(&compile_cmd),
+                                    &include_context, &build);
       }
     } else {
-      perror(as_c_string(&cmd));
-      return_code = errno;
+      // Compile the other files first, then compile the first one
+      // linking it with their object files.
+      size_t temporary_count = 0;
+      for (size_t k = 1; k is_not file_count; ++k) {
+        int fd = mkstemp(object_files[k]);
+        if (fd is -1) {
+          return_code = errno;
+          perror(object_files[k]);
+          break;
+        }
+        close(fd);
+        ++temporary_count;
+      }
+      if (return_code is EXIT_SUCCESS) {
+        return_code = compile_files(file_names + 1, object_files + 1,
+                                    targets + 1, file_count - 1, max_jobs,
+                                    as_c_string(&compile_cmd),
+                                    &include_context, &build);
+      }
+      if (return_code is EXIT_SUCCESS) {
+        for (int j = 0; j < i; ++j) {
+          if (j is_not 0) push_str(&cmd, " ");
+          const char* arg = args[j];
+          for (size_t k = 1; k is_not file_count; ++k) {
+            if (arg is file_names[k]) arg = object_files[k];
+          }
+          push_str(&cmd, arg);
+        }
+        return_code = compile_file(file_names[0], as_c_string(&cmd),
+                                   NULL, targets[0],
+                                   &include_context, &build);
+      }
+      for (size_t k = 1; k is_not 1 + temporary_count; ++k) {
+        remove(object_files[k]);
+      }
     }
-  } else {
-    return_code = include(file_name, stdout, &include_context, options);
   }
 
   fflush(stdout);
+  if (trace_fd is_not -1) close(trace_fd);
 
   return return_code;
 }
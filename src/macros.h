@@ -3,7 +3,7 @@
 #include "macros/defer.h"
 #include "macros/slice.h"
 #else
-#define MACRO(name) { (MacroFunction_p) macro_##name, #name }
+#define MACRO(name) { (MacroFunction_p) macro_##name, #name, name##_triggers }
 MACRO(backstitch),
 MACRO(defer),
 MACRO(slice),
@@ -1,8 +1,12 @@
 /* -*- coding: utf-8 c-basic-offset: 2 tab-width: 2 indent-tabs-mode: nil -*-
  * vi: set et ts=2 sw=2: */
+/// Tokens that trigger `macro_backstitch()`.
+static TokenType backstitch_triggers[] = { T_BACKSTITCH, T_NONE };
+
 /// Reorganize `obj @ fn1(a), fn2(b)` as `fn1(obj, a), fn2(obj, b)`.
 static void
-macro_backstitch(mut_Marker_array_p markers, mut_Byte_array_p src)
+macro_backstitch(mut_Marker_array_p markers, mut_Byte_array_p src,
+                 Options_p options, Arena* arena)
 {
   Marker_mut_p start  = start_of_Marker_array(markers);
   Marker_mut_p cursor = start;
@@ -19,7 +23,9 @@ macro_backstitch(mut_Marker_array_p markers, mut_Byte_array_p src)
   Marker_array_mut_slice object;
   Marker_array_mut_slice slice;
 
-  mut_Marker_array replacement = init_Marker_array(30);
+  mut_Marker_small_array_buffer replacement_inline;
+  mut_Marker_array replacement =
+      init_Marker_small_array(&replacement_inline);
 
   while (cursor is_not end) {
     if (cursor->token_type is T_BACKSTITCH) {
@@ -30,7 +36,7 @@ macro_backstitch(mut_Marker_array_p markers, mut_Byte_array_p src)
       if (first_segment_start is end) {
         error_at(LANG("macro pespunte incompleto.",
                       "unfinished backstitch macro."),
-                 cursor, markers, src);
+                 cursor, markers, src, options);
         return;
       }
       Marker_mut_p prefix = NULL, suffix = NULL;
@@ -39,7 +45,7 @@ macro_backstitch(mut_Marker_array_p markers, mut_Byte_array_p src)
         if (first_segment_start is end) {
           error_at(LANG("declarador afijo incompleto.",
                         "unfinished affix declarator."),
-                   cursor, markers, src);
+                   cursor, markers, src, options);
           return;
         }
         if ((first_segment_start - 1)->token_type is_not T_ELLIPSIS) {
@@ -49,7 +55,7 @@ macro_backstitch(mut_Marker_array_p markers, mut_Byte_array_p src)
           if (first_segment_start->token_type is_not T_IDENTIFIER) {
             error_at(LANG("prefijo no válido, debe ser un identificador.",
                           "invalid suffix, must be an identifier."),
-                     cursor, markers, src);
+                     cursor, markers, src, options);
             return;
           }
           suffix = first_segment_start++;
@@ -66,7 +72,7 @@ macro_backstitch(mut_Marker_array_p markers, mut_Byte_array_p src)
       }
       Marker_mut_p start_of_line = find_line_start(cursor, start, &err);
       if (err.message) {
-        error_at(err.message, err.position, markers, src);
+        error_at(err.message, err.position, markers, src, options);
         err.message = NULL;
       } else {
         mut_Marker object_indentation =
@@ -109,7 +115,7 @@ macro_backstitch(mut_Marker_array_p markers, mut_Byte_array_p src)
         Marker_mut_p end_of_line =
             find_line_end(first_segment_start, end, &err);
         if (err.message) {
-          error_at(err.message, err.position, markers, src);
+          error_at(err.message, err.position, markers, src, options);
           err.message = NULL;
         } else {
           if (first_segment_start->token_type is T_COMMA) {
@@ -132,7 +138,7 @@ macro_backstitch(mut_Marker_array_p markers, mut_Byte_array_p src)
                           " el objeto de pespunte y los segmentos.",
                           "backstitch object and segments"
                           " can not be both omitted at the same time."),
-                     cursor, markers, src);
+                     cursor, markers, src, options);
             return;
           }
 
@@ -170,7 +176,7 @@ macro_backstitch(mut_Marker_array_p markers, mut_Byte_array_p src)
                   if (nesting) break; // Allow nested backstitch application.
                   error_at(LANG("prefijo no válido, debe ser un identificador.",
                                 "invalid prefix, must be an identifier."),
-                           cursor, markers, src);
+                           cursor, markers, src, options);
                   destruct_Marker_array(&replacement);
                   return;
                   //break;
@@ -182,7 +188,7 @@ macro_backstitch(mut_Marker_array_p markers, mut_Byte_array_p src)
             if (nesting) {
               error_at(LANG("error sintáctico, grupo sin cerrar.",
                             "unclosed group, syntax error."),
-                       cursor, markers, src);
+                       cursor, markers, src, options);
               destruct_Marker_array(&replacement);
               return;
             }
@@ -245,7 +251,7 @@ macro_backstitch(mut_Marker_array_p markers, mut_Byte_array_p src)
                                 " con un identificador.",
                                 "the (pseudo-)object must start"
                                 " with an identifier."),
-                           cursor, markers, src);
+                           cursor, markers, src, options);
                   destruct_Marker_array(&replacement);
                   return;
                 }
@@ -272,7 +278,7 @@ macro_backstitch(mut_Marker_array_p markers, mut_Byte_array_p src)
               if (slice.start_p > slice.end_p) {
                 error_at(LANG("falta el objeto.",
                               "missing object."),
-                         cursor, markers, src);
+                         cursor, markers, src, options);
                 destruct_Marker_array(&replacement);
                 return;
               }
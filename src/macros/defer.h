@@ -1,12 +1,33 @@
 /* -*- coding: utf-8 c-basic-offset: 2 tab-width: 2 indent-tabs-mode: nil -*-
  * vi: set et ts=2 sw=2: */
+/// Tokens that trigger `macro_defer()`, which also moves the labels of loops.
+static TokenType defer_triggers[] = {
+  T_CONTROL_FLOW_DEFER, T_LABEL_COLON, T_NONE
+};
+
 /// Simple `defer`-style functionality using the `auto` keyword.
+///
+/// By default, the pending deferred actions get copied before each
+/// `return`, `break`, `continue`, and `goto` that leaves their block,
+/// and so for `return` they run before evaluating the returned value.
+/// With `#pragma Cedro 1.0 goto-ladder`, `return` instead stores
+/// the value in `cedro_result` and jumps to a ladder of labels
+/// at the end of the blocks, so the value gets evaluated first,
+/// before the deferred actions, as in Go.
+/// Functions that might declare variable length arrays,
+/// see `may_declare_vla()`, and those whose return type can not
+/// be copied into a variable, keep the default lowering.
 static void
-macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src);
+macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src,
+            Options_p options, Arena* arena);
 
 typedef struct DeferredAction {
   size_t level;
   mut_Marker_array action;
+  /// Number for its label in the goto ladder.
+  size_t label;
+  /// Whether some `return` jumps to its label in the goto ladder.
+  bool targeted;
 } MUT_CONST_TYPE_VARIANTS(DeferredAction);
 
 /* Stack of pending deferred actions. */
@@ -45,13 +66,27 @@ is_newline_marker(Marker m)
   return m.len is 0 and m.token_type is T_NONE;
 }
 
+/** Marker for the label `cedro_defer_N` of the deferred action number `N`
+ * in the goto ladder. */
+static Marker
+ladder_label(size_t number, TokenType token_type, mut_Byte_array_p src)
+{
+  char label[32];
+  snprintf(label, sizeof(label), "cedro_defer_%zu", number);
+  return Marker_from(src, label, token_type);
+}
+
 /** Insert actions backwards up to and including the given level.
+    If `ladder_src` is not `NULL`, put the label of the goto ladder
+    before each action that is the target of some jump.
+    The temporary arrays come from `arena`, or `malloc()` if `NULL`.
     Returns the number of tokens inserted. */
 static size_t
 insert_deferred_actions(DeferredAction_array_p pending, size_t level,
                         Marker_array_slice line,
                         Marker indentation, Marker extra_indentation,
-                        size_t cursor, mut_Marker_array_p markers)
+                        size_t cursor, mut_Marker_array_p markers,
+                        mut_Byte_array_p ladder_src, Arena* arena)
 {
   mut_Marker between[2] = { indentation, extra_indentation };
 
@@ -75,7 +110,16 @@ insert_deferred_actions(DeferredAction_array_p pending, size_t level,
         bounds_of_Marker_array(&actions_cursor->action);
 
     mut_Marker_array action_indented =
-        init_Marker_array(actions_cursor->action.len + 10);
+        init_Marker_array_in(arena, actions_cursor->action.len + 10);
+    if (ladder_src and actions_cursor->targeted) {
+      push_Marker_array(&action_indented,
+                        ladder_label(actions_cursor->label,
+                                     T_CONTROL_FLOW_LABEL, ladder_src));
+      push_Marker_array(&action_indented,
+                        Marker_from(ladder_src, ":", T_LABEL_COLON));
+      push_Marker_array(&action_indented,
+                        Marker_from(ladder_src, " ", T_SPACE));
+    }
     for (Marker_mut_p p = action.start_p; p is_not action.end_p; ++p) {
       if (is_newline_marker(*p)) {
         append_Marker_array(&action_indented, indent);
@@ -98,6 +142,110 @@ insert_deferred_actions(DeferredAction_array_p pending, size_t level,
   return inserted_length;
 }
 
+/** Check whether the text of `m` is `text`. */
+static bool
+is_marker_text(Marker_p m, const char* text, Byte_array_p src)
+{
+  size_t len = strlen(text);
+  return m->len is len and mem_eq(get_Byte_array(src, m->start), text, len);
+}
+
+/** Copy into `type` the return type of the function whose name is `name`,
+    without storage class specifiers, to declare the variable
+    that keeps the return value while going through the goto ladder.
+    `is_void` gets set if the function does not return any value.
+    Returns `false` if the type can not be used for that,
+    for instance for functions that return function pointers. */
+static bool
+extract_return_type(Marker_p name, Marker_p start, mut_Marker_array_p type,
+                    bool* is_void, mut_Byte_array_p src)
+{
+  Marker space = Marker_from(src, " ", T_SPACE);
+  Marker_mut_p type_start = name;
+  while (type_start is_not start) {
+    TokenType t = (type_start-1)->token_type;
+    if (t is T_SEMICOLON or t is T_BLOCK_END or t is T_PREPROCESSOR or
+        t is T_NONE) break;
+    if (t is T_TUPLE_START or t is T_TUPLE_END or
+        t is T_INDEX_START or t is T_INDEX_END or
+        t is T_BLOCK_START or t is T_TYPEDEF) return false;
+    --type_start;
+  }
+
+  bool is_pointer = false;
+  for (Marker_mut_p m = type_start; m is_not name; ++m) {
+    if (is_marker_text(m, "*", src)) is_pointer = true;
+  }
+
+  type->len = 0;
+  size_t words = 0;
+  *is_void = false;
+  for (Marker_mut_p m = type_start; m is_not name; ++m) {
+    if (m->token_type is T_SPACE or m->token_type is T_COMMENT) continue;
+    if (is_marker_text(m, "static",    src) or
+        is_marker_text(m, "extern",    src) or
+        is_marker_text(m, "inline",    src) or
+        is_marker_text(m, "register",  src) or
+        is_marker_text(m, "_Noreturn", src)) continue;
+    // The variable must be assignable, even if the value is not.
+    if (not is_pointer and
+        (is_marker_text(m, "const",    src) or
+         is_marker_text(m, "volatile", src))) continue;
+    if (type->len is_not 0) push_Marker_array(type, space);
+    push_Marker_array(type, *m);
+    *is_void = (++words is 1 and is_marker_text(m, "void", src));
+  }
+
+  return words is_not 0;
+}
+
+/** Check whether the block that starts at `block_start`
+    might declare a variable length array:
+    the goto ladder can not be used there, because a `goto` from before
+    that declaration to a label after it, in its scope, is not allowed.
+    This looks for `[` after an identifier that follows a type,
+    a qualifier, another identifier that could be a type name,
+    `*`, or `,`, with some identifier inside the brackets.
+    It also matches some arrays of constant size, like those that use
+    enumeration constants, or some expressions, which is fine
+    because then the deferred actions just get copied as usual. */
+static bool
+may_declare_vla(Marker_p block_start, Marker_p end, Byte_array_p src)
+{
+  size_t nesting = 0;
+  for (Marker_mut_p m = block_start; m is_not end; ++m) {
+    if (m->token_type is T_BLOCK_START) {
+      ++nesting;
+    } else if (m->token_type is T_BLOCK_END) {
+      if (--nesting is 0) break;
+    } else if (m->token_type is T_INDEX_START) {
+      Marker_p name = skip_space_back(block_start, m);
+      if (name is block_start or (name-1)->token_type is_not T_IDENTIFIER) {
+        continue;
+      }
+      Marker_p type = skip_space_back(block_start, name - 1);
+      if (type is block_start) continue;
+      TokenType t = (type-1)->token_type;
+      if (t is_not T_TYPE and t is_not T_TYPE_QUALIFIER and
+          t is_not T_TYPE_STRUCT and t is_not T_IDENTIFIER and
+          t is_not T_COMMA and not is_marker_text(type-1, "*", src)) {
+        continue;
+      }
+      size_t index_nesting = 0;
+      for (Marker_mut_p i = m; i is_not end; ++i) {
+        if (i->token_type is T_INDEX_START) {
+          ++index_nesting;
+        } else if (i->token_type is T_INDEX_END) {
+          if (--index_nesting is 0) break;
+        } else if (i->token_type is T_IDENTIFIER) {
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
 /** Eliminate pending deferred actions whose level is greater or equal
     than the given level.
  */
@@ -120,7 +268,8 @@ exit_level(mut_DeferredAction_array_p pending, size_t level)
 }
 
 static void
-macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
+macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src,
+            Options_p options, Arena* arena)
 {
   Marker space       = Marker_from(src, " ", T_SPACE);
   Marker block_start = Marker_from(src, "{", T_BLOCK_START);
@@ -130,15 +279,51 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
   Marker semicolon     = Marker_from(src, ";", T_SEMICOLON);
   mut_Marker indent_one_level = { .start = 0, .len = 0, .token_type = T_NONE };
 
-  mut_TokenType_array block_stack  = init_TokenType_array(20);
-  mut_DeferredAction_array  pending     = init_DeferredAction_array(20);
+  mut_TokenType_small_array_buffer block_stack_inline;
+  mut_TokenType_array block_stack  =
+      init_TokenType_small_array(&block_stack_inline);
+  mut_DeferredAction_array pending =
+      init_DeferredAction_array_in(arena, 20);
 
   mut_Marker_mut_p cursor = start_of_mut_Marker_array(markers);
   mut_Marker_mut_p end    = end_of_mut_Marker_array(markers);
   size_t cursor_position;
 
   mut_Error err = { .position = NULL, .message = NULL };
-  mut_Marker_array marker_buffer = init_Marker_array(8);
+  mut_Marker_small_array_buffer marker_buffer_inline;
+  mut_Marker_array marker_buffer =
+      init_Marker_small_array(&marker_buffer_inline);
+
+  // Goto ladder, with `#pragma Cedro 1.0 goto-ladder`.
+  // Its markers get created only when used, to leave `src` alone otherwise.
+  bool goto_ladder = options->use_goto_ladder_for_defer;
+  mut_Marker ladder_int = {0}, ladder_flag = {0}, ladder_result = {0},
+      ladder_assign = {0}, ladder_zero = {0}, ladder_one = {0},
+      ladder_if = {0}, ladder_goto = {0}, ladder_return = {0},
+      ladder_open = {0}, ladder_close = {0};
+  if (goto_ladder) {
+    ladder_int    = Marker_from(src, "int",             T_TYPE);
+    ladder_flag   = Marker_from(src, "cedro_returning", T_IDENTIFIER);
+    ladder_result = Marker_from(src, "cedro_result",    T_IDENTIFIER);
+    ladder_assign = Marker_from(src, "=",               T_OP_14);
+    ladder_zero   = Marker_from(src, "0",               T_NUMBER);
+    ladder_one    = Marker_from(src, "1",               T_NUMBER);
+    ladder_if     = Marker_from(src, "if",              T_CONTROL_FLOW_IF);
+    ladder_goto   = Marker_from(src, "goto",            T_CONTROL_FLOW_GOTO);
+    ladder_return = Marker_from(src, "return",          T_CONTROL_FLOW_RETURN);
+    ladder_open   = Marker_from(src, "(",               T_TUPLE_START);
+    ladder_close  = Marker_from(src, ")",               T_TUPLE_END);
+  }
+  size_t label_count = 0;
+  // Position of the `{` that starts the current function body,
+  // whether its returns can go through the ladder, whether any does,
+  // and whether any of them needs the flag to keep returning
+  // after the ladder of an inner block.
+  size_t function_body = 0;
+  bool function_ladder = false, function_returns = false;
+  bool function_flag = false;
+  bool returns_void = false;
+  mut_Marker_array return_type = init_Marker_array_in(arena, 8);
 
   while (cursor is_not end) {
     if (cursor->token_type is T_BLOCK_START) {
@@ -206,8 +391,24 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
         // No need to rebase `cursor` because the array was not reallocated.
         cursor -= c - a; // Just adjust it to follow the memmove.
       }
+      if (goto_ladder and block_stack.len is 1) {
+        function_body = index_Marker_array(markers, cursor);
+        function_returns = function_flag = false;
+        // Labels have function scope, so each function can start again,
+        // which makes the result independent of the preceding functions.
+        label_count = 0;
+        function_ladder =
+            statement is_not cursor and
+            statement->token_type is T_IDENTIFIER and
+            extract_return_type(statement, start_of_mut_Marker_array(markers),
+                                &return_type, &returns_void, src) and
+            not may_declare_vla(cursor, end, src);
+      }
       ++cursor; // Move to token after T_BLOCK_START.
 
+      // Take the indentation from each top-level declaration, so that
+      // the result does not depend on what came before it.
+      if (block_stack.len is 1) indent_one_level.token_type = T_NONE;
       if (cursor is_not end and cursor->token_type is T_SPACE and
           indent_one_level.token_type is T_NONE) {
         Byte_array_slice slice = slice_for_marker(src, cursor);
@@ -239,17 +440,33 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
       // The deferred actions will have been already inserted before it.
       previous_line = find_line_start(previous_line, start, &err);
       if (err.message) goto free_all_and_return;
-      mut_Marker between = previous_line->token_type is T_SPACE?
+      // The `return` lines rewritten for the goto ladder have no line break.
+      mut_Marker between =
+          previous_line->token_type is T_SPACE and
+          (not goto_ladder or has_byte('\n', previous_line, src))?
           *previous_line:
           indentation(markers, cursor, false, src);
       between.synthetic = true;
       previous_line = skip_space_forward(previous_line, end);
+      // With the goto ladder, the actions in this level that are
+      // the target of some jump must be there even after a diversion.
+      size_t level_start = pending.len;
+      bool ladder_targeted = false;
+      while (level_start is_not 0 and
+             get_DeferredAction_array(&pending, level_start - 1)->level >=
+             block_level) {
+        --level_start;
+        if (get_DeferredAction_array(&pending, level_start)->targeted) {
+          ladder_targeted = true;
+        }
+      }
       bool need_to_insert_deferred_actions =
           (are_there_pending_deferred_actions(&pending, block_level) and
-           previous_line->token_type is_not T_CONTROL_FLOW_BREAK     and
-           previous_line->token_type is_not T_CONTROL_FLOW_CONTINUE  and
-           previous_line->token_type is_not T_CONTROL_FLOW_GOTO      and
-           previous_line->token_type is_not T_CONTROL_FLOW_RETURN);
+           (ladder_targeted or
+            (previous_line->token_type is_not T_CONTROL_FLOW_BREAK     and
+             previous_line->token_type is_not T_CONTROL_FLOW_CONTINUE  and
+             previous_line->token_type is_not T_CONTROL_FLOW_GOTO      and
+             previous_line->token_type is_not T_CONTROL_FLOW_RETURN)));
 
       if (need_to_insert_deferred_actions) {
         if (insertion_point->token_type is T_SPACE) {
@@ -261,7 +478,48 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
         insert_deferred_actions(&pending, block_level,
                                 (Marker_array_slice){0},
                                 between, indent_one_level,
-                                marker_buffer.len, &marker_buffer);
+                                marker_buffer.len, &marker_buffer,
+                                goto_ladder? src: NULL, arena);
+        // At the end of the function, return without checking the flag:
+        // falling off the end would return an undefined value anyway.
+        bool at_function_end = level_start is 0 and block_stack.len is 1;
+        if (ladder_targeted and not (at_function_end and returns_void)) {
+          // Continue returning through the ladder of the enclosing blocks,
+          // or return if there are no more pending actions.
+          mut_Marker_array_p b = &marker_buffer;
+          if (insertion_point->token_type is T_SPACE) {
+            mut_Marker line_break = *insertion_point;
+            line_break.synthetic = true;
+            push_Marker_array(b, line_break);
+            push_Marker_array(b, indent_one_level);
+          } else {
+            push_Marker_array(b, between);
+          }
+          if (not at_function_end) {
+            push_Marker_array(b, ladder_if);
+            push_Marker_array(b, space);
+            push_Marker_array(b, ladder_open);
+            push_Marker_array(b, ladder_flag);
+            push_Marker_array(b, ladder_close);
+            push_Marker_array(b, space);
+          }
+          if (level_start is_not 0) {
+            mut_DeferredAction_p outer =
+                get_mut_DeferredAction_array(&pending, level_start - 1);
+            outer->targeted = true;
+            push_Marker_array(b, ladder_goto);
+            push_Marker_array(b, space);
+            push_Marker_array(b,
+                              ladder_label(outer->label, T_IDENTIFIER, src));
+          } else {
+            push_Marker_array(b, ladder_return);
+            if (not returns_void) {
+              push_Marker_array(b, space);
+              push_Marker_array(b, ladder_result);
+            }
+          }
+          push_Marker_array(b, semicolon);
+        }
         if (insertion_point is cursor) {
           push_Marker_array(&marker_buffer, between);
         }
@@ -289,6 +547,47 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
         cursor = get_mut_Marker_array(markers, cursor_position);
       }
 
+      if (goto_ladder and block_stack.len is 1 and function_returns and
+          (function_flag or not returns_void)) {
+        // Declare the variables for the ladder at the start of the function.
+        cursor_position = index_Marker_array(markers, cursor);
+        size_t position = function_body + 1;
+        mut_Marker line_break = space;
+        if (position is_not markers->len and
+            get_Marker_array(markers, position)->token_type is T_SPACE) {
+          line_break = *get_Marker_array(markers, position);
+          line_break.synthetic = true;
+          ++position;
+        }
+        marker_buffer.len = 0;
+        mut_Marker_array_p b = &marker_buffer;
+        if (function_flag) {
+          push_Marker_array(b, ladder_int);
+          push_Marker_array(b, space);
+          push_Marker_array(b, ladder_flag);
+          push_Marker_array(b, space);
+          push_Marker_array(b, ladder_assign);
+          push_Marker_array(b, space);
+          push_Marker_array(b, ladder_zero);
+          push_Marker_array(b, semicolon);
+          push_Marker_array(b, line_break);
+        }
+        if (not returns_void) {
+          append_Marker_array(b, bounds_of_Marker_array(&return_type));
+          push_Marker_array(b, space);
+          push_Marker_array(b, ladder_result);
+          push_Marker_array(b, semicolon);
+          push_Marker_array(b, line_break);
+        }
+        // Invalidates: markers
+        splice_Marker_array(markers, position, 0, NULL,
+                            bounds_of_Marker_array(&marker_buffer));
+        cursor_position += marker_buffer.len;
+        end    = end_of_mut_Marker_array(markers);
+        cursor = get_mut_Marker_array(markers, cursor_position);
+        function_returns = function_flag = false;
+      }
+
       exit_level(&pending, block_stack.len);
       pop_TokenType_array(&block_stack, NULL);
       ++cursor;
@@ -306,7 +605,7 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
         if (block_level is 0) {
           error_at(LANG("break fuera de bloque.",
                         "break outside of block."),
-                   cursor - 1, markers, src);
+                   cursor - 1, markers, src, options);
           err.message = NULL;
           break;
         }
@@ -328,7 +627,7 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
         if (block_level is 0) {
           error_at(LANG("continue fuera de bloque.",
                         "continue outside of block."),
-                   cursor - 1, markers, src);
+                   cursor - 1, markers, src, options);
           err.message = NULL;
           break;
         }
@@ -349,7 +648,7 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
         if (block_level is 0) {
           error_at(LANG("goto fuera de bloque.",
                         "goto outside of block."),
-                   cursor - 1, markers, src);
+                   cursor - 1, markers, src, options);
           break;
         }
      handle_as_goto:;
@@ -367,12 +666,11 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
         if (not label_p) {
           error_at(LANG("goto sin etiqueta.",
                         "goto without label."),
-                   cursor - 1, markers, src);
+                   cursor - 1, markers, src, options);
           break;
         }
 
-        mut_Byte_array label = init_Byte_array(10);
-        extract_src(label_p, label_p+1, src, &label);
+        Marker label = *label_p;
 
         // Find minimum block level traversed to reach label.
         label_p = NULL;
@@ -390,7 +688,7 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
             --nesting;
             low_watermark = nesting;
           } else if (m->token_type is T_CONTROL_FLOW_LABEL and
-                     src_eq(m, &label, src)) {
+                     is_same_text(m, &label, src)) {
             label_p = m;
             break;
           }
@@ -416,7 +714,7 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
               --nesting;
               low_watermark = nesting;
             } else if (m->token_type is T_CONTROL_FLOW_LABEL and
-                       src_eq(m, &label, src)) {
+                       is_same_text(m, &label, src)) {
               label_p = m;
               break;
             }
@@ -433,7 +731,8 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
             if (backward_jump) {
               error_at(LANG("no se permiten saltos atrás con «break».",
                             "backward jumps are not allowed with “break”."),
-                       skip_space_forward(cursor + 1, end) + 1, markers, src);
+                       skip_space_forward(cursor + 1, end) + 1,
+                       markers, src, options);
               label_p = NULL;
               break;
             }
@@ -454,7 +753,8 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
                             " justo después del bucle.",
                             "the target label must be"
                             " right after the loop."),
-                       skip_space_forward(cursor + 1, end) + 1, markers, src);
+                       skip_space_forward(cursor + 1, end) + 1,
+                       markers, src, options);
               label_p = NULL;
               break;
             }
@@ -466,7 +766,8 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
             if (forward_jump) {
               error_at(LANG("no se permiten saltos adelante con «continue».",
                             "forward jumps are not allowed with “continue”."),
-                       skip_space_forward(cursor + 1, end) + 1, markers, src);
+                       skip_space_forward(cursor + 1, end) + 1,
+                       markers, src, options);
               label_p = NULL;
               break;
             }
@@ -480,7 +781,7 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
                               " justo antes del bucle.",
                               "the target label must be"
                               " right before the loop."),
-                         label_p + 1, markers, src);
+                         label_p + 1, markers, src, options);
                 label_p = NULL;
                 break;
               }
@@ -493,16 +794,15 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
         } else {
           mut_Byte_array message = {0};
           push_fmt(&message,
-                   LANG("no se encuentra la etiqueta «%s».",
-                        "label “%s” not found."),
-                   as_c_string(&label));
+                   LANG("no se encuentra la etiqueta «%.*s».",
+                        "label “%.*s” not found."),
+                   (int)label.len, get_Byte_array(src, label.start));
           error_at(as_c_string(&message),
-                   skip_space_forward(cursor + 1, end), markers, src);
+                   skip_space_forward(cursor + 1, end),
+                   markers, src, options);
           destruct_Byte_array(&message);
           break;
         }
-
-        destruct_Byte_array(&label);
       }
 
       if (not are_there_pending_deferred_actions(&pending, block_level)) {
@@ -510,17 +810,88 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
         continue;
       }
 
+      if (goto_ladder and function_ladder and
+          cursor->token_type is T_CONTROL_FLOW_RETURN) {
+        // Keep the value and jump to the innermost pending action:
+        // `cedro_result = value; cedro_returning = 1; goto cedro_defer_N;`
+        // in a block if it is the body of `if`, `else`, or a loop.
+        Marker_mut_p statement_end = find_line_end(cursor, end, &err);
+        Marker_mut_p line_start = err.message? NULL:
+            find_line_start(cursor, start_of_mut_Marker_array(markers), &err);
+        if (err.message) {
+          error_at(err.message, err.position, markers, src, options);
+          err.message = NULL;
+          break;
+        }
+        line_start = skip_space_forward(line_start, cursor);
+        bool wrap = line_start->token_type is T_CONTROL_FLOW_IF or
+            line_start->token_type is T_CONTROL_FLOW_LOOP;
+        Marker_mut_p value_start = skip_space_forward(cursor + 1,
+                                                      statement_end);
+        Marker_mut_p value_end   = skip_space_back(value_start, statement_end);
+        mut_DeferredAction_p target =
+            get_mut_DeferredAction_array(&pending, pending.len - 1);
+        target->targeted = true;
+
+        marker_buffer.len = 0;
+        mut_Marker_array_p b = &marker_buffer;
+        if (wrap) {
+          push_Marker_array(b, block_start);
+          push_Marker_array(b, space);
+        }
+        if (value_start is_not value_end) {
+          if (not returns_void) {
+            push_Marker_array(b, ladder_result);
+            push_Marker_array(b, space);
+            push_Marker_array(b, ladder_assign);
+            push_Marker_array(b, space);
+          } // Else it is something like `return f();` with `void f(void)`.
+          append_Marker_array(b, (Marker_array_slice){ value_start, value_end });
+          push_Marker_array(b, semicolon);
+          push_Marker_array(b, space);
+        }
+        if (target->level > 1) {
+          push_Marker_array(b, ladder_flag);
+          push_Marker_array(b, space);
+          push_Marker_array(b, ladder_assign);
+          push_Marker_array(b, space);
+          push_Marker_array(b, ladder_one);
+          push_Marker_array(b, semicolon);
+          push_Marker_array(b, space);
+          function_flag = true;
+        }
+        push_Marker_array(b, ladder_goto);
+        push_Marker_array(b, space);
+        push_Marker_array(b, ladder_label(target->label, T_IDENTIFIER, src));
+        push_Marker_array(b, semicolon);
+        if (wrap) {
+          push_Marker_array(b, space);
+          push_Marker_array(b, block_end);
+        }
+        function_returns = true;
+
+        cursor_position = index_Marker_array(markers, cursor);
+        // Invalidates: markers
+        splice_Marker_array(markers, cursor_position,
+                            (size_t)(statement_end + 1 - cursor), NULL,
+                            bounds_of_Marker_array(&marker_buffer));
+        cursor_position += marker_buffer.len;
+        end    = end_of_mut_Marker_array(markers);
+        cursor = get_mut_Marker_array(markers, cursor_position);
+        continue;
+      }
+
       Marker_p start = start_of_mut_Marker_array(markers);
       Marker_array_mut_slice line = { .start_p = NULL, .end_p = NULL };
       line.start_p = find_line_start(cursor, start, &err);
       if (err.message) {
-        error_at(err.message, err.position, markers, src);
+        error_at(err.message, err.position, markers, src, options);
         err.message = NULL;
         break;
       }
       line.end_p = find_line_end(cursor, end, &err);
       if (err.message) {
-        error_at(err.message, err.position, markers, src);
+        error_at(err.message, err.position, markers, src, options);
         err.message = NULL;
         break;
       }
@@ -544,7 +915,7 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
         // We need to wrap this in a block.
         line.start_p = insertion_point;
         if (err.message) {
-          error_at(err.message, err.position, markers, src);
+          error_at(err.message, err.position, markers, src, options);
           err.message = NULL;
           break;
         }
@@ -561,7 +932,8 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
         insert_deferred_actions(&pending, block_level,
                                 line,
                                 between, indent_one_level,
-                                marker_buffer.len, &marker_buffer);
+                                marker_buffer.len, &marker_buffer,
+                                NULL, arena);
         push_Marker_array(&marker_buffer, between);
         push_Marker_array(&marker_buffer, block_end);
         delete_count = len_Marker_array_slice(line);
@@ -585,7 +957,8 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
         insert_deferred_actions(&pending, block_level,
                                 (Marker_array_slice){0},
                                 between, (Marker){0},
-                                marker_buffer.len, &marker_buffer);
+                                marker_buffer.len, &marker_buffer,
+                                NULL, arena);
         delete_count = 0;
       }
 
@@ -617,7 +990,7 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
             if (not nesting) {
               error_at(LANG("demasiados cierres de paréntesis.",
                             "too many closing parenthesis."),
-                       action_end, markers, src);
+                       action_end, markers, src, options);
               goto free_all_and_return;
             }
             --nesting;
@@ -641,7 +1014,7 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
         if (action_end is_not end) ++action_end; // Include closing semicolon.
       }
       if (err.message) {
-        error_at(err.message, err.position, markers, src);
+        error_at(err.message, err.position, markers, src, options);
         err.message = NULL;
         break;
       }
@@ -649,14 +1022,14 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
       if (action_end is action_start) {
         error_at(LANG("sentencia auto vacía.",
                       "empty auto statement."),
-                 action_end, markers, src);
+                 action_end, markers, src, options);
         break;
       }
 
       Marker_p line_start =
         find_line_start(cursor, start_of_mut_Marker_array(markers), &err);
       if (err.message) {
-        error_at(err.message, err.position, markers, src);
+        error_at(err.message, err.position, markers, src, options);
         err.message = NULL;
         break;
       }
@@ -716,7 +1089,9 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
       // Copy buffer into pending mut_DeferredAction_array:
       mut_DeferredAction deferred = {
         .level = block_stack.len,
-        .action = move_Marker_array(&marker_buffer)
+        .action = move_Marker_array(&marker_buffer),
+        .label = ++label_count,
+        .targeted = false
       };
       push_DeferredAction_array(&pending, move_DeferredAction(&deferred));
 
@@ -729,9 +1104,10 @@ macro_defer(mut_Marker_array_p markers, mut_Byte_array_p src)
 
 free_all_and_return:
   if (err.message) {
-    error_at(err.message, err.position, markers, src);
+    error_at(err.message, err.position, markers, src, options);
     err.message = NULL;
   }
+  destruct_Marker_array(&return_type);
   destruct_Marker_array(&marker_buffer);
   destruct_DeferredAction_array(&pending);
   destruct_TokenType_array(&block_stack);
@@ -1,17 +1,22 @@
 /* -*- coding: utf-8 c-basic-offset: 2 tab-width: 2 indent-tabs-mode: nil -*-
  * vi: set et ts=2 sw=2: */
+/// Tokens that trigger `macro_slice()`.
+static TokenType slice_triggers[] = { T_ELLIPSIS, T_NONE };
+
 /// Because of the lack of fences, it works for
 /// structs and array initializers, and for separate function arguments.
 /// x[a..b] → &x[a], &x[b]
 /// x[a..+b] → &x[a], &x[a+b]
 /// Uses &x[a] in preference to x+a as advised in page 111 of
 /// “21st Century C” by Ben Klemens.
+/// The markers are edited in a gap array, with the gap
+/// right after the last replacement, so that each one moves only
+/// the markers since the previous one instead of the rest of the file.
 static void
-macro_slice(mut_Marker_array_p markers, mut_Byte_array_p src)
+macro_slice(mut_Marker_array_p markers, mut_Byte_array_p src,
+            Options_p options, Arena* arena)
 {
-  Marker_mut_p start  = start_of_Marker_array(markers);
-  Marker_mut_p cursor = start;
-  Marker_mut_p end    = end_of_Marker_array(markers);
+  mut_Marker_gap_array edited = init_Marker_gap_array(markers);
 
   mut_Error err = { .position = NULL, .message = NULL };
 
@@ -25,16 +30,35 @@ macro_slice(mut_Marker_array_p markers, mut_Byte_array_p src)
   Marker closeBraces      = Marker_from(src, "}", T_BLOCK_END);
   Marker addressOf        = Marker_from(src, "&", T_OP_2);
 
-  mut_Marker_array replacement = init_Marker_array(30);
+  mut_Marker_small_array_buffer replacement_inline;
+  mut_Marker_array replacement =
+      init_Marker_small_array(&replacement_inline);
 
-  while (cursor is_not end) {
+  for (size_t position = 0; position is_not edited.array.len; ++position) {
+    Marker_mut_p cursor = get_mut_Marker_gap_array(&edited, position);
     if (cursor->token_type is T_ELLIPSIS and cursor->len is 2) {
+      // Move the gap after the end of this line, so that the line and
+      // everything before it is contiguous from the start of the block.
+      move_gap_Marker_gap_array(&edited, position);
+      cursor = get_mut_Marker_gap_array(&edited, position);
+      Marker_p line_end =
+          find_line_end(cursor,
+                        edited.array.start + edited.array.capacity, &err);
+      err.message = NULL; // Reported below, if it matters.
+      size_t line_end_position = position + (size_t)(line_end - cursor);
+      if (line_end_position is_not edited.array.len) ++line_end_position;
+      move_gap_Marker_gap_array(&edited, line_end_position);
+      Marker_mut_p start = edited.array.start;
+      Marker_mut_p end   = start + edited.gap;
+      cursor = start + position;
+
       Marker_array_mut_slice a = {
         .start_p = find_line_start(cursor, start, &err),
         .end_p = cursor
       };
       if (err.message) {
-        error_at(err.message, err.position, markers, src);
+        *markers = flatten_Marker_gap_array(&edited);
+        error_at(err.message, err.position, markers, src, options);
         err.message = NULL;
         break;
       }
@@ -43,7 +67,8 @@ macro_slice(mut_Marker_array_p markers, mut_Byte_array_p src)
         .end_p = find_line_end(cursor, end, &err),
       };
       if (err.message) {
-        error_at(err.message, err.position, markers, src);
+        *markers = flatten_Marker_gap_array(&edited);
+        error_at(err.message, err.position, markers, src, options);
         err.message = NULL;
         break;
       }
@@ -129,19 +154,17 @@ macro_slice(mut_Marker_array_p markers, mut_Byte_array_p src)
           push_Marker_array(&replacement, space);
           push_Marker_array(&replacement, closeBraces);
         }
-        // Invalidates: markers
-        size_t cursor_position = (size_t)(array.start_p - start);
-        splice_Marker_array(markers, cursor_position,
-                            (size_t)(b.end_p + 1 - array.start_p), NULL,
-                            bounds_of_Marker_array(&replacement));
-        cursor_position += replacement.len;
-        start = start_of_Marker_array(markers);
-        end   =   end_of_Marker_array(markers);
-        cursor = start + cursor_position;
+        // Invalidates: start, end, cursor
+        position = (size_t)(array.start_p - start);
+        splice_Marker_gap_array(&edited, position,
+                                (size_t)(b.end_p + 1 - array.start_p),
+                                bounds_of_Marker_array(&replacement));
+        position += replacement.len;
+        if (position is edited.array.len) break;
       }
     }
-    ++cursor;
   }
+  if (edited.array.start) *markers = flatten_Marker_gap_array(&edited);
 
   destruct_Marker_array(&replacement);
 }
@@ -0,0 +1,19 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#pragma Cedro 1.0
+
+void
+print_twice(const char* text)
+{
+  char* copy = malloc(64);
+  auto free(copy);
+  if (copy) {
+    snprintf(copy, 64, "%s", text);
+#ifdef VERBOSE
+    fputs("copied\n", stderr);
+#endif
+  }
+  fputs(copy, stdout);
+  fputs(copy, stdout);
+}
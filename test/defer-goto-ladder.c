@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#pragma Cedro 1.0 goto-ladder
+
+static void
+log_value(int* value)
+{
+  printf("value: %d\n", *value);
+}
+
+void
+print_first(const char* file_name)
+{
+  FILE* file = fopen(file_name, "r");
+  if (!file) return;
+  auto fclose(file);
+
+  int c = fgetc(file);
+  if (c == EOF) return;
+  putchar(c);
+}
+
+int
+count_lines(const char* file_name)
+{
+  FILE* file = fopen(file_name, "r");
+  if (!file) return -1;
+  auto fclose(file);
+
+  int lines = 0;
+  int c;
+  while ((c = fgetc(file)) != EOF) {
+    char* buffer = malloc(16);
+    auto free(buffer);
+    if (c == '\r') continue;
+    if (c == '\0') break;
+    if (c == '\n') {
+      ++lines;
+      if (lines > 1000) return lines;
+    }
+  }
+  return lines;
+}
+
+int
+classify(int value)
+{
+  auto log_value(&value);
+  if (value < 0) {
+    int* copy = malloc(sizeof(int));
+    auto free(copy);
+    *copy = -value;
+    if (*copy > 100) return -2;
+    else return -1;
+  } else if (value == 0) return 0;
+  else return 1;
+}
+
+int
+dispatch(int command)
+{
+  char* state = malloc(8);
+  auto free(state);
+  switch (command) {
+    case 0:
+      return 10;
+    case 1: {
+      char* scratch = malloc(8);
+      auto free(scratch);
+      for (int i = 0; i < command; ++i) {
+        if (i == 3) break;
+        if (i == 7) return i;
+      }
+      return 11;
+    }
+    default:
+      break;
+  }
+  return -1;
+}
+
+int
+sum_squares(int n)
+{
+  int* numbers = malloc(sizeof(int));
+  auto free(numbers);
+  int squares[n];
+  for (int i = 0; i < n; ++i) squares[i] = i * i;
+  if (n > 100) return -1;
+  int sum = 0;
+  for (int i = 0; i < n; ++i) sum += squares[i];
+  return sum;
+}
@@ -0,0 +1,25 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#pragma Cedro 1.0
+
+// The indentation of the deferred actions in each function
+// comes from that function, not from this initializer.
+static const char* names[] = {
+    "first", "second", "third"
+};
+
+void
+print_lines(const char* file_name)
+{
+  FILE* file = fopen(file_name, "r");
+  if (!file) return;
+  auto fclose(file);
+
+  char* line = malloc(256);
+  auto free(line);
+  while (fgets(line, 256, file)) {
+    if (line[0] == '#') break;
+    fputs(line, stdout);
+  }
+}
@@ -0,0 +1,17 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+void
+print_twice(const char* text)
+{
+  char* copy = malloc(64);
+  if (copy) {
+    snprintf(copy, 64, "%s", text);
+#ifdef VERBOSE
+    fputs("copied\n", stderr);
+#endif
+  }
+  fputs(copy, stdout);
+  fputs(copy, stdout);
+  free(copy);
+}
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+static void
+log_value(int* value)
+{
+  printf("value: %d\n", *value);
+}
+
+void
+print_first(const char* file_name)
+{
+  FILE* file = fopen(file_name, "r");
+  if (!file) return;
+
+  int c = fgetc(file);
+  if (c == EOF) { goto cedro_defer_1; }
+  putchar(c);
+  cedro_defer_1: fclose(file);
+}
+
+int
+count_lines(const char* file_name)
+{
+  int cedro_returning = 0;
+  int cedro_result;
+  FILE* file = fopen(file_name, "r");
+  if (!file) return -1;
+
+  int lines = 0;
+  int c;
+  while ((c = fgetc(file)) != EOF) {
+    char* buffer = malloc(16);
+    if (c == '\r') {
+      free(buffer);
+      continue;
+    }
+    if (c == '\0') {
+      free(buffer);
+      break;
+    }
+    if (c == '\n') {
+      ++lines;
+      if (lines > 1000) { cedro_result = lines; cedro_returning = 1; goto cedro_defer_2; }
+    }
+    cedro_defer_2: free(buffer);
+    if (cedro_returning) goto cedro_defer_1;
+  }
+  cedro_result = lines; goto cedro_defer_1;
+  cedro_defer_1: fclose(file);
+  return cedro_result;
+}
+
+int
+classify(int value)
+{
+  int cedro_returning = 0;
+  int cedro_result;
+  if (value < 0) {
+    int* copy = malloc(sizeof(int));
+    *copy = -value;
+    if (*copy > 100) { cedro_result = -2; cedro_returning = 1; goto cedro_defer_2; }
+    else { cedro_result = -1; cedro_returning = 1; goto cedro_defer_2; }
+    cedro_defer_2: free(copy);
+    if (cedro_returning) goto cedro_defer_1;
+  } else if (value == 0) { cedro_result = 0; goto cedro_defer_1; }
+  else { cedro_result = 1; goto cedro_defer_1; }
+  cedro_defer_1: log_value(&value);
+  return cedro_result;
+}
+
+int
+dispatch(int command)
+{
+  int cedro_returning = 0;
+  int cedro_result;
+  char* state = malloc(8);
+  switch (command) {
+    case 0:
+      cedro_result = 10; goto cedro_defer_1;
+    case 1: {
+      char* scratch = malloc(8);
+      for (int i = 0; i < command; ++i) {
+        if (i == 3) break;
+        if (i == 7) { cedro_result = i; cedro_returning = 1; goto cedro_defer_2; }
+      }
+      cedro_result = 11; cedro_returning = 1; goto cedro_defer_2;
+      cedro_defer_2: free(scratch);
+      if (cedro_returning) goto cedro_defer_1;
+    }
+    default:
+      break;
+  }
+  cedro_result = -1; goto cedro_defer_1;
+  cedro_defer_1: free(state);
+  return cedro_result;
+}
+
+int
+sum_squares(int n)
+{
+  int* numbers = malloc(sizeof(int));
+  int squares[n];
+  for (int i = 0; i < n; ++i) squares[i] = i * i;
+  if (n > 100) {
+    free(numbers);
+    return -1;
+  }
+  int sum = 0;
+  for (int i = 0; i < n; ++i) sum += squares[i];
+  free(numbers);
+  return sum;
+}
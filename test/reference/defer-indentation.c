@@ -0,0 +1,23 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+// The indentation of the deferred actions in each function
+// comes from that function, not from this initializer.
+static const char* names[] = {
+    "first", "second", "third"
+};
+
+void
+print_lines(const char* file_name)
+{
+  FILE* file = fopen(file_name, "r");
+  if (!file) return;
+
+  char* line = malloc(256);
+  while (fgets(line, 256, file)) {
+    if (line[0] == '#') break;
+    fputs(line, stdout);
+  }
+  free(line);
+    fclose(file);
+}